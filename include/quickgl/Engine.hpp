@@ -21,6 +21,7 @@
 
 #include <memory>
 #include <vector>
+#include <mutex>
 
 #include "InputManager.hpp"
 #include "util/RenderStageComposer.hpp"
@@ -34,6 +35,9 @@ namespace qgl {
 	class GlobalEntityManager;
 	class IndirectDrawBufferGenerator;
 	class BlitCameraToScreen;
+	class EntityCommandBuffer;
+	class Scheduler;
+	class FrameTaskGraph;
 	
 	class Engine : public std::enable_shared_from_this<Engine> {
 	public:
@@ -57,6 +61,9 @@ namespace qgl {
 		void Render();
 		void SwapBuffers();
 		
+		// index of frame being rendered, incremented by each Render()
+		inline uint64_t GetFrameIndex() const { return frameIndex; }
+		
 		uint32_t GetEntitiesCount() const;
 		
 		void AddCamera(std::shared_ptr<Camera> camera);
@@ -69,11 +76,20 @@ namespace qgl {
 		
 		inline const std::vector<StageTiming> GetTimings() const { return renderStageComposer.GetTimings(); }
 		inline double CountCpuTime() const { return renderStageComposer.GetTotalCpuTime(); }
+		inline const std::vector<StageWait> GetStageWaits() const { return renderStageComposer.GetWaits(); }
+		inline double CountWaitTime() const { return renderStageComposer.GetTotalWaitTime(); }
 		
 		void EnableProfiling(bool value);
 		bool GetProfiling() const;
 		
 		std::shared_ptr<DeltaVboManager> GetDeltaVboManager();
+		/*
+		 * Limits capacity of upload ring, which otherwise adapts between
+		 * 1 MiB and 256 MiB. When called before InitGL() initial ring size is
+		 * clamped to these limits.
+		 */
+		void SetDeltaVboLimits(uint32_t minCapacityBytes,
+				uint32_t maxCapacityBytes);
 		std::shared_ptr<MoveVboManager> GetMoveVboManager();
 		
 		std::shared_ptr<GlobalEntityManager> GetGlobalEntityManager();
@@ -81,12 +97,40 @@ namespace qgl {
 		
 		std::shared_ptr<BlitCameraToScreen> GetBlitter() { return blitTexture; }
 		
+		std::shared_ptr<Scheduler> GetScheduler();
+		/*
+		 * Jobs added to graph are executed during next Render() on worker
+		 * pool, in between render stages.
+		 */
+		std::shared_ptr<FrameTaskGraph> GetFrameTaskGraph();
+		
+		/*
+		 * Creates command buffer for recording entity operations on other
+		 * threads. Buffers are applied in increasing sortKey order at the
+		 * beginning of Render(). Can be called from any thread. Buffer is
+		 * removed after its last commands are applied, once no other
+		 * reference to it exists.
+		 */
+		std::shared_ptr<EntityCommandBuffer> CreateEntityCommandBuffer(
+				uint32_t sortKey=0);
+		
+	protected:
+		
+		void ApplyEntityCommandBuffers();
+		
 	protected:
 		
+		static constexpr int64_t MAX_FENCE_WAIT_NANOSECONDS = 1000000;
+		static constexpr int64_t MAX_JOB_WAIT_NANOSECONDS = 1000000;
+		// used when no fence and no job can unblock stages
+		static constexpr int64_t IDLE_SLEEP_NANOSECONDS = 50000;
+		
 		bool profiling;
 		
 		bool initialized;
 		
+		uint64_t frameIndex;
+		
 		InputManager inputManager;
 		RenderStageComposer renderStageComposer;
 		
@@ -95,6 +139,8 @@ namespace qgl {
 		std::set<std::shared_ptr<Camera>> cameras;
 		
 		std::shared_ptr<DeltaVboManager> deltaVboManager;
+		uint32_t deltaVboMinCapacity;
+		uint32_t deltaVboMaxCapacity;
 		std::shared_ptr<MoveVboManager> moveVboManager;
 		
 		std::shared_ptr<GlobalEntityManager> globalEntityManager;
@@ -104,6 +150,12 @@ namespace qgl {
 		std::shared_ptr<BlitCameraToScreen> blitTexture;
 		
 		std::shared_ptr<Pipeline> pipelinePostProcessing;
+		
+		std::shared_ptr<Scheduler> scheduler;
+		std::shared_ptr<FrameTaskGraph> frameTaskGraph;
+		
+		std::vector<std::shared_ptr<EntityCommandBuffer>> entityCommandBuffers;
+		std::mutex entityCommandBuffersMutex;
 	};
 }
 
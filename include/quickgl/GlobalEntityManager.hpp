@@ -20,9 +20,8 @@
 #define QUICKGL_GLOBAL_ENTITY_MANAGER_HPP
 
 #include <memory>
-#include <unordered_map>
-#include <unordered_set>
 
+#include "util/EntityRegistry.hpp"
 #include "Engine.hpp"
 
 namespace qgl {
@@ -32,10 +31,8 @@ namespace qgl {
 	class GlobalEntityManager final {
 	public:
 		
-		struct PipelineOffsetPair {
-			uint32_t offset;
-			uint32_t pipelineId;
-		};
+		static constexpr uint32_t INVALID_OFFSET
+			= EntityRegistry::INVALID_OFFSET;
 		
 		GlobalEntityManager(std::shared_ptr<Engine> engine);
 		~GlobalEntityManager();
@@ -44,30 +41,46 @@ namespace qgl {
 				uint32_t offset);
 		void FreeEntity(uint32_t entity);
 		
-		uint32_t GetEntityOffset(uint32_t entity);
+		/*
+		 * Creates count entities placed at offsets [firstOffset,
+		 * firstOffset+count) of given pipeline.
+		 */
+		void GetNewEntities(std::shared_ptr<Pipeline> pipeline,
+				uint32_t firstOffset, uint32_t count, uint32_t* outEntities);
+		
+		// returns INVALID_OFFSET for deleted or never existing entity
+		inline uint32_t GetEntityOffset(uint32_t entity) const {
+			return registry.GetOffset(entity);
+		}
+		inline bool IsEntityValid(uint32_t entity) const {
+			return registry.IsValid(entity);
+		}
+		inline uint32_t GetEntityPipelineId(uint32_t entity) const {
+			return registry.GetPipelineId(entity);
+		}
+		inline uint32_t GetEntitiesCount() const { return registry.Count(); }
 		template<typename T>
 		std::shared_ptr<T> GetEntityPipeline(uint32_t entity);
 		
 		void SetEntityOffset(uint32_t entity, uint32_t offset);
-		void SetEntityPipeline(uint32_t entity, uint32_t offset);
+		void SetEntityPipeline(uint32_t entity, uint32_t pipelineId,
+				uint32_t offset);
 		
 	private:
 		
 		std::shared_ptr<Engine> engine;
 		
-		uint32_t allEntitiesAdded;
-		uint32_t lastAddedEntity;
-		std::unordered_map<uint32_t, PipelineOffsetPair> mapEntity;
+		uint64_t allEntitiesAdded;
+		EntityRegistry registry;
 	};
 	
 	template<typename T>
 	std::shared_ptr<T> GlobalEntityManager::GetEntityPipeline(uint32_t entity) {
-		auto it = mapEntity.find(entity);
-		if(it == mapEntity.end()) {
+		const uint32_t pipelineId = registry.GetPipelineId(entity);
+		if(pipelineId == EntityRegistry::INVALID_PIPELINE) {
 			return nullptr;
 		}
-		return std::dynamic_pointer_cast<T>(
-				engine->GetPipeline(it->second.pipelineId));
+		return std::dynamic_pointer_cast<T>(engine->GetPipeline(pipelineId));
 	}
 }
 
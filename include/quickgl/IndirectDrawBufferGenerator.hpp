@@ -19,8 +19,12 @@
 #ifndef QUICKGL_INDIRECT_DRAW_BUFFER_GENERATOR_HPP
 #define QUICKGL_INDIRECT_DRAW_BUFFER_GENERATOR_HPP
 
+#include <cinttypes>
+
 #include <memory>
 
+#include "util/DeltaVboManager.hpp"
+
 namespace gl {
 	class VBO;
 	class Shader;
@@ -28,7 +32,15 @@ namespace gl {
 
 namespace qgl {
 	class Engine;
-	class DeltaVboManager;
+	
+	// layout of commands consumed by glMultiDrawElementsIndirect
+	struct DrawElementsIndirectCommand {
+		uint32_t count;
+		uint32_t instanceCount;
+		uint32_t firstIndex;
+		int32_t baseVertex;
+		uint32_t baseInstance;
+	};
 	
 	class IndirectDrawBufferGenerator final {
 	public:
@@ -39,27 +51,56 @@ namespace qgl {
 		void Init();
 		void Destroy();
 		
-		std::shared_ptr<gl::VBO> Generate(
+		/*
+		 * Generates commands into region of DeltaVboManager ring buffer.
+		 * meshIds holds mesh id of every entity, meshTable is
+		 * MeshManager::GetMeshTable().
+		 */
+		DeltaVboManager::Region Generate(
 				gl::VBO& entitiesToRender,
-				gl::VBO& meshInfo,
+				gl::VBO& meshIds,
+				gl::VBO& meshTable,
 				uint32_t entitiesCount,
 				uint32_t entitiesOffset,
 				uint32_t& generatedCount);
 		
+		/*
+		 * When meshes are stored in multiple pages, commands are bucketed by
+		 * page: commands of page p are written starting at pageOffsets[p],
+		 * which are exclusive prefix sums of numbers of entities using each
+		 * page. Order of commands inside of page is not specified.
+		 */
 		void Generate(
 				gl::VBO& entitiesToRender,
-				gl::VBO& meshInfo,
+				gl::VBO& meshIds,
+				gl::VBO& meshTable,
 				gl::VBO& indirectDrawBuffer,
 				uint32_t entitiesCount,
-				uint32_t entitiesOffset);
+				uint32_t entitiesOffset,
+				const uint32_t* pageOffsets=nullptr,
+				uint32_t pagesCount=1);
+		
+	private:
+		
+		void Dispatch(
+				gl::VBO& entitiesToRender,
+				gl::VBO& meshIds,
+				gl::VBO& meshTable,
+				uint32_t entitiesCount,
+				uint32_t entitiesOffset,
+				uint32_t pagesCount);
 		
 	private:
 		
 		std::shared_ptr<gl::Shader> shader;
 		std::shared_ptr<Engine> engine;
 		
+		// per page write positions of commands, used with multiple pages
+		std::shared_ptr<gl::VBO> pageCursors;
+		
 		uint32_t ENTITIES_COUNT_LOCATION;
 		uint32_t ENTITIES_OFFSET_LOCATION;
+		uint32_t PAGES_COUNT_LOCATION;
 		
 		static const char* INDIRECT_DRAW_BUFFER_COMPUTE_SHADER_SOURCE;
 	};
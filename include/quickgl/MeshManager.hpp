@@ -24,6 +24,8 @@
 #include <vector>
 #include <map>
 #include <set>
+#include <deque>
+#include <unordered_map>
 
 #include <glm/glm.hpp>
 
@@ -34,6 +36,8 @@
 
 namespace gl {
 	class VBO;
+	class Shader;
+	class Sync;
 	namespace BasicMeshLoader {
 		class Mesh;
 		class AssimpLoader;
@@ -52,6 +56,19 @@ namespace qgl {
 			uint32_t countElements;
 			uint32_t firstVertex;
 			uint32_t countVertices;
+			uint32_t page;
+			float boundingSphereCenterOffset[3];
+			float boundingSphereRadius;
+		};
+		
+		/*
+		 * Record of mesh table stored on GPU, entities refer to it by mesh id.
+		 */
+		struct MeshTableEntry {
+			uint32_t elementsStart;
+			uint32_t elementsCount;
+			uint32_t page;
+			uint32_t reserved; // for LOD data
 			float boundingSphereCenterOffset[3];
 			float boundingSphereRadius;
 		};
@@ -76,6 +93,8 @@ namespace qgl {
 		
 		void GetMeshIndices(uint32_t meshId, uint32_t& indexStart,
 				uint32_t& indexCount);
+		void GetMeshIndices(uint32_t meshId, uint32_t& indexStart,
+				uint32_t& indexCount, uint32_t& page);
 		void GetMeshBoundingSphere(uint32_t meshId, float* offset,
 				float& radius);
 		
@@ -89,8 +108,67 @@ namespace qgl {
 		
 		bool LoadMesh(gl::BasicMeshLoader::Mesh* mesh);
 		
-		gl::VBO& GetVBO() { return vbo; }
-		gl::VBO& GetEBO() { return ebo; }
+		/*
+		 * In paged mode mesh data is stored in list of fixed size vertex and
+		 * element buffer pages. A mesh never crosses page boundary and
+		 * growing appends new page, without copying existing data. Mesh
+		 * bigger than page gets its own page. Has to be called before any
+		 * mesh is loaded.
+		 */
+		void EnablePaging(uint32_t verticesPerPage, uint32_t elementsPerPage);
+		
+		inline uint32_t GetPagesCount() const { return pages.size(); }
+		gl::VBO& GetVBO(uint32_t page=0) { return pages[page]->vboAllocator.Vbo(); }
+		gl::VBO& GetEBO(uint32_t page=0) { return pages[page]->eboAllocator.Vbo(); }
+		
+		/*
+		 * Statistics are counted in vertices and indices respectively.
+		 */
+		inline Allocator::Stats GetVertexBufferStats(uint32_t page=0) const {
+			return pages[page]->vboAllocator.GetStats();
+		}
+		inline Allocator::Stats GetElementBufferStats(uint32_t page=0) const {
+			return pages[page]->eboAllocator.GetStats();
+		}
+		
+		/*
+		 * Grows vertex and element buffers up front to hold at least given
+		 * number of vertices and indices, to avoid reallocations later. In
+		 * paged mode pages are appended until their sum fits given numbers.
+		 * CompactBuffers() will not shrink buffers below reserved capacity.
+		 */
+		void ReserveCapacity(uint32_t vertices, uint32_t elements);
+		
+		/*
+		 * Moves meshes into free ranges closer to beginning of vertex and
+		 * element buffers, copying at most bytesBudget bytes on GPU, then
+		 * shrinks buffers if enough space was freed at their ends. Moved
+		 * meshes get their mesh table records updated, entities refer to
+		 * meshes by id, so they need no updates. Meshes never move between
+		 * pages and pages are never shrunk. Executed at most once per
+		 * frameIndex, so every pipeline sharing this MeshManager can call it.
+		 */
+		void CompactBuffers(uint32_t bytesBudget, uint64_t frameIndex);
+		
+		/*
+		 * Freed and relocated mesh ranges are not reused until GPU finishes
+		 * frame in which they were freed. Has to be called once per frame,
+		 * it fences current frame and releases ranges of frames already
+		 * finished by GPU.
+		 */
+		void ProcessDeferredFrees();
+		
+		/*
+		 * Shader storage buffer of MeshTableEntry indexed by mesh id. Records
+		 * of freed meshes have elementsCount equal 0.
+		 */
+		inline gl::VBO& GetMeshTable() { return meshTable.Vbo(); }
+		
+		/*
+		 * Uploads records of meshes loaded, freed or moved since last call.
+		 * Has to be called in each frame before mesh table is read on GPU.
+		 */
+		void UpdateMeshTable();
 		
 	protected:
 		
@@ -98,17 +176,67 @@ namespace qgl {
 		virtual bool LoadModels(
 				std::shared_ptr<gl::BasicMeshLoader::AssimpLoader> loader);
 		
+		struct Page {
+			Page(uint32_t vertexSize, uint32_t epoch);
+			
+			AllocatorVBO vboAllocator;
+			AllocatorVBO eboAllocator;
+			
+			std::unordered_map<uint32_t, uint32_t> meshIdByFirstVertex;
+			std::unordered_map<uint32_t, uint32_t> meshIdByFirstElement;
+		};
+		
+		void AllocateMesh(MeshInfo& info);
+		Page& AppendPage(uint32_t vertices, uint32_t elements);
+		void CompactPage(uint32_t page, uint32_t& bytesBudget);
+		void UpdateMeshTableEntry(uint32_t meshId);
+		void QueueRebaseIndices(uint32_t meshId, uint32_t oldFirstVertex,
+				uint32_t newFirstVertex);
+		// rebases all queued meshes with single dispatch
+		void RebaseIndices(gl::VBO& ebo);
+		
 	protected:
 		
 		std::map<std::string, uint32_t> mapNameToId;
 		std::vector<MeshInfo> meshInfo;
 		IdsManager idsManager;
 		
-		AllocatorVBO vboAllocator;
-		gl::VBO& vbo;
+		TypedVBO<MeshTableEntry> meshTable;
+		// range of mesh table records changed since last UpdateMeshTable()
+		uint32_t meshTableDirtyBegin;
+		uint32_t meshTableDirtyEnd;
+		
+		std::vector<std::unique_ptr<Page>> pages;
+		uint32_t verticesPerPage;
+		uint32_t elementsPerPage;
+		
+		struct EpochFence {
+			uint32_t epoch;
+			std::shared_ptr<gl::Sync> sync;
+		};
+		std::deque<EpochFence> epochFences;
+		uint32_t currentEpoch;
+		bool epochHasDeferredFrees;
+		uint32_t reservedVertices;
+		uint32_t reservedElements;
 		
-		AllocatorVBO eboAllocator;
-		gl::VBO& ebo;
+		uint64_t lastCompactionFrame;
+		
+		struct RebaseRecord {
+			uint32_t firstElement;
+			// sum of elements of previous records
+			uint32_t elementsOffset;
+			uint32_t oldFirstVertex;
+			uint32_t newFirstVertex;
+		};
+		std::vector<RebaseRecord> rebaseRecords;
+		std::vector<uint32_t> rebaseRecordMeshes;
+		// record index by mesh id, for meshes moved more than once in a pass
+		std::unordered_map<uint32_t, uint32_t> rebaseRecordByMesh;
+		std::unique_ptr<gl::VBO> rebaseRecordsBuffer;
+		std::unique_ptr<gl::Shader> rebaseIndicesShader;
+		int32_t rebaseIndicesUniformLocations[2];
+		static const char* REBASE_INDICES_COMPUTE_SHADER_SOURCE;
 		
 		bool(*const meshAppenderVertices)(
 				std::vector<uint8_t>& buffer,
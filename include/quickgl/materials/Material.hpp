@@ -19,6 +19,8 @@
 #ifndef QUICKGL_MATERIAL_HPP
 #define QUICKGL_MATERIAL_HPP
 
+#include <cinttypes>
+
 #include <memory>
 #include <string>
 
@@ -47,9 +49,15 @@ namespace qgl {
 		
 		virtual std::string GetName() const = 0;
 		
+		/*
+		 * Commands of mesh page p are stored in indirectBuffer starting at
+		 * command pageOffsets[p], there are pageCounts[p] of them.
+		 */
 		virtual void RenderPassIndirect(std::shared_ptr<Camera> camera,
 				gl::VBO& indirectBuffer,
-				uint32_t entitiesCount) = 0;
+				const uint32_t* pageOffsets,
+				const uint32_t* pageCounts,
+				uint32_t pagesCount) = 0;
 		
 	protected:
 		
@@ -19,6 +19,8 @@
 #ifndef QUICKGL_MATERIAL_STATIC_HPP
 #define QUICKGL_MATERIAL_STATIC_HPP
 
+#include <vector>
+
 #include <glm/glm.hpp>
 #include <glm/ext/quaternion_trigonometric.hpp>
 #include <glm/fwd.hpp>
@@ -50,11 +52,18 @@ namespace qgl {
 		
 		virtual void RenderPassIndirect(std::shared_ptr<Camera> camera,
 				gl::VBO& indirectBuffer,
-				uint32_t entitiesCount) override;
+				const uint32_t* pageOffsets,
+				const uint32_t* pageCounts,
+				uint32_t pagesCount) override;
+		
+	private:
+		
+		void InitVao(uint32_t page);
 		
 	private:
 		
-		std::shared_ptr<gl::VAO> vao;
+		// one vao per mesh manager page
+		std::vector<std::shared_ptr<gl::VAO>> vaos;
 		std::shared_ptr<gl::Shader> renderShader;
 		std::shared_ptr<PipelineStatic> pipeline;
 		
@@ -86,6 +86,33 @@ namespace qgl {
 		
 		virtual uint32_t GetEntityOffset(uint32_t entityId) const = 0;
 		
+	public: // batched variants, default implementations loop over single
+			// entity functions
+		
+		virtual void CreateEntities(uint32_t count, uint32_t* outEntityIds);
+		virtual void DeleteEntities(const uint32_t* entityIds, uint32_t count);
+		virtual void SetEntityMeshes(const uint32_t* entityIds, uint32_t count,
+				const uint32_t* meshIds);
+		// pos, rot and scale may be nullptr, then default values are used
+		virtual void SetEntityTransforms(const uint32_t* entityIds,
+				uint32_t count, const glm::vec3* pos, const glm::quat* rot,
+				const glm::vec3* scale);
+		
+		/*
+		 * Moves entities of this pipeline to target pipeline keeping their
+		 * handles. meshIds are ids of meshes of target pipeline, may be
+		 * nullptr when both pipelines share MeshManager. Not every pipeline
+		 * supports migration, default implementation throws.
+		 * Transforms and values of component columns existing in both
+		 * pipelines are preserved, other per-entity data of target pipeline
+		 * is initialized as for newly created entities.
+		 */
+		virtual void MigrateEntities(const uint32_t* entityIds,
+				uint32_t count, std::shared_ptr<Pipeline> target,
+				const uint32_t* meshIds);
+		void MigrateEntity(uint32_t entityId, std::shared_ptr<Pipeline> target,
+				uint32_t meshId);
+		
 		inline std::shared_ptr<Engine> GetEngine() { return engine; }
 		
 	protected:
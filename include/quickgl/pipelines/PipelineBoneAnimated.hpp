@@ -54,7 +54,9 @@ namespace qgl {
 		
 	protected:
 		
-		void UpdateAnimationData(std::shared_ptr<Camera> camera);
+		virtual void InitNewEntities(uint32_t firstOffset,
+				uint32_t count) override;
+		
 		void UpdateAnimationState(std::shared_ptr<Camera> camera);
 		void RenderEntities(std::shared_ptr<Camera> camera);
 		int32_t ENTITIES_COUNT_LOCATION;
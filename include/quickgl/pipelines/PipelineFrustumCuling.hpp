@@ -19,6 +19,8 @@
 #ifndef QUICKGL_PIPELINE_FRUSTUM_CULLING_HPP
 #define QUICKGL_PIPELINE_FRUSTUM_CULLING_HPP
 
+#include <vector>
+
 #include <glm/glm.hpp>
 #include <glm/ext/quaternion_trigonometric.hpp>
 #include <glm/fwd.hpp>
@@ -53,13 +55,20 @@ namespace qgl {
 		void PerformFrustumCulling(std::shared_ptr<Camera> camera);
 		void FetchFrustumCulledEntitiesCount(std::shared_ptr<Camera> camera);
 		bool CanExecuteFetchFrustumCulledEntitiesCount(std::shared_ptr<Camera> camera);
+		gl::Sync* GetFetchFrustumCulledEntitiesCountSync(std::shared_ptr<Camera> camera);
 		void GenerateIndirectDrawCommandBuffer(std::shared_ptr<Camera> camera);
 		
+		void ReserveCullingCounters(uint32_t pagesCount);
+		
 		uint32_t UNIFORM_LOCATION_DEPTH_TEXTURE;
 		
 	protected:
 		
 		uint32_t frustumCulledEntitiesCount;
+		// number of culled entities using each mesh page and offsets of
+		// their commands in indirectDrawBuffer
+		std::vector<uint32_t> frustumCulledPageCounts;
+		std::vector<uint32_t> frustumCulledPageOffsets;
 		
 	protected:
 		
@@ -75,7 +84,9 @@ namespace qgl {
 		
 		gl::Sync syncFrustumCulledEntitiesCountReadyToFetch;
 		
+		// {culled entities count, 1, 1, culled entities count per page...}
 		uint32_t *mappedPointerToentitiesCount;
+		uint32_t countersPagesCapacity;
 		
 		uint32_t objectsPerInvocation;
 	};
@@ -47,30 +47,114 @@ namespace qgl {
 		
 		virtual uint32_t GetEntityOffset(uint32_t entityId) const override;
 		
+		virtual void CreateEntities(uint32_t count,
+				uint32_t* outEntityIds) override;
+		virtual void DeleteEntities(const uint32_t* entityIds,
+				uint32_t count) override;
+		virtual void SetEntityMeshes(const uint32_t* entityIds, uint32_t count,
+				const uint32_t* meshIds) override;
+		virtual void SetEntityTransforms(const uint32_t* entityIds,
+				uint32_t count, const glm::vec3* pos, const glm::quat* rot,
+				const glm::vec3* scale) override;
+		
+		virtual void MigrateEntities(const uint32_t* entityIds,
+				uint32_t count, std::shared_ptr<Pipeline> target,
+				const uint32_t* meshIds) override;
+		
+		/*
+		 * Per-entity component columns are registered here.
+		 */
+		inline std::shared_ptr<EntityBufferManager> GetEntityBufferManager() {
+			return entityBufferManager;
+		}
+		
+		/*
+		 * When enabled transforms are uploaded as position, rotation and
+		 * scale (44 bytes per update instead of 68) and expanded into
+		 * matrices on GPU.
+		 */
+		inline void EnableCompactTransformUploads(bool enable) {
+			compactTransformUploads = enable;
+		}
+		
+		/*
+		 * Limits number of bytes of mesh data moved on GPU per frame while
+		 * compacting mesh buffers. 0 disables compaction. MeshManager shared
+		 * by several pipelines is compacted once per frame, with budget of
+		 * pipeline whose stage runs first.
+		 */
+		inline void SetMeshCompactionBudget(uint32_t bytesPerFrame) {
+			meshCompactionBytesPerFrame = bytesPerFrame;
+		}
+		
 	protected:
 		
 		void UpdateIDManagerData(std::shared_ptr<Camera>);
 		void UpdateEntityBufferManager(std::shared_ptr<Camera>);
+		void CompactMeshBuffers(std::shared_ptr<Camera>);
+		void ReleaseFreedMeshRanges(std::shared_ptr<Camera>);
 		
-	protected:
-
-		struct PerEntityMeshInfo {
-			uint32_t elementsStart;
-			uint32_t elementsCount;
-		};
+		void StageTransformTRS(uint32_t offset, const glm::vec3& pos,
+				const glm::quat& rot, const glm::vec3& scale);
+		void UploadTransformsTRS();
 		
-		struct PerEntityMeshInfoBoundingSphere {
-			float boundingSphereCenterOffset[3];
-			float boundingSphereRadius;
-		};
+		/*
+		 * Fills batchOffsets with offsets of given entities. Returns true when
+		 * offsets are contiguous and increasing.
+		 */
+		bool GatherEntityOffsets(const uint32_t* entityIds, uint32_t count);
 		
-		ManagedSparselyUpdatedVBO<PerEntityMeshInfo> perEntityMeshInfo;
+		/*
+		 * Initializes pipeline specific per-entity data of entities placed at
+		 * [firstOffset, firstOffset+count) by batched creation or migration.
+		 */
+		virtual void InitNewEntities(uint32_t firstOffset, uint32_t count);
 		
-		ManagedSparselyUpdatedVBO<PerEntityMeshInfoBoundingSphere> perEntityMeshInfoBoundingSphere;
+		/*
+		 * Stages in dst transforms staged here in compact form for entities
+		 * of batchIds, which were already adopted by dst.
+		 */
+		void MigrateStagedTransformsTRS(PipelineIdsManagedBase& dst);
+		
+	protected:
+		
+		// mesh ids, mesh data is read on GPU from MeshManager::GetMeshTable()
+		ManagedSparselyUpdatedVBO<uint32_t> perEntityMeshId;
 		
 		ManagedSparselyUpdatedVBO<glm::mat4> transformMatrices;
 		
+		// all per entity buffers updated with single dispatch, derived
+		// pipelines may add their own buffers in Init()
+		ManagedSparselyUpdatedVBOGroup perEntityBuffers;
+		
 		std::shared_ptr<EntityBufferManager> entityBufferManager;
+		
+		struct PerEntityTransformTRS {
+			float pos[3];
+			float rot[4]; // x, y, z, w
+			float scale[3];
+			uint32_t offset;
+		};
+		
+		bool compactTransformUploads;
+		std::vector<PerEntityTransformTRS> stagedTransformsTRS;
+		// for every offset: index+1 in stagedTransformsTRS, 0 when not staged
+		std::vector<uint32_t> stagedTransformsTRSSlots;
+		uint32_t stagedTransformsTRSMaxOffset;
+		std::unique_ptr<gl::Shader> expandTransformsTRSShader;
+		int32_t expandTransformsTRSUniformLocation;
+		static const char* EXPAND_TRANSFORMS_TRS_COMPUTE_SHADER_SOURCE;
+		
+		// scratch buffers reused by batched functions
+		std::vector<uint32_t> batchOffsets;
+		std::vector<glm::mat4> batchTransforms;
+		std::vector<uint32_t> batchIds;
+		std::vector<uint32_t> batchMeshIds;
+		
+		uint32_t meshCompactionBytesPerFrame;
+		// set by stages writing entity buffers with shaders, buffer copies of
+		// migration need barrier first
+		bool shaderWritesBeforeMigration;
 	};
 }
 
@@ -21,12 +21,42 @@
 
 #include <cinttypes>
 #include <vector>
-#include <map>
+#include <deque>
+#include <unordered_map>
 
 namespace qgl {
+	/*
+	 * Two-level segregated fit (TLSF) range allocator. Allocate() and Free()
+	 * are constant time, free ranges are coalesced with their physical
+	 * neighbours immediately on Free().
+	 */
 	class Allocator {
 	public:
 		
+		struct Relocation {
+			uint32_t from;
+			uint32_t to;
+			uint32_t count;
+		};
+		
+		struct Stats {
+			uint32_t capacity;
+			uint32_t liveElements;
+			uint32_t liveAllocations;
+			uint32_t freeElements;
+			uint32_t quarantinedElements;
+			uint32_t freeRanges;
+			uint32_t largestFreeRange;
+			// 0 when all free elements form single range, approaches 1 when
+			// free space is scattered into many small ranges
+			float fragmentation;
+			uint32_t growthCount;
+			uint64_t grownElements;
+			// allocationSizeHistogram[i] counts live allocations with size in
+			// range [2^i, 2^(i+1))
+			uint32_t allocationSizeHistogram[32];
+		};
+		
 		void Init(void* bufferObject,
 				void(*resize)(void*, uint32_t newSize),
 				void(*destructor)(void*));
@@ -36,13 +66,123 @@ namespace qgl {
 				void(*destructor)(void*));
 		~Allocator();
 		
+		static constexpr uint32_t INVALID_OFFSET = 0xFFFFFFFF;
+		
 		uint32_t Allocate(uint32_t count);
+		// Does not grow buffer, returns INVALID_OFFSET if range does not fit
+		uint32_t TryAllocate(uint32_t count);
 		void Free(uint32_t ptr, uint32_t count);
 		void ReserveAdditional(uint32_t additionalElements);
 		
+		/*
+		 * Moves (in bookkeeping only) one allocated range of at most maxCount
+		 * elements into lower free range. Caller has to copy data from
+		 * relocation.from to relocation.to. Returns false if no allocated
+		 * range can be moved closer to beginning of buffer. Consecutive calls
+		 * continue walking blocks from where the previous call stopped.
+		 */
+		bool Relocate(uint32_t maxCount, Relocation& relocation);
+		
+		/*
+		 * Releases free space at the end of buffer. Quarter of used space is
+		 * left as headroom, so that following allocations do not immediately
+		 * grow buffer again. Returns new capacity.
+		 */
+		uint32_t ShrinkToFit(uint32_t minimalCapacity);
+		
+		/*
+		 * Deferred freeing. After first call to BeginEpoch() ranges freed with
+		 * FreeDeferred() and ranges left by Relocate() stay in quarantine,
+		 * tagged with current epoch, until ReleaseEpochs() is called with
+		 * that or later epoch. Epochs have to be increasing.
+		 */
+		void BeginEpoch(uint32_t epoch);
+		void FreeDeferred(uint32_t ptr, uint32_t count);
+		void ReleaseEpochs(uint32_t lastEpochToRelease);
+		
+		/*
+		 * All counters except largestFreeRange are maintained incrementally,
+		 * largestFreeRange walks only single free list of the largest size
+		 * class.
+		 */
+		Stats GetStats() const;
+		inline uint32_t GetCapacity() const { return allocated; }
+		
+	protected:
+		
+		struct Block {
+			uint32_t offset;
+			uint32_t size;
+			uint32_t prevPhysical;
+			uint32_t nextPhysical;
+			uint32_t prevFree;
+			uint32_t nextFree;
+			bool isFree;
+			bool isQuarantined;
+		};
+		
+		uint32_t FindSuitableBlock(uint32_t size);
+		uint32_t FindFittingBlockInClass(uint32_t size);
+		uint32_t GetUsedBlock(uint32_t offset) const;
+		uint32_t FindLowestFreeBlock();
+		void OnBlockFreed(uint32_t block);
+		
+		void InsertFreeBlock(uint32_t block);
+		void RemoveFreeBlock(uint32_t block);
+		
+		void MarkUsed(uint32_t block);
+		void UnmarkUsed(uint32_t block);
+		
+		uint32_t SplitBlock(uint32_t block, uint32_t size);
+		uint32_t MergeWithNeighbours(uint32_t block);
+		
+		uint32_t NewBlock();
+		void ReleaseBlock(uint32_t block);
+		
+		static void MappingInsert(uint32_t size, uint32_t& fl, uint32_t& sl);
+		static void MappingSearch(uint32_t size, uint32_t& fl, uint32_t& sl);
+		
 	protected:
 		
-		std::map<uint32_t, uint32_t> freeRanges; // { offset, size }
+		static constexpr uint32_t NONE = 0xFFFFFFFF;
+		static constexpr uint32_t SL_INDEX_COUNT_LOG2 = 5;
+		static constexpr uint32_t SL_INDEX_COUNT = 1 << SL_INDEX_COUNT_LOG2;
+		static constexpr uint32_t FL_INDEX_COUNT = 32 - SL_INDEX_COUNT_LOG2 + 1;
+		
+		std::vector<Block> blocks;
+		std::vector<uint32_t> unusedBlocks;
+		// used and quarantined blocks by their offset, sized by number of
+		// blocks rather than by capacity
+		std::unordered_map<uint32_t, uint32_t> usedBlockByOffset;
+		uint32_t firstPhysicalBlock;
+		uint32_t lastPhysicalBlock;
+		bool mayRelocate;
+		// next block to be checked by Relocate(), NONE starts from last block
+		uint32_t relocateCursor;
+		// no free block lies before this one, NONE starts from first block
+		uint32_t lowestFreeCursor;
+		
+		struct QuarantinedRange {
+			uint32_t epoch;
+			uint32_t offset;
+			uint32_t size;
+		};
+		std::deque<QuarantinedRange> quarantine;
+		uint32_t currentEpoch;
+		bool deferredFree;
+		uint32_t quarantinedElements;
+		
+		uint32_t flBitmap;
+		uint32_t slBitmap[FL_INDEX_COUNT];
+		uint32_t freeLists[FL_INDEX_COUNT][SL_INDEX_COUNT];
+		
+		uint32_t liveElements;
+		uint32_t liveAllocations;
+		uint32_t freeRanges;
+		uint32_t growthCount;
+		uint64_t grownElements;
+		uint32_t allocationSizeHistogram[32];
+		
 		uint32_t allocated;
 		void* bufferObject;
 		void(*resize)(void*, uint32_t newSize);
@@ -51,4 +191,3 @@ namespace qgl {
 }
 
 #endif
-
@@ -0,0 +1,218 @@
+/*
+ *  This file is part of QuickGL.
+ *  Copyright (C) 2023 Marek Zalewski aka Drwalin
+ *
+ *  QuickGL is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  QuickGL is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef QUICKGL_COMPONENT_COLUMN_HPP
+#define QUICKGL_COMPONENT_COLUMN_HPP
+
+#include <cinttypes>
+
+#include <string>
+#include <vector>
+#include <memory>
+#include <algorithm>
+
+#include "ManagedSparselyUpdatedVBO.hpp"
+
+namespace qgl {
+	class Engine;
+	class GlobalEntityManager;
+	
+	struct EntityMove {
+		uint32_t from;
+		uint32_t to;
+	};
+	
+	enum ComponentStorage : uint32_t {
+		COMPONENT_STORAGE_HOST = 1,
+		COMPONENT_STORAGE_GPU = 2,
+		COMPONENT_STORAGE_HOST_AND_GPU = 3,
+	};
+	
+	/*
+	 * Per-entity data column indexed by entity offset. Host part is a plain
+	 * array readable on CPU, GPU part is sparsely updated shader storage
+	 * buffer. Columns are owned by EntityBufferManager and follow entity
+	 * moves together with other entity buffers. Column accepts only entities
+	 * of pipeline owning it, values of created and adopted entities are reset
+	 * to column default value. Host only column may be created without
+	 * engine, then it is accessible only by offsets.
+	 */
+	class UntypedComponentColumn {
+	public:
+		
+		UntypedComponentColumn(std::shared_ptr<Engine> engine,
+				const std::string& name, uint32_t elementSize,
+				ComponentStorage storage, uint32_t pipelineId);
+		virtual ~UntypedComponentColumn();
+		
+		void Init();
+		void Destroy();
+		
+		inline const std::string& GetName() const { return name; }
+		inline ComponentStorage GetStorage() const { return storage; }
+		inline uint32_t GetPipelineId() const { return pipelineId; }
+		inline bool HasHost() const { return storage & COMPONENT_STORAGE_HOST; }
+		inline bool HasGpu() const { return storage & COMPONENT_STORAGE_GPU; }
+		
+		// nullptr when column has no GPU storage
+		inline UntypedManagedSparselyUpdatedVBO* GetGpu() { return gpu.get(); }
+		
+		virtual void MoveHost(const EntityMove* moves, uint32_t count) = 0;
+		// sets values at [firstOffset, firstOffset+count) to default value
+		virtual void Reset(uint32_t firstOffset, uint32_t count) = 0;
+		/*
+		 * Copies host values of src at srcOffsets to offsets
+		 * [dstOffset, dstOffset+count). Does nothing when src stores values of
+		 * different type.
+		 */
+		virtual void CopyHostFrom(const UntypedComponentColumn& src,
+				const uint32_t* srcOffsets, uint32_t count,
+				uint32_t dstOffset) = 0;
+		/*
+		 * Copies host and GPU values of src at srcOffsets to offsets
+		 * [dstOffset, dstOffset+count), including GPU values not uploaded
+		 * yet. Copies nothing and returns false when src stores values of
+		 * different type or has different storage.
+		 */
+		virtual bool CopyFrom(UntypedComponentColumn& src,
+				const uint32_t* srcOffsets, uint32_t count,
+				uint32_t dstOffset) = 0;
+		
+	protected:
+		
+		// returns INVALID_OFFSET for stale entity or entity of other pipeline
+		uint32_t ResolveOffset(uint32_t entity) const;
+		
+	protected:
+		
+		const std::string name;
+		const ComponentStorage storage;
+		const uint32_t pipelineId;
+		
+		GlobalEntityManager* globalEntityManager;
+		std::unique_ptr<UntypedManagedSparselyUpdatedVBO> gpu;
+	};
+	
+	template<typename T>
+	class ComponentColumn final : public UntypedComponentColumn {
+	public:
+		
+		ComponentColumn(std::shared_ptr<Engine> engine,
+				const std::string& name, ComponentStorage storage,
+				uint32_t pipelineId, const T& defaultValue=T()) :
+			UntypedComponentColumn(engine, name, sizeof(T), storage,
+					pipelineId),
+			defaultValue(defaultValue) {}
+		virtual ~ComponentColumn() {}
+		
+		void Set(uint32_t entity, const T& value) {
+			const uint32_t offset = ResolveOffset(entity);
+			if(offset != 0xFFFFFFFF) {
+				SetAtOffset(offset, value);
+			}
+		}
+		
+		void SetAtOffset(uint32_t offset, const T& value) {
+			if(HasHost()) {
+				if(host.size() <= offset) {
+					host.resize(offset+1, defaultValue);
+				}
+				host[offset] = value;
+			}
+			if(gpu) {
+				gpu->SetValue(&value, offset);
+			}
+		}
+		
+		// valid only for columns with host storage
+		T Get(uint32_t entity) const {
+			const uint32_t offset = ResolveOffset(entity);
+			if(offset < host.size()) {
+				return host[offset];
+			}
+			return defaultValue;
+		}
+		
+		inline const T& GetDefaultValue() const { return defaultValue; }
+		
+		inline const T* HostData() const { return host.data(); }
+		
+		virtual void MoveHost(const EntityMove* moves,
+				uint32_t count) override {
+			const uint32_t size = host.size();
+			for(uint32_t i=0; i<count; ++i) {
+				const EntityMove m = moves[i];
+				if(m.to < size) {
+					host[m.to] = m.from < size ? host[m.from] : defaultValue;
+				}
+			}
+		}
+		
+		virtual void Reset(uint32_t firstOffset, uint32_t count) override {
+			if(HasHost() && firstOffset < host.size()) {
+				const uint32_t end = std::min<size_t>(host.size(),
+						firstOffset+count);
+				std::fill(host.begin()+firstOffset, host.begin()+end,
+						defaultValue);
+			}
+			if(gpu && count) {
+				gpu->SetValues(&defaultValue, 0, firstOffset, count);
+			}
+		}
+		
+		virtual void CopyHostFrom(const UntypedComponentColumn& src,
+				const uint32_t* srcOffsets, uint32_t count,
+				uint32_t dstOffset) override {
+			const ComponentColumn<T>* column
+				= dynamic_cast<const ComponentColumn<T>*>(&src);
+			if(column == nullptr || !HasHost() || !column->HasHost()) {
+				return;
+			}
+			if(host.size() < dstOffset+count) {
+				host.resize(dstOffset+count, defaultValue);
+			}
+			const uint32_t size = column->host.size();
+			for(uint32_t i=0; i<count; ++i) {
+				host[dstOffset+i] = srcOffsets[i] < size
+					? column->host[srcOffsets[i]] : defaultValue;
+			}
+		}
+		
+		virtual bool CopyFrom(UntypedComponentColumn& src,
+				const uint32_t* srcOffsets, uint32_t count,
+				uint32_t dstOffset) override {
+			ComponentColumn<T>* column = dynamic_cast<ComponentColumn<T>*>(&src);
+			if(column == nullptr || column->storage != storage) {
+				return false;
+			}
+			CopyHostFrom(src, srcOffsets, count, dstOffset);
+			if(gpu) {
+				gpu->CopyFrom(*column->gpu, srcOffsets, count, dstOffset);
+			}
+			return true;
+		}
+		
+	private:
+		
+		const T defaultValue;
+		std::vector<T> host;
+	};
+}
+
+#endif
+
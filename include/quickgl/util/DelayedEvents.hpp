@@ -19,40 +19,124 @@
 #ifndef QUICKGL_DELEYED_EVENTS_HPP
 #define QUICKGL_DELEYED_EVENTS_HPP
 
+#include <cinttypes>
+
 #include <chrono>
-#include <functional>
 #include <atomic>
-#include <map>
+#include <vector>
 #include <mutex>
 
+#include "Task.hpp"
+
 namespace qgl {
 	
+	/*
+	 * Hierarchical timing wheel with millisecond resolution. Every level has
+	 * SLOTS slots and covers SLOTS times longer period than level below.
+	 * Timers are placed at level of highest bit differing between their
+	 * deadline and current tick, and are moved to lower levels when wheel
+	 * reaches their slot. Insert and cancel are O(1). Events never fire
+	 * before their delay passes and fire at most 1 ms after it, not counting
+	 * latency of polling.
+	 */
 	class DelayedEvents {
 	public:
 		
-		DelayedEvents() = default;
+		struct Handle {
+			uint32_t index = 0xFFFFFFFF;
+			uint32_t generation = 0;
+		};
+		
+		DelayedEvents();
 		~DelayedEvents() = default;
 		
 		template<typename... Args, typename Fn>
-		void PushEvent(int msDelay, Fn event, Args... args) {
-			PushEvent_(msDelay, std::bind(event, args...));
+		Handle PushEvent(int msDelay, Fn event, Args... args) {
+			return PushEvent_(msDelay,
+					Task([event, args...]() { event(args...); }));
 		}
 		
-		void PushEvent_(int msDelay, std::function<void()> event);
+		Handle PushEvent_(int msDelay, Task&& event);
+		
+		/*
+		 * Returns true if event was cancelled before it started executing.
+		 */
+		bool Cancel(Handle handle);
 		
 		bool ExecuteOneEvent(); // returns true if anything was executed
+		/*
+		 * Executes at most maxEvents expired events, taking them out of the
+		 * wheel under single lock. Returns number of executed events.
+		 */
+		uint32_t ExecuteExpiredEvents(uint32_t maxEvents=0xFFFFFFFF);
 		bool HasAnyEvents();
 		
+		/*
+		 * Returns time_point::max() when there are no events. May return
+		 * earlier time than exact deadline of next event when it is stored at
+		 * higher levels of wheel or was cancelled. Does not lock.
+		 */
+		std::chrono::steady_clock::time_point GetNextEventTime();
+		
 	private:
 		
-		// replace std::function & std::bind with something faster/smaller
-		std::multimap<std::chrono::time_point<std::chrono::steady_clock>,
-			std::function<void()>> events;
+		static constexpr uint32_t SLOT_BITS = 8;
+		static constexpr uint32_t SLOTS = 1 << SLOT_BITS;
+		static constexpr uint32_t LEVELS = 6;
+		static constexpr uint32_t READY_LIST = LEVELS*SLOTS;
+		static constexpr uint32_t LISTS = READY_LIST+1;
+		static constexpr uint32_t NONE = 0xFFFFFFFF;
+		static constexpr uint64_t NO_TICK = 0xFFFFFFFFFFFFFFFFull;
+		
+		struct Timer {
+			Task task;
+			uint64_t deadline; // in ticks
+			uint64_t sequence;
+			uint32_t prev;
+			uint32_t next;
+			uint32_t list; // NONE when timer is free
+			uint32_t generation;
+		};
+		
+		uint64_t NowTick() const;
+		// checks next due tick without lock
+		bool IsBeforeNextDue() const;
+		// need to be called under lock
+		void UpdateNextDueTick();
+		uint64_t ComputeNextDueTick() const;
+		void Advance(uint64_t targetTick);
+		void Cascade();
+		void ExpireSlot(uint32_t slot);
+		void Insert(uint32_t timer);
+		void Append(uint32_t list, uint32_t timer);
+		void Unlink(uint32_t timer);
+		uint32_t FindOccupiedSlot(uint32_t level, uint32_t fromSlot) const;
+		Task TakeReady();
 		
-		// replace std::queue & std::mutex with something faster
+	private:
+		
+		std::chrono::steady_clock::time_point start;
+		uint64_t currentTick;
+		uint64_t nextSequence;
+		
+		std::vector<Timer> timers;
+		std::vector<uint32_t> freeTimers;
+		std::vector<uint32_t> expired;
+		
+		uint32_t heads[LISTS];
+		uint32_t tails[LISTS];
+		uint64_t occupied[LEVELS][SLOTS/64];
+		// timers in wheel, not counting ready ones
+		uint32_t wheelCount;
+		
+		std::atomic<uint32_t> eventsCount;
+		/*
+		 * Lower bound of tick of next event, written under lock. Polling
+		 * takes lock only after this tick is reached.
+		 */
+		std::atomic<uint64_t> nextDueTick;
 		std::mutex mutex;
 	};
 }
 
 #endif
-
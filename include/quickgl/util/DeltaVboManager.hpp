@@ -28,9 +28,22 @@ namespace gl {
 #ifndef OGLW_VBO_HPP
 	class VBO;
 #endif
+#ifndef OGLW_SYNC_HPP
+	class Sync;
+#endif
 }
 
 namespace qgl {
+	/*
+	 * Ring of persistently and coherently mapped upload memory, divided into
+	 * segments. Regions are suballocated linearly inside current segment.
+	 * Segment is fenced when ring moves to next one and CPU waits for that
+	 * fence only when ring wraps around to it again.
+	 *
+	 * Ring capacity follows peak per-frame upload volume of recent frames.
+	 * It grows at end of frame in which uploads did not fit and shrinks only
+	 * after being oversized for SHRINK_DELAY_FRAMES frames in a row.
+	 */
 	class DeltaVboManager final {
 	public:
 		
@@ -39,22 +52,93 @@ namespace qgl {
 			uint32_t to;
 		};
 		
-		DeltaVboManager(uint32_t bytesPerVbo, uint32_t numberOfVbos);
+		struct Region {
+			// CPU writable pointer to persistently mapped memory
+			void* data;
+			gl::VBO* vbo;
+			uint32_t offset;
+			uint32_t size;
+			
+			void BindBufferRange(uint32_t shaderStorageBinding) const;
+		};
+		
+		DeltaVboManager(uint32_t bytesPerSegment, uint32_t numberOfSegments);
 		~DeltaVboManager();
 		
 		void Init();
 		void Destroy();
 		
-		std::shared_ptr<gl::VBO> GetNextUpdateVBO();
+		/*
+		 * Returns region of min(bytes, segment size) bytes, rounded down to
+		 * multiple of elementSize.
+		 */
+		Region Allocate(uint32_t bytes, uint32_t elementSize);
+		
+		/*
+		 * Has to be called once per frame, after all uploads of that frame.
+		 */
+		void EndFrame();
+		
+		void SetCapacityLimits(uint32_t minCapacityBytes,
+				uint32_t maxCapacityBytes);
+		
+		inline uint32_t GetSegmentSize() const { return segmentSize; }
+		inline uint32_t GetSegmentsCount() const { return segmentsCount; }
+		inline uint32_t GetCapacity() const {
+			return segmentSize*segmentsCount;
+		}
+		inline uint32_t GetCapacityHighWaterMark() const {
+			return capacityHighWaterMark;
+		}
+		inline uint32_t GetLastFrameUploadedBytes() const {
+			return lastFrameBytes;
+		}
+		inline uint32_t GetUploadedBytesHighWaterMark() const {
+			return frameBytesHighWaterMark;
+		}
+		
+	private:
+		
+		void AdvanceSegment();
+		void Reallocate(uint32_t newCapacity);
+		void ReleaseRetiredBuffers();
 		
 	private:
 		
-		uint32_t vboSize;
-		uint32_t lastUsedVbo;
-		std::vector<std::shared_ptr<gl::VBO>> vbos;
+		static constexpr uint32_t OFFSET_ALIGNMENT = 256;
+		static constexpr uint32_t FRAMES_IN_FLIGHT = 3;
+		static constexpr uint32_t RECENT_FRAMES = 64;
+		static constexpr uint32_t SHRINK_DELAY_FRAMES = 300;
+		static constexpr uint32_t MIN_SEGMENT_SIZE = 64*1024;
+		static constexpr uint32_t MAX_SEGMENT_SIZE = 16*1024*1024;
+		static constexpr uint32_t TARGET_SEGMENTS_COUNT = 16;
+		
+		uint32_t segmentSize;
+		uint32_t segmentsCount;
+		uint32_t currentSegment;
+		uint32_t currentOffset;
+		
+		std::shared_ptr<gl::VBO> vbo;
+		uint8_t* mappedPointer;
+		std::vector<std::shared_ptr<gl::Sync>> segmentFences;
+		
+		struct RetiredBuffer {
+			std::shared_ptr<gl::VBO> vbo;
+			std::shared_ptr<gl::Sync> sync;
+		};
+		std::vector<RetiredBuffer> retiredBuffers;
+		
+		uint32_t minCapacity;
+		uint32_t maxCapacity;
+		uint32_t capacityHighWaterMark;
+		
+		uint32_t frameBytes;
+		uint32_t lastFrameBytes;
+		uint32_t frameBytesHighWaterMark;
+		uint32_t recentFramesBytes[RECENT_FRAMES];
+		uint32_t recentFrameId;
+		uint32_t oversizedFrames;
 	};
 }
 
 #endif
-
-
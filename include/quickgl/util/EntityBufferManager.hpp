@@ -26,8 +26,11 @@
 #include <set>
 #include <vector>
 #include <memory>
+#include <string>
 
 #include "../../include/quickgl/util/ManagedSparselyUpdatedVBO.hpp"
+#include "../../include/quickgl/util/DeltaVboManager.hpp"
+#include "../../include/quickgl/util/ComponentColumn.hpp"
 
 namespace gl {
 	class VBO;
@@ -36,25 +39,32 @@ namespace gl {
 namespace qgl {
 	class Engine;
 	class Pipeline;
+	class GlobalEntityManager;
 	
 	class EntityBufferManager final {
 	public:
 		
-		struct PairMove {
-			uint32_t from;
-			uint32_t to;
-		};
+		using PairMove = EntityMove;
 		
 		struct BufferInfo {
 			void (*reserve)(void* object, uint32_t newCapacity);
 			void (*resize)(void* object, uint32_t newSize);
-			void (*moveByVbo)(void* object, std::shared_ptr<Engine> engine, gl::VBO* deltaVbo,
+			void (*moveByVbo)(void* object, std::shared_ptr<Engine> engine,
+					const DeltaVboManager::Region& deltaRegion,
 					uint32_t elements);
 			void (*moveByOne)(void* object, uint32_t from, uint32_t to);
 			void (*updateVbo)(void* object);
 			
 			void* data;
 			void* funcData;
+			
+			// moves host data of all pairs at once, used instead of moveByOne
+			// when set
+			void (*moveByDelta)(void* object, const PairMove* moves,
+					uint32_t count) = nullptr;
+			// returns GPU buffer of object, such buffers are moved all
+			// together instead of with moveByVbo and moveByOne
+			gl::VBO* (*getVbo)(void* object) = nullptr;
 		};
 		
 		EntityBufferManager(std::shared_ptr<Engine> engine,
@@ -67,6 +77,27 @@ namespace qgl {
 		uint32_t GetNewEntity();
 		void FreeEntity(uint32_t entity);
 		
+		/*
+		 * Creates count entities with contiguous offsets and returns offset of
+		 * the first one.
+		 */
+		uint32_t GetNewEntities(uint32_t count, uint32_t* outEntities);
+		void FreeEntities(const uint32_t* entities, uint32_t count);
+		
+		/*
+		 * Places existing entities at contiguous offsets of this buffer and
+		 * points them to this pipeline. Returns offset of the first one.
+		 * Values of component columns with the same name, type and storage in
+		 * source follow entities from srcOffsets, other columns are reset.
+		 */
+		uint32_t AdoptEntities(const uint32_t* entities, uint32_t count,
+				EntityBufferManager& source, const uint32_t* srcOffsets);
+		/*
+		 * Releases offsets of entities that were moved to other pipeline,
+		 * without destroying entity handles.
+		 */
+		void ReleaseOffsets(const uint32_t* offsets, uint32_t count);
+		
 		uint32_t Count() const;
 		
 		void UpdateBuffers();
@@ -81,21 +112,67 @@ namespace qgl {
 		
 		uint32_t GetOffsetOfEntity(uint32_t entity) const;
 		
+		/*
+		 * Adds named per-entity column of user data. Throws if column with
+		 * given name already exists. New entities start with defaultValue.
+		 */
+		template<typename T>
+		std::shared_ptr<ComponentColumn<T>> AddComponentColumn(
+				const std::string& name, ComponentStorage storage,
+				const T& defaultValue=T());
+		template<typename T>
+		std::shared_ptr<ComponentColumn<T>> GetComponentColumn(
+				const std::string& name) const;
+		inline const std::unordered_map<std::string,
+			std::shared_ptr<UntypedComponentColumn>>& GetComponentColumns()
+				const { return componentColumns; }
+		std::shared_ptr<UntypedComponentColumn> GetUntypedComponentColumn(
+				const std::string& name) const;
+		// binds GPU part of column as shader storage buffer, returns false
+		// if column does not exist or has no GPU storage
+		bool BindComponentColumn(const std::string& name, uint32_t binding);
+		/*
+		 * Assigns shader storage binding to GPU column, all assigned columns
+		 * are bound by draw stages of owning pipeline. Throws if column does
+		 * not exist or has no GPU storage.
+		 */
+		void SetComponentColumnBinding(const std::string& name,
+				uint32_t binding);
+		// binds all columns with binding assigned by SetComponentColumnBinding
+		void BindComponentColumns();
+		// uploads values of GPU columns set since last call
+		void UpdateComponentColumns();
+		
 		static inline uint64_t GetAllEntitiesAdded() { return allEntitiesAdded; }
 		
 	private:
 		
+		void AddUntypedComponentColumn(
+				std::shared_ptr<UntypedComponentColumn> column);
+		uint32_t GetPipelineId() const;
+		void ResetComponentColumns(uint32_t firstOffset, uint32_t count);
 		void GenerateDeltaBuffer();
+		void UpdateMovedEntitiesOffsets(uint32_t begin, uint32_t end);
 		
 	private:
 		
-		std::unordered_map<uint32_t, PairMove> deltaFromTo;
+		// below this number of moves offsets are fixed on single thread
+		static constexpr uint32_t PARALLEL_FIXUP_THRESHOLD = 16384;
+		// moves fixed by single scheduler task at once
+		static constexpr uint32_t FIXUP_CHUNK_SIZE = 4096;
+		
 		std::vector<PairMove> deltaBuffer;
-		std::vector<uint32_t> freeingEntites;
+		// offsets freed since last UpdateBuffers()
+		std::vector<uint32_t> freedOffsets;
+		std::vector<uint32_t> movedEntities;
 		
 		ManagedSparselyUpdatedVBOWithLocal<uint32_t> mapOffsetToEntity;
 		
 		std::vector<BufferInfo> buffers;
+		std::vector<gl::VBO*> gpuBuffers;
+		std::unordered_map<std::string,
+			std::shared_ptr<UntypedComponentColumn>> componentColumns;
+		std::unordered_map<std::string, uint32_t> componentColumnBindings;
 		
 		uint32_t entitiesBufferSize;
 		uint32_t entitiesCount;
@@ -104,6 +181,8 @@ namespace qgl {
 		
 		std::shared_ptr<Engine> engine;
 		std::shared_ptr<Pipeline> pipeline;
+		// owned by engine, cached to avoid shared_ptr copy on every lookup
+		GlobalEntityManager* globalEntityManager;
 	};
 	
 	template<typename T>
@@ -121,9 +200,34 @@ namespace qgl {
 						((std::vector<T>*)vec)[0][to]);
 			},
 			nullptr,
-			vec
+			vec,
+			nullptr,
+			[](void* vec, const PairMove* moves, uint32_t count) {
+				std::vector<T>& v = *(std::vector<T>*)vec;
+				for(uint32_t i=0; i<count; ++i) {
+					std::swap(v[moves[i].from], v[moves[i].to]);
+				}
+			}
 		});
 	}
+	
+	template<typename T>
+	std::shared_ptr<ComponentColumn<T>> EntityBufferManager::AddComponentColumn(
+			const std::string& name, ComponentStorage storage,
+			const T& defaultValue) {
+		std::shared_ptr<ComponentColumn<T>> column
+			= std::make_shared<ComponentColumn<T>>(engine, name, storage,
+					GetPipelineId(), defaultValue);
+		AddUntypedComponentColumn(column);
+		return column;
+	}
+	
+	template<typename T>
+	std::shared_ptr<ComponentColumn<T>> EntityBufferManager::GetComponentColumn(
+			const std::string& name) const {
+		return std::dynamic_pointer_cast<ComponentColumn<T>>(
+				GetUntypedComponentColumn(name));
+	}
 }
 
 #endif
@@ -0,0 +1,157 @@
+/*
+ *  This file is part of QuickGL.
+ *  Copyright (C) 2023 Marek Zalewski aka Drwalin
+ *
+ *  QuickGL is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  QuickGL is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef QUICKGL_ENTITY_COMMAND_BUFFER_HPP
+#define QUICKGL_ENTITY_COMMAND_BUFFER_HPP
+
+#include <cinttypes>
+
+#include <vector>
+#include <memory>
+#include <mutex>
+
+#include <glm/glm.hpp>
+#include <glm/gtc/quaternion.hpp>
+
+namespace qgl {
+	class Engine;
+	class Pipeline;
+	
+	/*
+	 * Records entity mutations on any thread without touching engine state.
+	 * Each recording thread should own its own buffer obtained with
+	 * Engine::CreateEntityCommandBuffer(). Recorded commands are applied on
+	 * GL thread at the beginning of Engine::Render(), buffers are applied in
+	 * increasing order of their sort key and then in order of creation, so
+	 * result does not depend on thread timing. Buffer is double-buffered:
+	 * Apply() takes recorded commands under short lock and recording
+	 * continues into the other vector while they are applied, so simulation
+	 * may record during Engine::Render().
+	 *
+	 * CreateEntity() returns placeholder that can be used in following
+	 * commands of the same buffer in place of entity handle. Placeholders are
+	 * marked per command, so all bits of entity handles stay available to
+	 * EntityRegistry. After commands are applied ResolvePlaceholder() returns
+	 * real entity handle, until next Apply() that creates entities; before
+	 * that it returns 0.
+	 */
+	class EntityCommandBuffer final {
+	public:
+		
+		struct Placeholder {
+			uint32_t id;
+		};
+		
+		// entity handle or placeholder of entity created by this buffer
+		struct EntityRef {
+			EntityRef(uint32_t handle) : entity(handle), placeholder(false) {}
+			EntityRef(Placeholder p) : entity(p.id), placeholder(true) {}
+			uint32_t entity;
+			bool placeholder;
+		};
+		
+		EntityCommandBuffer(uint32_t sortKey);
+		~EntityCommandBuffer();
+		
+		Placeholder CreateEntity(uint32_t pipelineId);
+		void DeleteEntity(EntityRef entity);
+		
+		void SetEntityMesh(EntityRef entity, uint32_t meshId);
+		void SetEntityTransformsQuat(EntityRef entity, glm::vec3 pos={0,0,0},
+				glm::quat rot=glm::angleAxis(0.0f,glm::vec3(0,1,0)),
+				glm::vec3 scale={1,1,1});
+		// applied only to entities of PipelineBoneAnimated
+		void SetAnimationState(EntityRef entity, uint32_t animationId,
+				float timeOffset, bool enableUpdateTime,
+				uint32_t animationIdAfter, bool continueNextAnimation);
+		
+		uint32_t ResolvePlaceholder(Placeholder placeholder) const;
+		
+		inline uint32_t GetSortKey() const { return sortKey; }
+		bool Empty() const;
+		
+		// Needs to be called on GL thread.
+		void Apply(Engine& engine);
+		
+	private:
+		
+		enum CommandType : uint32_t {
+			COMMAND_CREATE,
+			COMMAND_DELETE,
+			COMMAND_SET_MESH,
+			COMMAND_SET_TRANSFORM,
+			COMMAND_SET_ANIMATION_STATE,
+		};
+		
+		enum CommandFlags : uint32_t {
+			// entity field holds placeholder id instead of entity handle
+			COMMAND_FLAG_PLACEHOLDER = 1,
+		};
+		
+		struct Command {
+			CommandType type;
+			uint32_t flags;
+			uint32_t entity; // pipelineId for COMMAND_CREATE
+			uint32_t args[3];
+			float values[10];
+		};
+		
+		static Command MakeCommand(CommandType type, EntityRef entity);
+		void Record(const Command& cmd);
+		uint32_t Resolve(const Command& cmd) const;
+		Pipeline* GetPipeline(Engine& engine, uint32_t entity,
+				uint32_t& pipelineId);
+		
+		void ApplyCreate(Engine& engine, uint32_t& i);
+		void ApplyRun(Engine& engine, uint32_t& i);
+		
+	private:
+		
+		const uint32_t sortKey;
+		
+		// guards commands, placeholder counters, resolved and resolvedBase
+		mutable std::mutex mutex;
+		// commands being recorded
+		std::vector<Command> commands;
+		// placeholder ids grow across Apply() calls
+		uint32_t nextPlaceholder;
+		// first placeholder of commands not yet taken by Apply()
+		uint32_t firstPendingPlaceholder;
+		
+		// commands taken by Apply() in progress
+		std::vector<Command> applying;
+		
+		// entities created by last Apply() that created any, indexed by
+		// placeholder-resolvedBase
+		std::vector<uint32_t> resolved;
+		uint32_t resolvedBase;
+		// entities created by Apply() in progress
+		std::vector<uint32_t> created;
+		uint32_t createdBase;
+		
+		// scratch buffers for batched calls
+		std::vector<uint32_t> batchIds;
+		std::vector<uint32_t> batchMeshes;
+		std::vector<glm::vec3> batchPos;
+		std::vector<glm::quat> batchRot;
+		std::vector<glm::vec3> batchScale;
+	};
+}
+
+#endif
+
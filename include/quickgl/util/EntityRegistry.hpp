@@ -0,0 +1,106 @@
+/*
+ *  This file is part of QuickGL.
+ *  Copyright (C) 2023 Marek Zalewski aka Drwalin
+ *
+ *  QuickGL is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  QuickGL is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef QUICKGL_ENTITY_REGISTRY_HPP
+#define QUICKGL_ENTITY_REGISTRY_HPP
+
+#include <cinttypes>
+
+#include <vector>
+
+namespace qgl {
+	/*
+	 * Maps entity handles to (pipeline, offset) pairs. Handle stores slot
+	 * index in lower 24 bits and slot generation in upper 8 bits, so lookup
+	 * is a single indexed load and handles of destroyed entities are detected.
+	 * Freed slots are reused in FIFO order to delay generation wrap-around.
+	 * Handle 0 is never returned.
+	 */
+	class EntityRegistry final {
+	public:
+		
+		static constexpr uint32_t INVALID_OFFSET = 0xFFFFFFFF;
+		static constexpr uint32_t INVALID_PIPELINE = 0xFFFFFFFF;
+		
+		static constexpr uint32_t INDEX_BITS = 24;
+		static constexpr uint32_t INDEX_MASK = (1u<<INDEX_BITS)-1;
+		static constexpr uint32_t MAX_ENTITIES = INDEX_MASK;
+		static constexpr uint32_t GENERATION_MASK = 0xFF;
+		
+		EntityRegistry();
+		~EntityRegistry();
+		
+		uint32_t Create(uint32_t pipelineId, uint32_t offset);
+		// creates count entities with offsets [firstOffset, firstOffset+count)
+		void Create(uint32_t pipelineId, uint32_t firstOffset, uint32_t count,
+				uint32_t* outHandles);
+		// returns false for stale handles
+		bool Destroy(uint32_t handle);
+		
+		inline bool IsValid(uint32_t handle) const {
+			const uint32_t index = handle & INDEX_MASK;
+			return index < slots.size() && slots[index].handle == handle;
+		}
+		
+		inline uint32_t GetOffset(uint32_t handle) const {
+			const uint32_t index = handle & INDEX_MASK;
+			if(index < slots.size() && slots[index].handle == handle)
+				return slots[index].offset;
+			return INVALID_OFFSET;
+		}
+		
+		inline uint32_t GetPipelineId(uint32_t handle) const {
+			const uint32_t index = handle & INDEX_MASK;
+			if(index < slots.size() && slots[index].handle == handle)
+				return slots[index].pipelineId;
+			return INVALID_PIPELINE;
+		}
+		
+		// return false for stale handles
+		bool SetOffset(uint32_t handle, uint32_t offset);
+		bool SetPipeline(uint32_t handle, uint32_t pipelineId,
+				uint32_t offset);
+		
+		void Reserve(uint32_t entities);
+		void Clear();
+		
+		inline uint32_t Count() const { return count; }
+		
+	private:
+		
+		uint32_t AcquireSlot();
+		
+	private:
+		
+		struct Slot {
+			uint32_t handle; // 0 when slot is free
+			uint32_t offset;
+			uint32_t pipelineId;
+			uint32_t generation;
+		};
+		
+		std::vector<Slot> slots;
+		// FIFO queue of free slots, consumed from freeFront
+		std::vector<uint32_t> freeSlots;
+		uint32_t freeFront;
+		uint32_t count;
+	};
+}
+
+#endif
+
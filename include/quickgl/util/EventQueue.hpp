@@ -19,41 +19,63 @@
 #ifndef QUICKGL_EVENT_QUEUE_HPP
 #define QUICKGL_EVENT_QUEUE_HPP
 
-#include <functional>
+#include <cinttypes>
+
 #include <atomic>
-#include <queue>
+#include <memory>
+#include <deque>
 #include <mutex>
 
+#include "Task.hpp"
+
 namespace qgl {
+	/*
+	 * Multi producer multi consumer queue of tasks. Tasks are kept in bounded
+	 * lock-free ring buffer. When the ring is full, tasks are appended to
+	 * mutex guarded overflow segments, which are drained after the ring so
+	 * that order of tasks pushed by single thread is kept.
+	 */
 	class EventQueue {
 	public:
 		
-		EventQueue() = default;
-		~EventQueue() = default;
+		// capacity is rounded up to power of 2
+		EventQueue(uint32_t ringCapacity=4096);
+		~EventQueue();
 		
 		template<typename... Args, typename Fn>
 		void PushEvent(Fn event, Args... args) {
-			PushEvent_(std::bind(event, args...));
+			PushEvent_(Task([event, args...]() { event(args...); }));
 		}
 		
-		void PushEvent_(std::function<void()> event);
+		void PushEvent_(Task&& event);
 		
+		bool PopEvent(Task& event); // returns false if queue was empty
 		bool ExecuteOneEvent(); // returns true if anything was executed
 		bool HasAnyEvents();
 		
 	private:
 		
-		std::atomic<uint32_t> counter;
+		bool TryPushRing(Task& event);
+		bool TryPopRing(Task& event);
+		
+	private:
+		
+		struct Cell {
+			std::atomic<size_t> sequence;
+			Task task;
+		};
 		
-		// replace std::function & std::bind with something faster/smaller
-		std::queue<std::function<void()>> eventsQueue;
+		const size_t mask;
+		std::unique_ptr<Cell[]> ring;
 		
-		// replace std::queue & std::mutex with something faster
-		std::mutex mutex;
+		alignas(64) std::atomic<size_t> enqueuePosition;
+		alignas(64) std::atomic<size_t> dequeuePosition;
+		alignas(64) std::atomic<uint32_t> counter;
 		
-		std::queue<std::function<void()>> popedEventsForRunningThreads;
+		std::atomic<uint32_t> overflowCount;
+		std::mutex overflowMutex;
+		std::deque<Task> overflow;
 	};
 }
 
 #endif
-
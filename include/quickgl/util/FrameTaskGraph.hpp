@@ -0,0 +1,142 @@
+/*
+ *  This file is part of QuickGL.
+ *  Copyright (C) 2023 Marek Zalewski aka Drwalin
+ *
+ *  QuickGL is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  QuickGL is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef QUICKGL_FRAME_TASK_GRAPH_HPP
+#define QUICKGL_FRAME_TASK_GRAPH_HPP
+
+#include <cinttypes>
+
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <memory>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+
+#include "Task.hpp"
+
+namespace qgl {
+	class Scheduler;
+	class RenderStageComposer;
+	
+	/*
+	 * CPU jobs of single frame. Jobs depend on other jobs and on render
+	 * stages selected by name. They are executed on worker pool while render
+	 * thread waits for GPU between stages. Jobs are added on render thread
+	 * before Engine::Render() and are removed after the frame ends.
+	 */
+	class FrameTaskGraph final {
+	public:
+		
+		using JobId = uint32_t;
+		
+		enum JobFlags : uint32_t {
+			// job is executed by render thread, with OpenGL context bound
+			JOB_RENDER_THREAD = 1,
+		};
+		
+		FrameTaskGraph(std::shared_ptr<Scheduler> scheduler);
+		~FrameTaskGraph();
+		
+		JobId AddJob(std::string name, Task&& job, uint32_t flags=0);
+		
+		// job starts after dependsOn finishes
+		void AddDependency(JobId job, JobId dependsOn);
+		/*
+		 * Job starts after stages with given name are executed for every
+		 * pipeline and camera in this frame.
+		 */
+		void RunAfterStage(JobId job, std::string stageName);
+		// stages with given name wait until job finishes
+		void RunBeforeStage(JobId job, std::string stageName);
+		
+	public: // used by RenderStageComposer
+		
+		void BeginFrame();
+		void UpdateStageDependencies(RenderStageComposer* composer);
+		bool IsStageBlocked(const std::string& stageName) const;
+		/*
+		 * Executes one render thread job or one ready job of this graph that
+		 * was not yet taken by worker pool. Tasks of other users of scheduler
+		 * are never executed. Returns false when nothing was executed.
+		 */
+		bool ExecuteOne();
+		bool HasPendingJobs() const;
+		/*
+		 * Waits until any job finishes, at most maxWaitNanoseconds. Returns
+		 * false without waiting when there are no pending jobs.
+		 */
+		bool WaitForJob(int64_t maxWaitNanoseconds);
+		void EndFrame();
+		
+	private:
+		
+		static constexpr int64_t END_FRAME_WAIT_NANOSECONDS = 1000000;
+		
+		struct Job {
+			std::string name;
+			Task task;
+			uint32_t flags;
+			std::vector<JobId> dependents;
+			std::vector<std::string> afterStages;
+			uint32_t dependenciesCount;
+			std::atomic<uint32_t> remainingDependencies;
+			std::atomic<bool> finished;
+		};
+		
+		/*
+		 * Ready worker jobs. Every job pushed here has its own scheduler task
+		 * that pops one job, whichever comes first. Queue is shared with
+		 * those tasks, so tasks that find it empty do not touch the graph.
+		 */
+		struct ReadyJobs {
+			std::mutex mutex;
+			std::vector<JobId> jobs;
+			FrameTaskGraph* graph;
+			
+			bool Pop(JobId& id);
+		};
+		
+		void Submit(JobId id);
+		void RunJob(JobId id);
+		void ResolveDependency(JobId id);
+		Job& GetJob(JobId id);
+		
+	private:
+		
+		std::shared_ptr<Scheduler> scheduler;
+		
+		std::vector<std::unique_ptr<Job>> jobs;
+		std::unordered_map<std::string, std::vector<JobId>> stageBlockers;
+		std::vector<JobId> jobsWaitingForStages;
+		
+		std::vector<JobId> renderThreadJobs;
+		std::mutex renderThreadJobsMutex;
+		
+		std::shared_ptr<ReadyJobs> readyJobs;
+		
+		std::atomic<uint32_t> unfinishedJobs;
+		// signaled by every finished job
+		std::mutex jobFinishedMutex;
+		std::condition_variable jobFinished;
+		bool running;
+	};
+}
+
+#endif
@@ -22,51 +22,83 @@
 #include <cinttypes>
 
 #include <vector>
-#include <map>
+#include <memory>
 
 #include "ManagedSparselyUpdatedVBO.hpp"
 
 namespace qgl {
+	class Engine;
+	
+	/*
+	 * Sparse set of ids stored in flat arrays. Used ids are kept densely in
+	 * array of used ids, freed ids are reused in LIFO order before new ones
+	 * are added.
+	 */
 	class IdsManager {
 	public:
 		
+		static constexpr uint32_t INVALID_OFFSET = 0xFFFFFFFF;
+		
 		virtual ~IdsManager() = default;
 		
 		virtual uint32_t GetNewId();
 		virtual void FreeId(uint32_t id);
 		
+		/*
+		 * Allocates count ids into outIds. Ids that were not reused from
+		 * freed ones are consecutive.
+		 */
+		virtual void GetNewIds(uint32_t count, uint32_t* outIds);
+		// ids that are not used are ignored
+		virtual void FreeIds(const uint32_t* ids, uint32_t count);
+		
+		inline bool IsUsed(uint32_t id) const {
+			return id < mapIdToOffsetInArrayOfUsedIds.size()
+				&& mapIdToOffsetInArrayOfUsedIds[id] != INVALID_OFFSET;
+		}
+		
 		inline uint32_t CountIds() const { return arrayOfUsedIds.size(); }
 		inline uint32_t GetArraySize() const {
-			return CountIds() + freeIdsStack.size();
+			return mapIdToOffsetInArrayOfUsedIds.size();
 		}
 		
 		inline const uint32_t* GetArrayOfUsedIds() const {
-			return &(arrayOfUsedIds[0]);
+			return arrayOfUsedIds.data();
 		}
 		
 	protected:
 		
-		std::vector<uint32_t> ids;
+		/*
+		 * Removes id from array of used ids by moving last used id into its
+		 * place. Returns offset of moved id or INVALID_OFFSET when nothing
+		 * was moved.
+		 */
+		uint32_t RemoveUsedId(uint32_t id);
+		
+	protected:
+		
 		std::vector<uint32_t> freeIdsStack;
 		
 		std::vector<uint32_t> arrayOfUsedIds;
-		std::map<uint32_t, uint32_t> mapIdToOffsetInArrayOfUsedIds;
+		// INVALID_OFFSET for freed ids
+		std::vector<uint32_t> mapIdToOffsetInArrayOfUsedIds;
 	};
 	
-	class IdsManagerVBOManaged final {
+	/*
+	 * Mirrors array of used ids into GPU buffer.
+	 */
+	class IdsManagerVBOManaged final : public IdsManager {
 	public:
 		
+		IdsManagerVBOManaged(std::shared_ptr<Engine> engine);
 		virtual ~IdsManagerVBOManaged() = default;
 		
 		void InitVBO();
 		
-		uint32_t GetNewId();
-		void FreeId(uint32_t id);
-		
-		inline uint32_t CountIds() const { return arrayOfUsedIds.size(); }
-		inline uint32_t GetArraySize() const {
-			return CountIds() + freeIdsStack.size();
-		}
+		virtual uint32_t GetNewId() override;
+		virtual void FreeId(uint32_t id) override;
+		virtual void GetNewIds(uint32_t count, uint32_t* outIds) override;
+		virtual void FreeIds(const uint32_t* ids, uint32_t count) override;
 		
 		void UpdateVBO();
 		inline gl::VBO& Vbo() { return vbo.Vbo(); }
@@ -74,12 +106,6 @@ namespace qgl {
 	private:
 		
 		ManagedSparselyUpdatedVBO<uint32_t> vbo;
-		
-		std::vector<uint32_t> freeIdsStack;
-		
-		std::vector<uint32_t> arrayOfUsedIds;
-		std::vector<uint32_t> mapIdToOffsetInArrayOfUsedIds;
-		
 	};
 }
 
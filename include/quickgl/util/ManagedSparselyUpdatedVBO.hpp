@@ -22,7 +22,7 @@
 #include <cinttypes>
 
 #include <vector>
-#include <unordered_map>
+#include <algorithm>
 #include <memory>
 
 namespace gl {
@@ -44,6 +44,8 @@ namespace qgl {
 		void Destroy();
 		
 		void Resize(uint32_t size);
+		// grows GPU buffer to hold at least count elements, keeps contents
+		void EnsureCapacity(uint32_t count);
 		
 		inline gl::VBO& Vbo() { return *vbo; }
 		
@@ -51,8 +53,68 @@ namespace qgl {
 		
 		void SetValue(const void* value, uint32_t id);
 		
+		/*
+		 * Stages count values for ids [firstId, firstId+count). Values are
+		 * read with valueStride bytes between consecutive elements, stride 0
+		 * stages the same value for all ids.
+		 */
+		void SetValues(const void* values, uint32_t valueStride,
+				uint32_t firstId, uint32_t count);
+		/*
+		 * Stages count values for arbitrary ids. Ids equal to 0xFFFFFFFF
+		 * (invalid entity offset) are skipped, stride 0 stages the same value
+		 * for all ids.
+		 */
+		void SetValues(const void* values, uint32_t valueStride,
+				const uint32_t* ids, uint32_t count);
+		
+		/*
+		 * Reserves staging memory for additional updates before next UpdateVBO.
+		 */
+		void ReserveUpdates(uint32_t additionalUpdates);
+		
+		/*
+		 * Copies values of src at srcIds to ids [dstFirstId, dstFirstId+count).
+		 * Uploaded values are copied on GPU, values still staged in src are
+		 * staged here, so src does not need to be updated before. Throws if
+		 * element sizes differ.
+		 */
+		void CopyFrom(UntypedManagedSparselyUpdatedVBO& src,
+				const uint32_t* srcIds, uint32_t count, uint32_t dstFirstId);
+		
 		uint32_t Count() const;
 		
+	private:
+		
+		friend class ManagedSparselyUpdatedVBOGroup;
+		
+		/*
+		 * Grows GPU buffer, uploads dense runs and collects remaining entries
+		 * into scatteredEntries. Returns number of entries left to scatter.
+		 */
+		uint32_t PrepareUpdate();
+		inline const uint32_t* ScatteredEntries() const {
+			return allEntriesScattered ? nullptr : scatteredEntries.data();
+		}
+		inline uint32_t ScatteredEntry(uint32_t i) const {
+			return allEntriesScattered ? i : scatteredEntries[i];
+		}
+		void FinishUpdate();
+		
+		uint8_t* StageValue(uint32_t id);
+		void GrowStagedSlots(uint32_t size);
+		void ClearStagedSlots(uint32_t entries);
+		
+		inline uint32_t StagedId(uint32_t entry) const {
+			return *(const uint32_t*)&(deltaData[entry*UPDATE_STRUCUTRE_SIZE
+					+ ELEMENT_SIZE]);
+		}
+		// copies values of count staged entries with consecutive ids
+		void UploadRange(uint32_t firstEntry, uint32_t count);
+		// scatters staged entries with compute shader, all entries when
+		// entries is nullptr
+		void UploadScattered(const uint32_t* entries, uint32_t count);
+		
 	private:
 		
 		std::shared_ptr<Engine> engine;
@@ -63,10 +125,62 @@ namespace qgl {
 		int32_t shaderDeltaCommandsLocation;
 		
 		std::vector<uint8_t> deltaData;
-		std::unordered_map<uint32_t, uint32_t> whereSomethingWasUpdated;
+		// for every id: index+1 of its entry in deltaData, 0 when not staged
+		std::vector<uint32_t> stagedSlots;
+		std::vector<uint32_t> scatteredEntries;
+		bool allEntriesScattered;
 		
 		const uint32_t ELEMENT_SIZE;
 		const uint32_t UPDATE_STRUCUTRE_SIZE;
+		// Runs of consecutive ids at least this long are uploaded as plain
+		// ranges. Below it per element id overhead and extra dispatch are
+		// cheaper than additional buffer copy command.
+		const uint32_t MIN_RANGE_UPLOAD_ELEMENTS;
+	};
+	
+	/*
+	 * Updates several sparsely updated buffers indexed by the same ids with
+	 * single packed delta stream and single compute dispatch. Values of one id
+	 * changed in several buffers share one record. Dense runs are still
+	 * uploaded as ranges by each buffer, and when only one buffer has
+	 * scattered entries it uploads them with its own stream without record
+	 * headers.
+	 */
+	class ManagedSparselyUpdatedVBOGroup final {
+	public:
+		
+		static constexpr uint32_t MAX_BUFFERS = 6;
+		
+		ManagedSparselyUpdatedVBOGroup(std::shared_ptr<Engine> engine);
+		~ManagedSparselyUpdatedVBOGroup();
+		
+		void Add(UntypedManagedSparselyUpdatedVBO* vbo);
+		void Destroy();
+		
+		void UpdateVBOs();
+		
+	private:
+		
+		void CompileShader();
+		
+	private:
+		
+		struct Record {
+			uint32_t id;
+			uint32_t mask;
+			uint32_t words;
+			uint32_t entries[MAX_BUFFERS];
+		};
+		
+		std::shared_ptr<Engine> engine;
+		std::vector<UntypedManagedSparselyUpdatedVBO*> buffers;
+		
+		std::vector<Record> records;
+		// for every id: index+1 of its record, 0 when there is none
+		std::vector<uint32_t> recordOfId;
+		
+		gl::Shader* shader;
+		int32_t shaderRecordsCountLocation;
 	};
 	
 	template<typename T>
@@ -80,6 +194,16 @@ namespace qgl {
 		void SetValue(const T& value, uint32_t id) {
 			UntypedManagedSparselyUpdatedVBO::SetValue((const void*)&value, id);
 		}
+		
+		void SetValues(const T* values, uint32_t firstId, uint32_t count) {
+			UntypedManagedSparselyUpdatedVBO::SetValues((const void*)values,
+					sizeof(T), firstId, count);
+		}
+		
+		void SetValues(const T* values, const uint32_t* ids, uint32_t count) {
+			UntypedManagedSparselyUpdatedVBO::SetValues((const void*)values,
+					sizeof(T), ids, count);
+		}
 	};
 	
 	template<typename T>
@@ -99,6 +223,26 @@ namespace qgl {
 			localBuffer[id] = value;
 		}
 		
+		void SetValues(const T* values, uint32_t firstId, uint32_t count) {
+			ManagedSparselyUpdatedVBO<T>::SetValues(values, firstId, count);
+			if(localBuffer.size() < firstId+count) {
+				localBuffer.resize(firstId+count);
+			}
+			std::copy(values, values+count, localBuffer.begin()+firstId);
+		}
+		
+		void SetValues(const T* values, const uint32_t* ids, uint32_t count) {
+			ManagedSparselyUpdatedVBO<T>::SetValues(values, ids, count);
+			for(uint32_t i=0; i<count; ++i) {
+				if(ids[i] == 0xFFFFFFFF)
+					continue;
+				if(localBuffer.size() <= ids[i]) {
+					localBuffer.resize(ids[i]+1);
+				}
+				localBuffer[ids[i]] = values[i];
+			}
+		}
+		
 		void Resize(uint32_t size) {
 			UntypedManagedSparselyUpdatedVBO::Resize(size);
 			localBuffer.resize(size);
@@ -23,6 +23,10 @@
 
 #include <memory>
 #include <unordered_map>
+#include <vector>
+#include <string>
+
+#include "DeltaVboManager.hpp"
 
 namespace gl {
 #ifndef OGLW_VBO_HPP
@@ -52,7 +56,8 @@ namespace qgl {
 		
 		void Update(gl::VBO* vbo, const PairMove* data, uint32_t elements);
 		
-		void Update(gl::VBO* vbo, gl::VBO* deltaVbo, uint32_t elements);
+		void Update(gl::VBO* vbo, const DeltaVboManager::Region& deltaRegion,
+				uint32_t elements);
 		
 		friend class MoveVboManager;
 		
@@ -64,6 +69,35 @@ namespace qgl {
 		uint32_t updateElementsCountLocation;
 	};
 	
+	/*
+	 * Applies single list of moves to several buffers of different element
+	 * sizes with one dispatch.
+	 */
+	class MoveMultiVboUpdater final {
+	public:
+		
+		// limited by guaranteed minimum of shader storage bindings in compute
+		// shader, one binding is taken by moves
+		static constexpr uint32_t MAX_BUFFERS = 7;
+		
+		MoveMultiVboUpdater(std::shared_ptr<Engine> engine,
+				const std::vector<uint32_t>& bytes);
+		~MoveMultiVboUpdater();
+		
+		void Init();
+		void Destroy();
+		
+		void Update(gl::VBO* const* vbos,
+				const DeltaVboManager::Region& deltaRegion, uint32_t elements);
+		
+	private:
+		
+		const std::vector<uint32_t> BYTES;
+		std::shared_ptr<Engine> engine;
+		std::shared_ptr<gl::Shader> shader;
+		uint32_t updateElementsCountLocation;
+	};
+	
 	class MoveVboManager final {
 	public:
 		
@@ -77,12 +111,21 @@ namespace qgl {
 		void Update(gl::VBO* vbo, const MoveVboUpdater::PairMove* data,
 				uint32_t elements, uint32_t elementSize);
 		
-		void Update(gl::VBO* vbo, gl::VBO* deltaVbo, uint32_t elements,
-				uint32_t elementSize);
+		void Update(gl::VBO* vbo, const DeltaVboManager::Region& deltaRegion,
+				uint32_t elements, uint32_t elementSize);
+		
+		/*
+		 * Moves elements of all given buffers with the same delta list. Uses
+		 * one dispatch per MoveMultiVboUpdater::MAX_BUFFERS buffers.
+		 */
+		void Update(gl::VBO* const* vbos, uint32_t vbosCount,
+				const DeltaVboManager::Region& deltaRegion, uint32_t elements);
 		
 	private:
 		
 		std::unordered_map<uint32_t, std::shared_ptr<MoveVboUpdater>> updatersByElementSizeSize;
+		std::unordered_map<std::string, std::shared_ptr<MoveMultiVboUpdater>>
+			multiUpdatersByElementSizes;
 		std::shared_ptr<Engine> engine;
 	};
 }
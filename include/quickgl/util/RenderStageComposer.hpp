@@ -30,9 +30,14 @@
 #include <memory>
 #include <functional>
 
+namespace gl {
+	class Sync;
+}
+
 namespace qgl {
 	class Camera;
 	class Pipeline;
+	class FrameTaskGraph;
 	
 	enum StageTypeFlags : uint32_t {
 		/*
@@ -71,17 +76,24 @@ namespace qgl {
 		
 		void Execute(std::shared_ptr<Camera> camera);
 		bool CanExecute(std::shared_ptr<Camera> camera);
+		/*
+		 * Returns fence which needs to be signaled before stage can be
+		 * executed, nullptr when stage does not wait for any fence.
+		 */
+		gl::Sync* GetPendingSync(std::shared_ptr<Camera> camera);
 		
 		inline Stage(
 				std::string name,
 				StageOrder stageOrder,
 				std::shared_ptr<Pipeline> pipeline,
 				void(Pipeline::* taskFunction)(std::shared_ptr<Camera>),
-				bool(Pipeline::* canExecute)(std::shared_ptr<Camera>) = nullptr) :
+				bool(Pipeline::* canExecute)(std::shared_ptr<Camera>) = nullptr,
+				gl::Sync*(Pipeline::* pendingSync)(std::shared_ptr<Camera>) = nullptr) :
 					name(name),
 					executionPolicy(stageOrder),
 					taskFunction(taskFunction),
 					canExecute(canExecute),
+					pendingSync(pendingSync),
 					pipeline(pipeline) {
 		}
 		
@@ -89,6 +101,7 @@ namespace qgl {
 		const StageOrder executionPolicy;
 		void(Pipeline::* taskFunction)(std::shared_ptr<Camera>);
 		bool(Pipeline::* canExecute)(std::shared_ptr<Camera>);
+		gl::Sync*(Pipeline::* pendingSync)(std::shared_ptr<Camera>);
 		const std::shared_ptr<Pipeline> pipeline;
 	};
 	
@@ -110,6 +123,13 @@ namespace qgl {
 		void End();
 	};
 	
+	// time spent by render thread waiting for fence of blocked stage
+	struct StageWait {
+		std::shared_ptr<struct Stage> stage;
+		std::shared_ptr<Camera> camera;
+		double waitedSeconds;
+	};
+	
 	class PipelineStagesScheduler {
 	public:
 		
@@ -122,13 +142,17 @@ namespace qgl {
 				std::string name,
 				StageOrder stageOrder,
 				void(T::* taskFunction)(std::shared_ptr<Camera>),
-				bool(T::* canExecute)(std::shared_ptr<Camera>) = nullptr) {
+				bool(T::* canExecute)(std::shared_ptr<Camera>) = nullptr,
+				gl::Sync*(T::* pendingSync)(std::shared_ptr<Camera>) = nullptr) {
 			AddStage(std::make_shared<Stage>(name, stageOrder, pipeline,
 						(void(Pipeline::*)(std::shared_ptr<Camera>))taskFunction,
-						(bool(Pipeline::*)(std::shared_ptr<Camera>))canExecute));
+						(bool(Pipeline::*)(std::shared_ptr<Camera>))canExecute,
+						(gl::Sync*(Pipeline::*)(std::shared_ptr<Camera>))pendingSync));
 		}
 		
 		bool HasMoreStages();
+		// returns true if stage with given name is still to be executed
+		bool HasPendingStage(const std::string& name);
 		bool CanExecuteNextStage();
 		void ExecuteNextStage();
 		
@@ -147,6 +171,9 @@ namespace qgl {
 		std::shared_ptr<Camera> currentCamera;
 		uint32_t currentCameraId;
 		
+		// order of last executed stage of this pipeline in current frame
+		uint64_t lastExecutionIndex;
+		
 		std::vector<std::shared_ptr<Stage>> globalStages;
 		std::vector<std::shared_ptr<Stage>> perCameraStages;
 		
@@ -177,14 +204,40 @@ namespace qgl {
 		bool ContinueStages();
 		bool HasAnyStagesLeft();
 		
+		/*
+		 * Waits at most maxWaitNanoseconds for fence of blocked stage. Fences
+		 * are signaled in order of submission, so the one of pipeline which
+		 * executed its stage earliest is waited for. Returns false when no
+		 * blocked stage waits for a fence.
+		 */
+		bool WaitForBlockedStages(int64_t maxWaitNanoseconds);
+		
 		bool CanExecuteSyncStage(uint32_t cameraId, StageOrder stageOrder);
 		
+		/*
+		 * Jobs of frameTaskGraph are started in ResetExecution() and executed
+		 * by ExecuteCpuJob() while stages wait for GPU. EndFrame() waits for
+		 * remaining jobs.
+		 */
+		void SetFrameTaskGraph(std::shared_ptr<FrameTaskGraph> frameTaskGraph);
+		bool ExecuteCpuJob(); // returns false when nothing was executed
+		// returns false without waiting when no CPU job is pending
+		bool WaitForCpuJob(int64_t maxWaitNanoseconds);
+		void EndFrame();
+		
+		// returns true if stages with given name were executed by all
+		// pipelines for all cameras in this frame
+		bool IsStageFinished(const std::string& name);
+		bool IsStageBlockedByJobs(const std::string& name);
+		
 		std::shared_ptr<Camera> GetCameraByIndex(uint32_t id);
 		
 		void SetGlFinishInEveryStageToProfile(bool value);
 		
 		std::vector<StageTiming> GetTimings() const;
 		double GetTotalCpuTime() const;
+		std::vector<StageWait> GetWaits() const;
+		double GetTotalWaitTime() const;
 		
 	private:
 		
@@ -195,6 +248,10 @@ namespace qgl {
 		std::vector<StageTiming> timings;
 		double totalCpuTime;
 		
+		std::vector<StageWait> waits;
+		double totalWaitTime;
+		uint64_t executedStagesCount;
+		
 		std::map<uint32_t,
 			std::map<std::shared_ptr<Pipeline>,
 				StageOrder>> mapCurrentCameraIdToPipelines;
@@ -202,6 +259,8 @@ namespace qgl {
 		std::vector<std::shared_ptr<Camera>> cameras;
 		std::vector<std::shared_ptr<Pipeline>> pipelines;
 		
+		std::shared_ptr<FrameTaskGraph> frameTaskGraph;
+		
 		bool hasAnyStagesLeft;
 	};
 }
@@ -19,44 +19,129 @@
 #ifndef QUICKGL_SCHEDULER_HPP
 #define QUICKGL_SCHEDULER_HPP
 
-#include "EventQueue.hpp"
+#include <cinttypes>
+
+#include <vector>
+#include <deque>
+#include <memory>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+
+#include "Task.hpp"
 #include "DelayedEvents.hpp"
 #include "Log.hpp"
 
 namespace qgl {
+	/*
+	 * Pool of worker threads. Every worker has its own deques of priority and
+	 * regular tasks, takes newest tasks from its own deques and steals oldest
+	 * tasks of other workers when it runs out of them. Idle workers sleep
+	 * until new task or delayed task becomes ready.
+	 */
 	class Scheduler {
 	public:
 		
-		Scheduler() = default;
-		~Scheduler() = default;
+		// 0 workers means std::thread::hardware_concurrency()
+		Scheduler(uint32_t workersCount=0);
+		~Scheduler();
+		
+		void Start();
+		/*
+		 * Waits for workers to finish their current tasks. Tasks left in
+		 * queues are not executed.
+		 */
+		void Stop();
 		
+		/*
+		 * Starts workers and executes tasks on calling thread until Stop() is
+		 * called. Calling thread sleeps like idle worker.
+		 */
 		void Run();
 		
+		inline uint32_t GetWorkersCount() const { return workers.size(); }
+		
 		template<typename... Args, typename Fn>
 		void ScheduleTask(Fn task, Args... args) {
-			regularEvents.PushEvent((void(*)(Args...))task, args...);
+			void(*fn)(Args...) = (void(*)(Args...))task;
+			PushTask(Task([fn, args...]() { fn(args...); }), LANE_REGULAR);
+		}
+		
+		inline void ScheduleTask_(Task&& task) {
+			PushTask(std::move(task), LANE_REGULAR);
 		}
 		
 		template<typename... Args, typename Fn>
 		void SchedulePriorityTask(Fn task, Args... args) {
-			priorityEvents.PushEvent((void(*)(Args...))task, args...);
+			void(*fn)(Args...) = (void(*)(Args...))task;
+			PushTask(Task([fn, args...]() { fn(args...); }), LANE_PRIORITY);
 		}
 		
 		template<typename... Args, typename Fn>
-		void ScheduleDelayedTask(int msDelay, Fn task, Args... args) {
-			delayedEvents.PushEvent(msDelay, (void(*)(Args...))task, args...);
+		DelayedEvents::Handle ScheduleDelayedTask(int msDelay, Fn task,
+				Args... args) {
+			const auto previousNextEvent = delayedEvents.GetNextEventTime();
+			DelayedEvents::Handle handle = delayedEvents.PushEvent(msDelay,
+					(void(*)(Args...))task, args...);
+			// sleeping workers already wait for earlier event otherwise
+			if(delayedEvents.GetNextEventTime() < previousNextEvent) {
+				WakeOneWorker();
+			}
+			return handle;
+		}
+		
+		// returns true if task was cancelled before it started executing
+		inline bool CancelDelayedTask(DelayedEvents::Handle handle) {
+			return delayedEvents.Cancel(handle);
 		}
 		
 		bool ExecuteOne(); // returns true if anything was executed
 		
 	private:
 		
-		EventQueue regularEvents;
-		EventQueue priorityEvents;
+		enum Lane : uint32_t {
+			LANE_PRIORITY = 0,
+			LANE_REGULAR = 1
+		};
+		
+		struct Worker {
+			std::mutex mutex;
+			std::deque<Task> lanes[2];
+			std::thread thread;
+		};
+		
+		static constexpr uint32_t NO_WORKER = 0xFFFFFFFF;
+		// expired delayed events executed at once by single worker
+		static constexpr uint32_t DELAYED_EVENTS_BATCH = 16;
+		
+		void PushTask(Task&& task, uint32_t lane);
+		bool PopTask(uint32_t self, uint32_t lane, Task& task);
+		bool ExecuteOne(uint32_t self);
+		void WorkerLoop(uint32_t self);
+		void Park();
+		void WakeOneWorker();
+		void WakeAllWorkers();
+		
+	private:
+		
+		std::vector<std::unique_ptr<Worker>> workers;
+		
+		std::atomic<uint32_t> nextWorker;
+		// tasks in workers deques, not counting delayed ones
+		std::atomic<uint32_t> pendingTasks;
+		std::atomic<uint32_t> sleepingWorkers;
+		std::atomic<bool> stopping;
+		bool started;
+		
+		std::mutex parkMutex;
+		std::condition_variable parkCondition;
 		
 		DelayedEvents delayedEvents;
+		
+		static thread_local Scheduler* currentScheduler;
+		static thread_local uint32_t currentWorker;
 	};
 }
 
 #endif
-
@@ -0,0 +1,127 @@
+/*
+ *  This file is part of QuickGL.
+ *  Copyright (C) 2023 Marek Zalewski aka Drwalin
+ *
+ *  QuickGL is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  QuickGL is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef QUICKGL_TASK_HPP
+#define QUICKGL_TASK_HPP
+
+#include <cstddef>
+
+#include <new>
+#include <utility>
+#include <type_traits>
+
+namespace qgl {
+	/*
+	 * Move-only callable without arguments. Callables up to INLINE_SIZE bytes
+	 * are stored inline, bigger ones are allocated on heap.
+	 */
+	class Task final {
+	public:
+		
+		static constexpr size_t INLINE_SIZE = 48;
+		
+		Task() : ops(nullptr) {}
+		
+		template<typename F, typename = std::enable_if_t<
+			!std::is_same_v<std::decay_t<F>, Task>>>
+		Task(F&& func) {
+			using T = std::decay_t<F>;
+			if constexpr(sizeof(T) <= INLINE_SIZE
+					&& alignof(T) <= alignof(std::max_align_t)
+					&& std::is_nothrow_move_constructible_v<T>) {
+				new(storage) T(std::forward<F>(func));
+				ops = &InlineOps<T>::ops;
+			} else {
+				*(T**)storage = new T(std::forward<F>(func));
+				ops = &HeapOps<T>::ops;
+			}
+		}
+		
+		Task(Task&& other) noexcept : ops(other.ops) {
+			if(ops) {
+				ops->move(storage, other.storage);
+				other.ops = nullptr;
+			}
+		}
+		
+		Task& operator=(Task&& other) noexcept {
+			if(this != &other) {
+				Reset();
+				ops = other.ops;
+				if(ops) {
+					ops->move(storage, other.storage);
+					other.ops = nullptr;
+				}
+			}
+			return *this;
+		}
+		
+		Task(const Task&) = delete;
+		Task& operator=(const Task&) = delete;
+		
+		~Task() {
+			Reset();
+		}
+		
+		inline void Reset() {
+			if(ops) {
+				ops->destroy(storage);
+				ops = nullptr;
+			}
+		}
+		
+		inline explicit operator bool() const { return ops != nullptr; }
+		
+		inline void operator()() { ops->invoke(storage); }
+		
+	private:
+		
+		struct Ops {
+			void (*invoke)(void* storage);
+			// move constructs into dst and destroys src
+			void (*move)(void* dst, void* src);
+			void (*destroy)(void* storage);
+		};
+		
+		template<typename T>
+		struct InlineOps {
+			static void Invoke(void* s) { (*(T*)s)(); }
+			static void Move(void* d, void* s) {
+				new(d) T(std::move(*(T*)s));
+				((T*)s)->~T();
+			}
+			static void Destroy(void* s) { ((T*)s)->~T(); }
+			inline const static Ops ops{Invoke, Move, Destroy};
+		};
+		
+		template<typename T>
+		struct HeapOps {
+			static void Invoke(void* s) { (**(T**)s)(); }
+			static void Move(void* d, void* s) { *(T**)d = *(T**)s; }
+			static void Destroy(void* s) { delete *(T**)s; }
+			inline const static Ops ops{Invoke, Move, Destroy};
+		};
+		
+	private:
+		
+		alignas(std::max_align_t) unsigned char storage[INLINE_SIZE];
+		const Ops* ops;
+	};
+}
+
+#endif
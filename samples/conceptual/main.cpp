@@ -402,6 +402,14 @@ int main() {
 					renderTime/1000000, renderTime%1000000);
 			ImGui::Text("Cpu time spent on each task separately sum: %6.6f us",
 					engine->CountCpuTime()*1000000);
+			for(auto w : engine->GetStageWaits()) {
+				ImGui::Text("Waited: %10.3f us \t  %24s | %s",
+						w.waitedSeconds*1000000.0,
+						w.stage->pipeline->GetName().c_str(),
+						w.stage->name.c_str());
+			}
+			ImGui::Text("Time spent waiting for GPU fences: %6.6f us",
+					engine->CountWaitTime()*1000000);
 		ImGui::End();
 		
 		ImGui::Begin("Other camera");
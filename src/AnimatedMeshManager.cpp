@@ -42,12 +42,10 @@ namespace qgl {
 	
 	void AnimatedMeshManager::ReleaseMeshReference(uint32_t id) {
 		MeshManager::ReleaseMeshReference(id);
-		throw "AnimatedMeshManager::ReleaseMeshReference is not implemented.";
 	}
 	
 	void AnimatedMeshManager::FreeMesh(uint32_t id) {
 		MeshManager::FreeMesh(id);
-		throw "AnimatedMeshManager::FreeMesh is not implemented.";
 	}
 	
 	bool AnimatedMeshManager::LoadModels(
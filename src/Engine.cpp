@@ -19,6 +19,7 @@
 #include <chrono>
 #include <set>
 #include <thread>
+#include <algorithm>
 
 #include "../OpenGLWrapper/include/openglwrapper/OpenGL.hpp"
 #include "../OpenGLWrapper/include/openglwrapper/FBO.hpp"
@@ -28,6 +29,9 @@
 #include "../include/quickgl/Gui.hpp"
 #include "../include/quickgl/util/DeltaVboManager.hpp"
 #include "../include/quickgl/util/MoveVboUpdater.hpp"
+#include "../include/quickgl/util/EntityCommandBuffer.hpp"
+#include "../include/quickgl/util/Scheduler.hpp"
+#include "../include/quickgl/util/FrameTaskGraph.hpp"
 #include "../include/quickgl/GlobalEntityManager.hpp"
 #include "../include/quickgl/IndirectDrawBufferGenerator.hpp"
 #include "../include/quickgl/BlitCameraToScreen.hpp"
@@ -39,6 +43,9 @@ namespace qgl {
 	Engine::Engine() {
 		initialized = false;
 		profiling = false;
+		frameIndex = 0;
+		deltaVboMinCapacity = 1024*1024;
+		deltaVboMaxCapacity = 256*1024*1024;
 	}
 	
 	Engine::~Engine() {
@@ -58,7 +65,19 @@ namespace qgl {
 		Gui::InitIMGUI();
 		initialized = true;
 		
-		deltaVboManager = std::make_shared<DeltaVboManager>(1024*1024, 16);
+		// render thread helps workers while it waits for GPU
+		scheduler = std::make_shared<Scheduler>(
+				std::max(2u, std::thread::hardware_concurrency()) - 1);
+		scheduler->Start();
+		frameTaskGraph = std::make_shared<FrameTaskGraph>(scheduler);
+		renderStageComposer.SetFrameTaskGraph(frameTaskGraph);
+		
+		const uint32_t deltaVboCapacity = std::clamp<uint32_t>(16*1024*1024,
+				deltaVboMinCapacity, deltaVboMaxCapacity);
+		deltaVboManager = std::make_shared<DeltaVboManager>(
+				deltaVboCapacity/16, 16);
+		deltaVboManager->SetCapacityLimits(deltaVboMinCapacity,
+				deltaVboMaxCapacity);
 		deltaVboManager->Init();
 		moveVboManager = std::make_shared<MoveVboManager>(shared_from_this());
 		globalEntityManager = std::make_shared<GlobalEntityManager>(shared_from_this());
@@ -79,6 +98,9 @@ namespace qgl {
 			gl::Finish();
 			
 			renderStageComposer.Destroy();
+			frameTaskGraph = nullptr;
+			scheduler->Stop();
+			scheduler = nullptr;
 
 			for(auto& p : pipelines) {
 				p = nullptr;
@@ -90,6 +112,7 @@ namespace qgl {
 
 			mainCamera = nullptr;
 			
+			entityCommandBuffers.clear();
 			globalEntityManager = nullptr;
 
 			Gui::DeinitIMGUI();
@@ -134,6 +157,9 @@ namespace qgl {
 	}
 	
 	void Engine::Render() {
+		++frameIndex;
+		ApplyEntityCommandBuffers();
+		
 		for(auto c : cameras) {
 			c->PrepareDataForNewFrame();
 			c->Clear(true);
@@ -142,10 +168,22 @@ namespace qgl {
 		renderStageComposer.ResetExecution();
 		while(renderStageComposer.HasAnyStagesLeft()) {
 			if(renderStageComposer.ContinueStages() == false) {
-				std::this_thread::sleep_for(std::chrono::microseconds(100));
+				// execute CPU jobs while stages wait for GPU
+				if(renderStageComposer.ExecuteCpuJob() == false) {
+					// waits are bounded, because jobs finished by workers and
+					// fences may unblock other stages
+					if(renderStageComposer.WaitForBlockedStages(
+								MAX_FENCE_WAIT_NANOSECONDS) == false
+							&& renderStageComposer.WaitForCpuJob(
+								MAX_JOB_WAIT_NANOSECONDS) == false) {
+						std::this_thread::sleep_for(std::chrono::nanoseconds(
+									IDLE_SLEEP_NANOSECONDS));
+					}
+				}
 			}
-			// do some CPU work between render stages here
 		}
+		renderStageComposer.EndFrame();
+		deltaVboManager->EndFrame();
 		gl::FBO::Unbind();
 		if(mainCamera) {
 			auto tex = mainCamera->GetMainColorTexture();
@@ -207,6 +245,16 @@ namespace qgl {
 		return deltaVboManager;
 	}
 	
+	void Engine::SetDeltaVboLimits(uint32_t minCapacityBytes,
+			uint32_t maxCapacityBytes) {
+		deltaVboMinCapacity = minCapacityBytes;
+		deltaVboMaxCapacity = std::max(maxCapacityBytes, minCapacityBytes);
+		if(deltaVboManager) {
+			deltaVboManager->SetCapacityLimits(deltaVboMinCapacity,
+					deltaVboMaxCapacity);
+		}
+	}
+	
 	std::shared_ptr<MoveVboManager> Engine::GetMoveVboManager() {
 		return moveVboManager;
 	}
@@ -218,5 +266,41 @@ namespace qgl {
 	std::shared_ptr<IndirectDrawBufferGenerator> Engine::GetIndirectDrawBufferGenerator() {
 		return indirectDrawBufferGenerator;
 	}
+	
+	std::shared_ptr<Scheduler> Engine::GetScheduler() {
+		return scheduler;
+	}
+	
+	std::shared_ptr<FrameTaskGraph> Engine::GetFrameTaskGraph() {
+		return frameTaskGraph;
+	}
+	
+	std::shared_ptr<EntityCommandBuffer> Engine::CreateEntityCommandBuffer(
+			uint32_t sortKey) {
+		auto buffer = std::make_shared<EntityCommandBuffer>(sortKey);
+		std::lock_guard<std::mutex> lock(entityCommandBuffersMutex);
+		// keep buffers with equal keys in order of creation
+		auto it = std::upper_bound(entityCommandBuffers.begin(),
+				entityCommandBuffers.end(), sortKey,
+				[](uint32_t key, const std::shared_ptr<EntityCommandBuffer>& b) {
+					return key < b->GetSortKey();
+				});
+		entityCommandBuffers.insert(it, buffer);
+		return buffer;
+	}
+	
+	void Engine::ApplyEntityCommandBuffers() {
+		std::lock_guard<std::mutex> lock(entityCommandBuffersMutex);
+		for(auto& buffer : entityCommandBuffers) {
+			if(!buffer->Empty()) {
+				buffer->Apply(*this);
+			}
+		}
+		entityCommandBuffers.erase(std::remove_if(entityCommandBuffers.begin(),
+					entityCommandBuffers.end(),
+					[](const std::shared_ptr<EntityCommandBuffer>& b) {
+						return b.use_count() == 1;
+					}), entityCommandBuffers.end());
+	}
 }
 
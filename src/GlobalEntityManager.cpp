@@ -23,7 +23,7 @@
 namespace qgl {
 	GlobalEntityManager::GlobalEntityManager(std::shared_ptr<Engine> engine) :
 			engine(engine) {
-		lastAddedEntity = 0;
+		allEntitiesAdded = 0;
 	}
 
 	GlobalEntityManager::~GlobalEntityManager() {
@@ -32,32 +32,27 @@ namespace qgl {
 	uint32_t GlobalEntityManager::GetNewEntity(
 			std::shared_ptr<Pipeline> pipeline, uint32_t offset) {
 		allEntitiesAdded++;
-		uint32_t entity = 0;
-		for(;;) {
-			entity = ++lastAddedEntity;
-			if(entity == 0)
-				continue;
-			if(mapEntity.find(entity) == mapEntity.end())
-				break;
-		}
-		mapEntity[entity] = {offset, pipeline->GetPipelineId()};
-		return entity;
+		return registry.Create(pipeline->GetPipelineId(), offset);
 	}
 
-	void GlobalEntityManager::FreeEntity(uint32_t entity) {
-		mapEntity.erase(entity);
+	void GlobalEntityManager::GetNewEntities(std::shared_ptr<Pipeline> pipeline,
+			uint32_t firstOffset, uint32_t count, uint32_t* outEntities) {
+		allEntitiesAdded += count;
+		registry.Create(pipeline->GetPipelineId(), firstOffset, count,
+				outEntities);
 	}
 
-	uint32_t GlobalEntityManager::GetEntityOffset(uint32_t entity) {
-		auto it = mapEntity.find(entity);
-		if(it == mapEntity.end())
-			return 0;
-		return it->second.offset;
+	void GlobalEntityManager::FreeEntity(uint32_t entity) {
+		registry.Destroy(entity);
 	}
 
 	void GlobalEntityManager::SetEntityOffset(uint32_t entity,
 			uint32_t offset) {
-		mapEntity[entity].offset = offset;
+		registry.SetOffset(entity, offset);
 	}
-}
 
+	void GlobalEntityManager::SetEntityPipeline(uint32_t entity,
+			uint32_t pipelineId, uint32_t offset) {
+		registry.SetPipeline(entity, pipelineId, offset);
+	}
+}
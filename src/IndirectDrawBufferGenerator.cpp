@@ -17,6 +17,7 @@
  */
 
 #include <memory>
+#include <algorithm>
 
 #include "../OpenGLWrapper/include/openglwrapper/VBO.hpp"
 #include "../OpenGLWrapper/include/openglwrapper/Shader.hpp"
@@ -43,44 +44,83 @@ namespace qgl {
 		
 		ENTITIES_COUNT_LOCATION = shader->GetUniformLocation("entitiesCount");
 		ENTITIES_OFFSET_LOCATION = shader->GetUniformLocation("entitiesOffset");
+		PAGES_COUNT_LOCATION = shader->GetUniformLocation("pagesCount");
+		
+		pageCursors = std::make_shared<gl::VBO>(sizeof(uint32_t),
+				gl::SHADER_STORAGE_BUFFER, gl::DYNAMIC_DRAW);
+		pageCursors->Init(16);
 	}
 	
 	void IndirectDrawBufferGenerator::Destroy() {
 		engine = nullptr;
 		shader->Destroy();
 		shader = nullptr;
+		pageCursors->Destroy();
+		pageCursors = nullptr;
 	}
 	
-	std::shared_ptr<gl::VBO> IndirectDrawBufferGenerator::Generate(
+	DeltaVboManager::Region IndirectDrawBufferGenerator::Generate(
 			gl::VBO& entitiesToRender,
-			gl::VBO& meshInfo,
+			gl::VBO& meshIds,
+			gl::VBO& meshTable,
 			uint32_t entitiesCount,
 			uint32_t entitiesOffset,
 			uint32_t& generatedCount) {
-		auto vbo = engine->GetDeltaVboManager()->GetNextUpdateVBO();
-		generatedCount = std::min<uint32_t>(entitiesCount, vbo->GetVertexCount()*vbo->VertexSize()/20);
-		Generate(entitiesToRender, meshInfo, *vbo, generatedCount, entitiesOffset);
-		return vbo;
+		DeltaVboManager::Region region = engine->GetDeltaVboManager()
+			->Allocate((entitiesOffset+entitiesCount)
+					*sizeof(DrawElementsIndirectCommand),
+					sizeof(DrawElementsIndirectCommand));
+		const uint32_t fitting = region.size/sizeof(DrawElementsIndirectCommand);
+		generatedCount = std::min<uint32_t>(entitiesCount,
+				fitting - std::min(fitting, entitiesOffset));
+		region.BindBufferRange(3);
+		Dispatch(entitiesToRender, meshIds, meshTable, generatedCount,
+				entitiesOffset, 1);
+		return region;
 	}
 	
 	void IndirectDrawBufferGenerator::Generate(
 			gl::VBO& entitiesToRender,
-			gl::VBO& meshInfo,
+			gl::VBO& meshIds,
+			gl::VBO& meshTable,
 			gl::VBO& indirectDrawBuffer,
 			uint32_t entitiesCount,
-			uint32_t entitiesOffset) {
+			uint32_t entitiesOffset,
+			const uint32_t* pageOffsets,
+			uint32_t pagesCount) {
+		if(pagesCount > 1) {
+			if(pageCursors->GetVertexCount() < pagesCount) {
+				pageCursors->Generate(nullptr, pagesCount);
+			}
+			pageCursors->Update(pageOffsets, 0, pagesCount*sizeof(uint32_t));
+			pageCursors->BindBufferBase(gl::SHADER_STORAGE_BUFFER, 5);
+		}
+		indirectDrawBuffer
+			.BindBufferBase(gl::SHADER_STORAGE_BUFFER, 3);
+		Dispatch(entitiesToRender, meshIds, meshTable, entitiesCount,
+				entitiesOffset, pagesCount);
+	}
+	
+	void IndirectDrawBufferGenerator::Dispatch(
+			gl::VBO& entitiesToRender,
+			gl::VBO& meshIds,
+			gl::VBO& meshTable,
+			uint32_t entitiesCount,
+			uint32_t entitiesOffset,
+			uint32_t pagesCount) {
 		// set visible entities count
 		shader->Use();
 		
 		// bind buffers
 		entitiesToRender
 			.BindBufferBase(gl::SHADER_STORAGE_BUFFER, 1);
-		meshInfo
+		meshIds
 			.BindBufferBase(gl::SHADER_STORAGE_BUFFER, 2);
-		indirectDrawBuffer
-			.BindBufferBase(gl::SHADER_STORAGE_BUFFER, 3);
+		meshTable
+			.BindBufferBase(gl::SHADER_STORAGE_BUFFER, 4);
 		shader->SetUInt(ENTITIES_COUNT_LOCATION, entitiesCount);
 		shader->SetUInt(ENTITIES_OFFSET_LOCATION, entitiesOffset);
+		shader->SetUInt(PAGES_COUNT_LOCATION, pagesCount);
 		
 		// generate indirect draw command
 		shader->DispatchRoundGroupNumbers(entitiesCount, 1, 1);
@@ -104,35 +144,50 @@ struct DrawElementsIndirectCommand {
 	uint baseInstance;
 };
 
-struct PerEntityMeshInfo {
+struct MeshTableEntry {
 	uint elementsStart;
 	uint elementsCount;
+	uint page;
+	uint reserved;
+	vec4 boundingSphere;
 };
 
 layout (std430, binding=1) readonly buffer ccc {
 	uint visibleEntityIds[];
 };
 layout (std430, binding=2) readonly buffer bbb {
-	PerEntityMeshInfo meshInfo[];
+	uint meshIds[];
 };
 layout (std430, binding=3) writeonly buffer aaa {
 	DrawElementsIndirectCommand indirectCommands[];
 };
+layout (std430, binding=4) readonly buffer ddd {
+	MeshTableEntry meshTable[];
+};
+layout (std430, binding=5) buffer eee {
+	uint pageCursors[];
+};
 
 layout (local_size_x = 256, local_size_y = 1, local_size_z = 1) in;
 
 uniform uint entitiesCount;
 uniform uint entitiesOffset;
+uniform uint pagesCount;
 
 void main() {
 	if(gl_GlobalInvocationID.x >= entitiesCount)
 		return;
 	uint ids = entitiesOffset + gl_GlobalInvocationID.x;
 	uint id = visibleEntityIds[ids];
-	indirectCommands[ids] = DrawElementsIndirectCommand(
-		meshInfo[id].elementsCount,
+	MeshTableEntry mesh = meshTable[meshIds[id]];
+	uint target = ids;
+	if(pagesCount > 1) {
+		target = atomicAdd(pageCursors[mesh.page], 1);
+	}
+	indirectCommands[target] = DrawElementsIndirectCommand(
+		mesh.elementsCount,
 		1,
-		meshInfo[id].elementsStart,
+		mesh.elementsStart,
 		0,
 		id
 	);
@@ -16,11 +16,18 @@
  *  along with this program.  If not, see <https://www.gnu.org/licenses/>.
  */
 
+#include <cstring>
+
+#include <algorithm>
+
 #include <memory>
 #include <vector>
 #include <map>
 
+#include "../OpenGLWrapper/include/openglwrapper/OpenGL.hpp"
 #include "../OpenGLWrapper/include/openglwrapper/VBO.hpp"
+#include "../OpenGLWrapper/include/openglwrapper/Shader.hpp"
+#include "../OpenGLWrapper/include/openglwrapper/Sync.hpp"
 #include "../OpenGLWrapper/include/openglwrapper/VAO.hpp"
 #include "../OpenGLWrapper/include/openglwrapper/Texture.hpp"
 #include "../OpenGLWrapper/include/openglwrapper/basic_mesh_loader/AssimpLoader.hpp"
@@ -33,10 +40,20 @@ namespace qgl {
 				std::vector<uint8_t>& buffer,
 				uint32_t bufferByteOffset,
 				gl::BasicMeshLoader::Mesh* mesh))
-		: vboAllocator(vertexSize, false), vbo(vboAllocator.Vbo()),
-			eboAllocator(sizeof(uint32_t), true), ebo(eboAllocator.Vbo()),
+		: meshTableDirtyBegin(0xFFFFFFFF), meshTableDirtyEnd(0),
+			verticesPerPage(0), elementsPerPage(0),
+			currentEpoch(1), epochHasDeferredFrees(false),
+			reservedVertices(0), reservedElements(0), lastCompactionFrame(0),
 			meshAppenderVertices(meshAppenderVertices),
 			vertexSize(vertexSize) {
+		pages.emplace_back(std::make_unique<Page>(vertexSize, currentEpoch));
+	}
+	
+	MeshManager::Page::Page(uint32_t vertexSize, uint32_t epoch) :
+		vboAllocator(vertexSize, false),
+		eboAllocator(sizeof(uint32_t), true) {
+		vboAllocator.BeginEpoch(epoch);
+		eboAllocator.BeginEpoch(epoch);
 	}
 	
 	MeshManager::~MeshManager() {
@@ -109,16 +126,16 @@ namespace qgl {
 		std::vector<uint8_t> vboSrc, eboSrc;
 		if(meshAppenderVertices(vboSrc, 0, mesh)) {
 			MeshInfo info;
+			info.name = mesh->name;
 			mesh->GetBoundingSphereInfo(info.boundingSphereCenterOffset,
 				info.boundingSphereRadius);
 			
 			info.countVertices = mesh->pos.size();
-			info.firstVertex = vboAllocator.Allocate(info.countVertices);
+			info.countElements = mesh->indices.size();
+			AllocateMesh(info);
 			
 			eboSrc.clear();
 			mesh->AppendIndices<uint32_t>(info.firstVertex, eboSrc);
-			info.countElements = mesh->indices.size();
-			info.firstElement = eboAllocator.Allocate(info.countElements);
 			
 			std::string name = mesh->name;
 			uint32_t meshId = idsManager.GetNewId();
@@ -127,17 +144,84 @@ namespace qgl {
 				meshInfo.resize(meshId+100);
 			}
 			meshInfo[meshId] = info;
+			UpdateMeshTableEntry(meshId);
+			Page& page = *pages[info.page];
+			page.meshIdByFirstVertex[info.firstVertex] = meshId;
+			page.meshIdByFirstElement[info.firstElement] = meshId;
 			
-			vbo.Update(&vboSrc.front(), info.firstVertex*vertexSize,
+			page.vboAllocator.Vbo().Update(&vboSrc.front(),
+					info.firstVertex*vertexSize,
 					info.countVertices*vertexSize);
 			
-			ebo.Update(&eboSrc.front(), info.firstElement*sizeof(uint32_t),
+			page.eboAllocator.Vbo().Update(&eboSrc.front(),
+					info.firstElement*sizeof(uint32_t),
 					info.countElements*sizeof(uint32_t));
 			return true;
 		}
 		return false;
 	}
 	
+	void MeshManager::AllocateMesh(MeshInfo& info) {
+		if(verticesPerPage == 0) {
+			info.page = 0;
+			info.firstVertex = pages[0]->vboAllocator.Allocate(
+					info.countVertices);
+			info.firstElement = pages[0]->eboAllocator.Allocate(
+					info.countElements);
+			return;
+		}
+		
+		for(uint32_t i=0; i<pages.size(); ++i) {
+			Page& page = *pages[i];
+			const uint32_t firstVertex =
+				page.vboAllocator.TryAllocate(info.countVertices);
+			if(firstVertex == Allocator::INVALID_OFFSET) {
+				continue;
+			}
+			const uint32_t firstElement =
+				page.eboAllocator.TryAllocate(info.countElements);
+			if(firstElement == Allocator::INVALID_OFFSET) {
+				page.vboAllocator.Free(firstVertex, info.countVertices);
+				continue;
+			}
+			info.page = i;
+			info.firstVertex = firstVertex;
+			info.firstElement = firstElement;
+			return;
+		}
+		
+		Page& page = AppendPage(std::max(info.countVertices, verticesPerPage),
+				std::max(info.countElements, elementsPerPage));
+		info.page = pages.size()-1;
+		info.firstVertex = page.vboAllocator.TryAllocate(info.countVertices);
+		info.firstElement = page.eboAllocator.TryAllocate(info.countElements);
+	}
+	
+	MeshManager::Page& MeshManager::AppendPage(uint32_t vertices,
+			uint32_t elements) {
+		pages.emplace_back(std::make_unique<Page>(vertexSize, currentEpoch));
+		Page& page = *pages.back();
+		page.vboAllocator.ReserveAdditional(std::max(vertices, 1u));
+		page.eboAllocator.ReserveAdditional(std::max(elements, 1u));
+		return page;
+	}
+	
+	void MeshManager::EnablePaging(uint32_t verticesPerPage,
+			uint32_t elementsPerPage) {
+		if(pages.size() > 1 ||
+				pages[0]->vboAllocator.GetStats().liveAllocations > 0) {
+			throw "qgl::MeshManager::EnablePaging() has to be called before any mesh is loaded.";
+		}
+		this->verticesPerPage = verticesPerPage;
+		this->elementsPerPage = elementsPerPage;
+		pages.clear();
+		if(verticesPerPage > 0) {
+			AppendPage(verticesPerPage, elementsPerPage);
+		} else {
+			pages.emplace_back(std::make_unique<Page>(vertexSize, currentEpoch));
+		}
+	}
+	
 	MeshManager::MeshInfo MeshManager::GetMeshInfoById(uint32_t id) const {
 		return meshInfo[id];
 	}
@@ -157,6 +241,14 @@ namespace qgl {
 		indexCount = info.countElements;
 	}
 	
+	void MeshManager::GetMeshIndices(uint32_t meshId, uint32_t& indexStart,
+			uint32_t& indexCount, uint32_t& page) {
+		MeshInfo info = GetMeshInfoById(meshId);
+		indexStart = info.firstElement;
+		indexCount = info.countElements;
+		page = info.page;
+	}
+	
 	void MeshManager::GetMeshBoundingSphere(uint32_t meshId, float* offset,
 			float& radius) {
 		MeshInfo info = GetMeshInfoById(meshId);
@@ -165,11 +257,285 @@ namespace qgl {
 	}
 	
 	void MeshManager::FreeMesh(uint32_t id) {
-		throw "Meshmanager::FreeMesh is not implemented.";
+		MeshInfo& info = meshInfo[id];
+		Page& page = *pages[info.page];
+		page.vboAllocator.FreeDeferred(info.firstVertex, info.countVertices);
+		page.eboAllocator.FreeDeferred(info.firstElement, info.countElements);
+		epochHasDeferredFrees = true;
+		page.meshIdByFirstVertex.erase(info.firstVertex);
+		page.meshIdByFirstElement.erase(info.firstElement);
+		auto it = mapNameToId.find(info.name);
+		if(it != mapNameToId.end() && it->second == id) {
+			mapNameToId.erase(it);
+		}
+		idsManager.FreeId(id);
+		info = MeshInfo();
+		UpdateMeshTableEntry(id);
 	}
 	
 	void MeshManager::ReleaseMeshReference(uint32_t id) {
-		throw "Meshmanager::ReleaseMeshReference is not implemented.";
+		// meshes are not reference counted yet
+		FreeMesh(id);
 	}
-}
+	
+	void MeshManager::ReserveCapacity(uint32_t vertices, uint32_t elements) {
+		reservedVertices = vertices;
+		reservedElements = elements;
+		if(verticesPerPage == 0) {
+			AllocatorVBO& vboAllocator = pages[0]->vboAllocator;
+			AllocatorVBO& eboAllocator = pages[0]->eboAllocator;
+			if(vboAllocator.GetCapacity() < vertices) {
+				vboAllocator.ReserveAdditional(
+						vertices - vboAllocator.GetCapacity());
+			}
+			if(eboAllocator.GetCapacity() < elements) {
+				eboAllocator.ReserveAdditional(
+						elements - eboAllocator.GetCapacity());
+			}
+			return;
+		}
+		
+		uint64_t totalVertices = 0, totalElements = 0;
+		for(auto& page : pages) {
+			totalVertices += page->vboAllocator.GetCapacity();
+			totalElements += page->eboAllocator.GetCapacity();
+		}
+		while(totalVertices < vertices || totalElements < elements) {
+			Page& page = AppendPage(verticesPerPage, elementsPerPage);
+			totalVertices += page.vboAllocator.GetCapacity();
+			totalElements += page.eboAllocator.GetCapacity();
+		}
+	}
+	
+	void MeshManager::CompactBuffers(uint32_t bytesBudget,
+			uint64_t frameIndex) {
+		if(frameIndex == lastCompactionFrame) {
+			return;
+		}
+		lastCompactionFrame = frameIndex;
+		for(uint32_t i=0; i<pages.size(); ++i) {
+			CompactPage(i, bytesBudget);
+		}
+		
+		if(verticesPerPage == 0) {
+			pages[0]->vboAllocator.ShrinkToFit(
+					std::max(reservedVertices, 4096u));
+			pages[0]->eboAllocator.ShrinkToFit(
+					std::max(reservedElements, 4096u));
+		}
+	}
+	
+	void MeshManager::ProcessDeferredFrees() {
+		while(!epochFences.empty() && epochFences.front().sync->IsDone()) {
+			for(auto& page : pages) {
+				page->vboAllocator.ReleaseEpochs(epochFences.front().epoch);
+				page->eboAllocator.ReleaseEpochs(epochFences.front().epoch);
+			}
+			epochFences.front().sync->Destroy();
+			epochFences.pop_front();
+		}
+		
+		if(epochHasDeferredFrees == false) {
+			return;
+		}
+		std::shared_ptr<gl::Sync> sync = std::make_shared<gl::Sync>();
+		sync->StartFence();
+		epochFences.push_back({currentEpoch, sync});
+		
+		++currentEpoch;
+		epochHasDeferredFrees = false;
+		for(auto& page : pages) {
+			page->vboAllocator.BeginEpoch(currentEpoch);
+			page->eboAllocator.BeginEpoch(currentEpoch);
+		}
+	}
+	
+	void MeshManager::CompactPage(uint32_t pageId, uint32_t& bytesBudget) {
+		Page& page = *pages[pageId];
+		gl::VBO& vbo = page.vboAllocator.Vbo();
+		gl::VBO& ebo = page.eboAllocator.Vbo();
+		
+		Allocator::Relocation r;
+		while(bytesBudget >= vertexSize &&
+				page.vboAllocator.Relocate(bytesBudget/vertexSize, r)) {
+			const uint32_t meshId = page.meshIdByFirstVertex[r.from];
+			page.meshIdByFirstVertex.erase(r.from);
+			page.meshIdByFirstVertex[r.to] = meshId;
+			
+			vbo.Copy(&vbo, r.from*vertexSize, r.to*vertexSize,
+					r.count*vertexSize);
+			QueueRebaseIndices(meshId, r.from, r.to);
+			meshInfo[meshId].firstVertex = r.to;
+			epochHasDeferredFrees = true;
+			
+			bytesBudget -= r.count*vertexSize;
+		}
+		// indices have to be rebased before element ranges are moved
+		RebaseIndices(ebo);
+		
+		while(bytesBudget >= sizeof(uint32_t) &&
+				page.eboAllocator.Relocate(bytesBudget/sizeof(uint32_t), r)) {
+			const uint32_t meshId = page.meshIdByFirstElement[r.from];
+			page.meshIdByFirstElement.erase(r.from);
+			page.meshIdByFirstElement[r.to] = meshId;
+			
+			ebo.Copy(&ebo, r.from*sizeof(uint32_t), r.to*sizeof(uint32_t),
+					r.count*sizeof(uint32_t));
+			meshInfo[meshId].firstElement = r.to;
+			UpdateMeshTableEntry(meshId);
+			epochHasDeferredFrees = true;
+			
+			bytesBudget -= r.count*sizeof(uint32_t);
+		}
+	}
+	
+	void MeshManager::QueueRebaseIndices(uint32_t meshId,
+			uint32_t oldFirstVertex, uint32_t newFirstVertex) {
+		const MeshInfo& info = meshInfo[meshId];
+		if(info.countElements == 0) {
+			return;
+		}
+		auto it = rebaseRecordByMesh.find(meshId);
+		if(it != rebaseRecordByMesh.end()) {
+			// indices still refer to vertices before the first move
+			rebaseRecords[it->second].newFirstVertex = newFirstVertex;
+			return;
+		}
+		uint32_t elementsOffset = 0;
+		if(!rebaseRecords.empty()) {
+			const MeshInfo& last = meshInfo[rebaseRecordMeshes.back()];
+			elementsOffset = rebaseRecords.back().elementsOffset
+				+ last.countElements;
+		}
+		rebaseRecordByMesh[meshId] = rebaseRecords.size();
+		rebaseRecordMeshes.emplace_back(meshId);
+		rebaseRecords.push_back({info.firstElement, elementsOffset,
+				oldFirstVertex, newFirstVertex});
+	}
+	
+	void MeshManager::RebaseIndices(gl::VBO& ebo) {
+		if(rebaseRecords.empty()) {
+			return;
+		}
+		const uint32_t totalElements = rebaseRecords.back().elementsOffset
+			+ meshInfo[rebaseRecordMeshes.back()].countElements;
+		
+		if(!rebaseIndicesShader) {
+			rebaseIndicesShader = std::make_unique<gl::Shader>();
+			if(rebaseIndicesShader->Compile(REBASE_INDICES_COMPUTE_SHADER_SOURCE))
+				exit(31);
+			rebaseIndicesUniformLocations[0] =
+				rebaseIndicesShader->GetUniformLocation("recordsCount");
+			rebaseIndicesUniformLocations[1] =
+				rebaseIndicesShader->GetUniformLocation("totalElements");
+			rebaseRecordsBuffer = std::make_unique<gl::VBO>(
+					sizeof(RebaseRecord), gl::SHADER_STORAGE_BUFFER,
+					gl::DYNAMIC_DRAW);
+			rebaseRecordsBuffer->Init();
+		}
+		
+		if(rebaseRecordsBuffer->GetVertexCount() < rebaseRecords.size()) {
+			rebaseRecordsBuffer->Generate(rebaseRecords.data(),
+					rebaseRecords.size());
+		} else {
+			rebaseRecordsBuffer->Update(rebaseRecords.data(), 0,
+					rebaseRecords.size()*sizeof(RebaseRecord));
+		}
+		
+		rebaseIndicesShader->Use();
+		rebaseIndicesShader->SetUInt(rebaseIndicesUniformLocations[0],
+				rebaseRecords.size());
+		rebaseIndicesShader->SetUInt(rebaseIndicesUniformLocations[1],
+				totalElements);
+		ebo.BindBufferBase(gl::SHADER_STORAGE_BUFFER, 1);
+		rebaseRecordsBuffer->BindBufferBase(gl::SHADER_STORAGE_BUFFER, 2);
+		rebaseIndicesShader->DispatchRoundGroupNumbers(totalElements, 1, 1);
+		gl::Shader::Unuse();
+		
+		// rebased indices are read by draws and by element relocation copies
+		gl::MemoryBarrier(gl::SHADER_STORAGE_BARRIER_BIT
+				| gl::ELEMENT_ARRAY_BARRIER_BIT
+				| gl::BUFFER_UPDATE_BARRIER_BIT);
+		
+		rebaseRecords.clear();
+		rebaseRecordMeshes.clear();
+		rebaseRecordByMesh.clear();
+	}
+	
+	const char* MeshManager::REBASE_INDICES_COMPUTE_SHADER_SOURCE = R"(
+#version 420 core
+#extension GL_ARB_compute_shader : require
+#extension GL_ARB_shader_storage_buffer_object : require
+
+struct RebaseRecord {
+	uint firstElement;
+	uint elementsOffset;
+	uint oldFirstVertex;
+	uint newFirstVertex;
+};
 
+layout (std430, binding=1) buffer indicesBuffer {
+	uint indices[];
+};
+
+layout (std430, binding=2) readonly buffer recordsBuffer {
+	RebaseRecord records[];
+};
+
+layout (local_size_x = 256, local_size_y = 1, local_size_z = 1) in;
+
+uniform uint recordsCount;
+uniform uint totalElements;
+
+void main() {
+	uint id = gl_GlobalInvocationID.x;
+	if(id >= totalElements)
+		return;
+	
+	// last record with elementsOffset <= id
+	uint lo = 0;
+	uint hi = recordsCount-1;
+	while(lo < hi) {
+		uint mid = (lo + hi + 1) / 2;
+		if(records[mid].elementsOffset <= id) {
+			lo = mid;
+		} else {
+			hi = mid - 1;
+		}
+	}
+	RebaseRecord r = records[lo];
+	
+	uint element = r.firstElement + id - r.elementsOffset;
+	indices[element] = indices[element] - r.oldFirstVertex + r.newFirstVertex;
+}
+)";
+	
+	void MeshManager::UpdateMeshTableEntry(uint32_t meshId) {
+		if(meshId >= meshTable.Count()) {
+			meshTable.Resize(std::max<uint32_t>(meshId+1,
+						(meshTable.Count()*3)/2 + 64));
+		}
+		const MeshInfo& info = meshInfo[meshId];
+		MeshTableEntry& entry = meshTable.Elements()[meshId];
+		entry.elementsStart = info.firstElement;
+		entry.elementsCount = info.countElements;
+		entry.page = info.page;
+		entry.reserved = 0;
+		memcpy(entry.boundingSphereCenterOffset,
+				info.boundingSphereCenterOffset, sizeof(float)*3);
+		entry.boundingSphereRadius = info.boundingSphereRadius;
+		
+		meshTableDirtyBegin = std::min(meshTableDirtyBegin, meshId);
+		meshTableDirtyEnd = std::max(meshTableDirtyEnd, meshId+1);
+	}
+	
+	void MeshManager::UpdateMeshTable() {
+		if(meshTableDirtyBegin >= meshTableDirtyEnd) {
+			return;
+		}
+		meshTable.UpdateVertices(meshTableDirtyBegin,
+				meshTableDirtyEnd-meshTableDirtyBegin);
+		meshTableDirtyBegin = 0xFFFFFFFF;
+		meshTableDirtyEnd = 0;
+	}
+}
@@ -49,9 +49,17 @@ namespace qgl {
 			exit(31);
 		
 		// init vao
-		vao = std::make_unique<gl::VAO>(gl::TRIANGLES);
+		InitVao(0);
+		
+		// get shader uniform locations
+		PROJECTION_VIEW_LOCATION =
+			renderShader->GetUniformLocation("projectionView");
+	}
+	
+	void MaterialBoneAnimated::InitVao(uint32_t page) {
+		std::shared_ptr<gl::VAO> vao = std::make_shared<gl::VAO>(gl::TRIANGLES);
 		vao->Init();
-		gl::VBO& vbo = pipeline->meshManager->GetVBO();
+		gl::VBO& vbo = pipeline->meshManager->GetVBO(page);
 		
 		vao->SetAttribPointer(vbo, renderShader->GetAttributeLocation("in_pos"), 3, gl::FLOAT, false, 0, 0);
 		vao->SetAttribPointer(vbo, renderShader->GetAttributeLocation("in_color"), 4, gl::UNSIGNED_BYTE, true, 12, 0);
@@ -71,20 +79,17 @@ namespace qgl {
 		vao->SetAttribPointer(modelVbo, renderShader->GetAttributeLocation("model")+1, 4, gl::FLOAT, false, 16, 1);
 		vao->SetAttribPointer(modelVbo, renderShader->GetAttributeLocation("model")+2, 4, gl::FLOAT, false, 32, 1);
 		vao->SetAttribPointer(modelVbo, renderShader->GetAttributeLocation("model")+3, 4, gl::FLOAT, false, 48, 1);
-		vao->BindElementBuffer(pipeline->meshManager->GetEBO(), gl::UNSIGNED_INT);
-		
-		// get shader uniform locations
-		PROJECTION_VIEW_LOCATION =
-			renderShader->GetUniformLocation("projectionView");
+		vao->BindElementBuffer(pipeline->meshManager->GetEBO(page), gl::UNSIGNED_INT);
+		vaos.emplace_back(vao);
 	}
 	
 	void MaterialBoneAnimated::Destroy() {
 		pipeline = nullptr;
-		if(vao)
+		for(auto& vao : vaos)
 			vao->Delete();
 		if(renderShader)
 			renderShader->Destroy();
-		vao = nullptr;
+		vaos.clear();
 		renderShader = nullptr;
 	}
 	
@@ -98,22 +103,32 @@ namespace qgl {
 	
 	void MaterialBoneAnimated::RenderPassIndirect(std::shared_ptr<Camera> camera,
 			gl::VBO& indirectBuffer,
-			uint32_t entitiesCount) {
-		if(entitiesCount == 0) {
-			return;
+			const uint32_t* pageOffsets,
+			const uint32_t* pageCounts,
+			uint32_t pagesCount) {
+		while(vaos.size() < pagesCount) {
+			InitVao(vaos.size());
 		}
 		
-		vao->Bind();
 		renderShader->Use();
 		
 		glm::mat4 pv = camera->GetPerspectiveViewMatrix();;
 		renderShader->SetMat4(PROJECTION_VIEW_LOCATION, pv);
 		
-		renderShader->Use();
-		vao->BindIndirectBuffer(indirectBuffer);
-		vao->DrawMultiElementsIndirect(nullptr, entitiesCount);
-			
-		vao->Unbind();
+		// commands are bucketed by page of their mesh
+		for(uint32_t page=0; page<pagesCount; ++page) {
+			if(pageCounts[page] == 0) {
+				continue;
+			}
+			vaos[page]->Bind();
+			vaos[page]->BindIndirectBuffer(indirectBuffer);
+			vaos[page]->DrawMultiElementsIndirect(
+					(void*)(size_t)(pageOffsets[page]
+						*sizeof(DrawElementsIndirectCommand)),
+					pageCounts[page]);
+			vaos[page]->Unbind();
+		}
+		
 		gl::Shader::Unuse();
 	}
 	
@@ -58,6 +58,46 @@ namespace qgl {
 		SetEntityTransformsQuat(entityId, pos, glm::quat(eulerRot), scale);
 	}
 	
+	void Pipeline::CreateEntities(uint32_t count, uint32_t* outEntityIds) {
+		for(uint32_t i=0; i<count; ++i) {
+			outEntityIds[i] = CreateEntity();
+		}
+	}
+	
+	void Pipeline::DeleteEntities(const uint32_t* entityIds, uint32_t count) {
+		for(uint32_t i=0; i<count; ++i) {
+			DeleteEntity(entityIds[i]);
+		}
+	}
+	
+	void Pipeline::SetEntityMeshes(const uint32_t* entityIds, uint32_t count,
+			const uint32_t* meshIds) {
+		for(uint32_t i=0; i<count; ++i) {
+			SetEntityMesh(entityIds[i], meshIds[i]);
+		}
+	}
+	
+	void Pipeline::SetEntityTransforms(const uint32_t* entityIds,
+			uint32_t count, const glm::vec3* pos, const glm::quat* rot,
+			const glm::vec3* scale) {
+		for(uint32_t i=0; i<count; ++i) {
+			SetEntityTransformsQuat(entityIds[i],
+					pos ? pos[i] : glm::vec3(0,0,0),
+					rot ? rot[i] : glm::angleAxis(0.0f,glm::vec3(0,1,0)),
+					scale ? scale[i] : glm::vec3(1,1,1));
+		}
+	}
+	
+	void Pipeline::MigrateEntities(const uint32_t* entityIds, uint32_t count,
+			std::shared_ptr<Pipeline> target, const uint32_t* meshIds) {
+		throw "qgl::Pipeline::MigrateEntities() is not supported by this pipeline.";
+	}
+	
+	void Pipeline::MigrateEntity(uint32_t entityId,
+			std::shared_ptr<Pipeline> target, uint32_t meshId) {
+		MigrateEntities(&entityId, 1, target, &meshId);
+	}
+	
 	void Pipeline::SetPipelineId(uint32_t newId) {
 		pipelineId = newId;
 	}
@@ -32,6 +32,7 @@
 #include "../../include/quickgl/AnimatedMeshManager.hpp"
 #include "../../include/quickgl/cameras/Camera.hpp"
 #include "../../include/quickgl/Engine.hpp"
+#include "../../include/quickgl/GlobalEntityManager.hpp"
 #include "../../include/quickgl/materials/MaterialBoneAnimated.hpp"
 
 #include "../../include/quickgl/pipelines/PipelineBoneAnimated.hpp"
@@ -54,10 +55,20 @@ namespace qgl {
 		return entity;
 	}
 	
+	void PipelineBoneAnimated::InitNewEntities(uint32_t firstOffset,
+			uint32_t count) {
+		const AnimatedState state{0, 0, 0, 0, 0, 0, 0,
+			engine->GetInputManager().GetTime()};
+		std::vector<AnimatedState> states(count, state);
+		perEntityAnimationState.SetValues(states.data(), firstOffset, count);
+	}
+	
 	void PipelineBoneAnimated::SetAnimationState(uint32_t entityId,
 			uint32_t animationId, float timeOffset, bool enableUpdateTime,
 			uint32_t animationIdAfter, bool continueNextAnimation) {
 		entityId = GetEntityOffset(entityId);
+		if(entityId == GlobalEntityManager::INVALID_OFFSET)
+			return;
 		perEntityAnimationState.SetValue({
 				animationId,
 				animationIdAfter,
@@ -87,6 +98,7 @@ namespace qgl {
 		
 		entityBufferManager
 			->AddManagedSparselyUpdateVBO(&perEntityAnimationState);
+		perEntityBuffers.Add(&perEntityAnimationState);
 		
 		ENTITIES_COUNT_LOCATION =
 			updateAnimationShader->GetUniformLocation("entitiesCount");
@@ -95,11 +107,6 @@ namespace qgl {
 		TIME_STAMP_LOCATION =
 			updateAnimationShader->GetUniformLocation("timeStamp");
 		
-		stagesScheduler.AddStage(
-			"Update animation data",
-			STAGE_UPDATE_DATA,
-			&PipelineBoneAnimated::UpdateAnimationData);
-		
 		stagesScheduler.AddStage(
 			"Update animation state",
 			STAGE_GLOBAL,
@@ -111,10 +118,6 @@ namespace qgl {
 			&PipelineBoneAnimated::RenderEntities);
 	}
 	
-	void PipelineBoneAnimated::UpdateAnimationData(std::shared_ptr<Camera> camera) {
-		perEntityAnimationState.UpdateVBO();
-	}
-	
 	void PipelineBoneAnimated::UpdateAnimationState(std::shared_ptr<Camera> camera) {
 		updateAnimationShader->Use();
 
@@ -137,8 +140,14 @@ namespace qgl {
 	}
 	
 	void PipelineBoneAnimated::RenderEntities(std::shared_ptr<Camera> camera) {
+		if(frustumCulledEntitiesCount == 0) {
+			return;
+		}
+		entityBufferManager->BindComponentColumns();
 		material->RenderPassIndirect(camera, *indirectDrawBuffer,
-				frustumCulledEntitiesCount);
+				frustumCulledPageOffsets.data(),
+				frustumCulledPageCounts.data(),
+				frustumCulledPageCounts.size());
 	}
 	
 	void PipelineBoneAnimated::Destroy() {
@@ -17,6 +17,8 @@
  */
 
 #include <memory>
+#include <vector>
+#include <algorithm>
 
 #define GLM_ENABLE_EXPERIMENTAL
 #include <glm/gtx/matrix_decompose.hpp>
@@ -61,19 +63,8 @@ namespace qgl {
 				gl::SHADER_STORAGE_BUFFER, gl::DYNAMIC_DRAW);
 		clippingPlanes->Init(128);
 		
-		frustumCulledIdsCountAtomicCounter = std::make_shared<gl::VBO>(sizeof(uint32_t),
-				gl::DISPATCH_INDIRECT_BUFFER, gl::DYNAMIC_DRAW);
-		frustumCulledIdsCountAtomicCounter->Init();
-		const static uint32_t ints[3] = {0, 1, 1};
-		frustumCulledIdsCountAtomicCounter->Generate(ints, 3);
-		
-		frustumCulledIdsCountAtomicCounterAsyncFetch = std::make_shared<gl::VBO>(
-				sizeof(uint32_t),
-				gl::SHADER_STORAGE_BUFFER, gl::DYNAMIC_DRAW);
-		mappedPointerToentitiesCount = (uint32_t*)
-			frustumCulledIdsCountAtomicCounterAsyncFetch->InitMapPersistent(
-					nullptr, 3,
-					gl::MAP_WRITE_BIT | gl::MAP_FLUSH_EXPLICIT_BIT);
+		countersPagesCapacity = 0;
+		ReserveCullingCounters(1);
 		
 		frustumCullingShader = std::make_unique<gl::Shader>();
 		if(frustumCullingShader->Compile(FRUSTUM_CULLING_COMPUTE_SHADER_SOURCE))
@@ -82,7 +73,8 @@ namespace qgl {
 		
 		objectsPerInvocation = 16;
 		
-		indirectDrawBuffer = std::make_shared<gl::VBO>(20,
+		indirectDrawBuffer = std::make_shared<gl::VBO>(
+				sizeof(DrawElementsIndirectCommand),
 				gl::DRAW_INDIRECT_BUFFER, gl::DYNAMIC_DRAW);
 		indirectDrawBuffer->Init(1024);
 		
@@ -105,7 +97,8 @@ namespace qgl {
 			"Fetching count of entities in frustum view to CPU",
 			STAGE_CAMERA,
 			&PipelineFrustumCulling::FetchFrustumCulledEntitiesCount,
-			&PipelineFrustumCulling::CanExecuteFetchFrustumCulledEntitiesCount);
+			&PipelineFrustumCulling::CanExecuteFetchFrustumCulledEntitiesCount,
+			&PipelineFrustumCulling::GetFetchFrustumCulledEntitiesCountSync);
 		
 		stagesScheduler.AddStage(
 			"Generating indirect draw command buffer",
@@ -139,6 +132,7 @@ namespace qgl {
 			glm::uvec2 cameraPixelDimension;
 			uint objectsPerInvocation;
 			uint entitiesCount;
+			uint pagesCount;
 		} d;
 		camera->GetClippingPlanes(d.clippingPlanes);
 		d.pv = camera->GetPerspectiveViewMatrix();
@@ -154,11 +148,46 @@ namespace qgl {
 		camera->GetRenderTargetDimensions(d.cameraPixelDimension.x, d.cameraPixelDimension.y);
 		d.objectsPerInvocation = objectsPerInvocation;
 		d.entitiesCount = entityBufferManager->Count();
+		d.pagesCount = std::max(meshManager->GetPagesCount(), 1u);
 		clippingPlanes->Update(&d, 0, sizeof(d));
 		
+		ReserveCullingCounters(d.pagesCount);
+		std::vector<uint32_t> counters(3 + d.pagesCount, 0);
+		counters[1] = counters[2] = 1;
 		frustumCulledEntitiesCount = 0;
 		frustumCulledIdsCountAtomicCounter
-			->Update(&frustumCulledEntitiesCount, 0, sizeof(uint32_t));
+			->Update(counters.data(), 0, counters.size()*sizeof(uint32_t));
+	}
+	
+	void PipelineFrustumCulling::ReserveCullingCounters(uint32_t pagesCount) {
+		if(pagesCount <= countersPagesCapacity) {
+			return;
+		}
+		countersPagesCapacity = pagesCount + 4;
+		const uint32_t countersCount = 3 + countersPagesCapacity;
+		
+		if(frustumCulledIdsCountAtomicCounter == nullptr) {
+			frustumCulledIdsCountAtomicCounter = std::make_shared<gl::VBO>(
+					sizeof(uint32_t),
+					gl::DISPATCH_INDIRECT_BUFFER, gl::DYNAMIC_DRAW);
+			frustumCulledIdsCountAtomicCounter->Init();
+		}
+		std::vector<uint32_t> counters(countersCount, 0);
+		counters[1] = counters[2] = 1;
+		frustumCulledIdsCountAtomicCounter->Generate(counters.data(),
+				countersCount);
+		
+		// persistently mapped buffer cannot be resized, it is recreated
+		if(frustumCulledIdsCountAtomicCounterAsyncFetch) {
+			frustumCulledIdsCountAtomicCounterAsyncFetch->Destroy();
+		}
+		frustumCulledIdsCountAtomicCounterAsyncFetch = std::make_shared<gl::VBO>(
+				sizeof(uint32_t),
+				gl::SHADER_STORAGE_BUFFER, gl::DYNAMIC_DRAW);
+		mappedPointerToentitiesCount = (uint32_t*)
+			frustumCulledIdsCountAtomicCounterAsyncFetch->InitMapPersistent(
+					nullptr, countersCount,
+					gl::MAP_WRITE_BIT | gl::MAP_FLUSH_EXPLICIT_BIT);
 	}
 	
 	void PipelineFrustumCulling::PerformFrustumCulling(std::shared_ptr<Camera> camera) {
@@ -174,7 +203,9 @@ namespace qgl {
 			->BindBufferBase(gl::SHADER_STORAGE_BUFFER, 4);
 		clippingPlanes
 			->BindBufferBase(gl::SHADER_STORAGE_BUFFER, 5);
-		perEntityMeshInfoBoundingSphere.Vbo()
+		perEntityMeshId.Vbo()
+			.BindBufferBase(gl::SHADER_STORAGE_BUFFER, 2);
+		meshManager->GetMeshTable()
 			.BindBufferBase(gl::SHADER_STORAGE_BUFFER, 6);
 		frustumCullingShader
 			->SetTexture(UNIFORM_LOCATION_DEPTH_TEXTURE,
@@ -189,8 +220,10 @@ namespace qgl {
 					1, 1);
 		gl::Shader::Unuse();
 		
+		const uint32_t pagesCount = std::max(meshManager->GetPagesCount(), 1u);
 		frustumCulledIdsCountAtomicCounterAsyncFetch->
-			Copy(frustumCulledIdsCountAtomicCounter.get(), 0, 0, 12);
+			Copy(frustumCulledIdsCountAtomicCounter.get(), 0, 0,
+					(3 + pagesCount) * sizeof(uint32_t));
 		
 		frustumCulledIdsCountAtomicCounterAsyncFetch->
 			FlushFromGpuMapPersistentFullRange();
@@ -207,10 +240,28 @@ namespace qgl {
 
 		// fetch number of entities to render after culling
 		frustumCulledEntitiesCount = mappedPointerToentitiesCount[0];
+		
+		// with single page, culling shader does not count entities per page
+		const uint32_t pagesCount = std::max(meshManager->GetPagesCount(), 1u);
+		frustumCulledPageCounts.resize(pagesCount);
+		frustumCulledPageOffsets.resize(pagesCount);
+		if(pagesCount == 1) {
+			frustumCulledPageCounts[0] = frustumCulledEntitiesCount;
+		} else {
+			for(uint32_t i=0; i<pagesCount; ++i) {
+				frustumCulledPageCounts[i] = mappedPointerToentitiesCount[3+i];
+			}
+		}
+		uint32_t offset = 0;
+		for(uint32_t i=0; i<pagesCount; ++i) {
+			frustumCulledPageOffsets[i] = offset;
+			offset += frustumCulledPageCounts[i];
+		}
 
-		if(indirectDrawBuffer->GetVertexCount() < frustumCulledEntitiesCount) {
+		const uint32_t commandsCount = frustumCulledEntitiesCount;
+		if(indirectDrawBuffer->GetVertexCount() < commandsCount) {
 			indirectDrawBuffer->Generate(nullptr,
-					(frustumCulledEntitiesCount | 0xFFF) + 1);
+					(commandsCount | 0xFFF) + 1);
 		}
 		
 // 		gl::MemoryBarrier(gl::ALL_BARRIER_BITS);
@@ -219,14 +270,24 @@ namespace qgl {
 	bool PipelineFrustumCulling::CanExecuteFetchFrustumCulledEntitiesCount(std::shared_ptr<Camera> camera) {
 		return syncFrustumCulledEntitiesCountReadyToFetch.IsDone();
 	}
+	
+	gl::Sync* PipelineFrustumCulling::GetFetchFrustumCulledEntitiesCountSync(std::shared_ptr<Camera> camera) {
+		if(syncFrustumCulledEntitiesCountReadyToFetch.IsDone()) {
+			return nullptr;
+		}
+		return &syncFrustumCulledEntitiesCountReadyToFetch;
+	}
 		
 	void PipelineFrustumCulling::GenerateIndirectDrawCommandBuffer(std::shared_ptr<Camera> camera) {
 		engine->GetIndirectDrawBufferGenerator()->Generate(
 				*frustumCulledIdsBuffer,
-				perEntityMeshInfo.Vbo(),
+				perEntityMeshId.Vbo(),
+				meshManager->GetMeshTable(),
 				*indirectDrawBuffer,
 				frustumCulledEntitiesCount,
-				0);
+				0,
+				frustumCulledPageOffsets.data(),
+				frustumCulledPageOffsets.size());
 
 		gl::MemoryBarrier(gl::BUFFER_UPDATE_BARRIER_BIT |
 				gl::SHADER_STORAGE_BARRIER_BIT |
@@ -261,14 +322,28 @@ namespace qgl {
 #extension GL_ARB_compute_shader : require
 #extension GL_ARB_shader_storage_buffer_object : require
 
+struct MeshTableEntry {
+	uint elementsStart;
+	uint elementsCount;
+	uint page;
+	uint reserved;
+	vec4 boundingSphere;
+};
+
 layout (std430, binding=1) writeonly buffer aaa {
 	uint frustumCulledEntitiesIds[];
 };
+layout (std430, binding=2) readonly buffer bbb {
+	uint meshIds[];
+};
 layout (std430, binding=3) readonly buffer ccc {
 	mat4 entitesTransformations[];
 };
 layout (std430, binding=4) buffer ddd {
 	uint globalAtomicCounter;
+	uint dispatchY;
+	uint dispatchZ;
+	uint pageCounters[];
 };
 layout (std430, binding=5) readonly buffer eee {
 	mat4 pv;
@@ -285,9 +360,10 @@ layout (std430, binding=5) readonly buffer eee {
 	ivec2 cameraPixelDimension;
 	uint objectsPerInvocation;
 	uint entitiesCount;
+	uint pagesCount;
 };
 layout (std430, binding=6) readonly buffer fff {
-	vec4 meshInfo[];
+	MeshTableEntry meshTable[];
 };
 
 layout (local_size_x = 32, local_size_y = 1, local_size_z = 1) in;
@@ -301,8 +377,9 @@ uint IsInView(uint id) {
 	if(id < entitiesCount) {
 		uint ret = 0;
 		
-		vec4 pos = entitesTransformations[id] * vec4(meshInfo[id].xyz, 1);
-		vec4 rad = entitesTransformations[id] * vec4(0,0,meshInfo[id].w, 0);
+		vec4 sphere = meshTable[meshIds[id]].boundingSphere;
+		vec4 pos = entitesTransformations[id] * vec4(sphere.xyz, 1);
+		vec4 rad = entitesTransformations[id] * vec4(0,0,sphere.w, 0);
 		float dd = length(rad);
 		
 		vec4 p1 = pv*(pos + p1fur * dd);
@@ -411,6 +488,13 @@ void main() {
 	for(uint i=0; i<inViewCount; ++i) {
 		frustumCulledEntitiesIds[globalStartingLocation+i] = inViewIds[i];
 	}
+	
+	// commands of culled entities are bucketed by page of their mesh
+	if(pagesCount > 1) {
+		for(uint i=0; i<inViewCount; ++i) {
+			atomicAdd(pageCounters[meshTable[meshIds[inViewIds[i]]].page], 1);
+		}
+	}
 }
 )";
 }
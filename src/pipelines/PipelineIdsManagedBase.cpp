@@ -16,18 +16,29 @@
  *  along with this program.  If not, see <https://www.gnu.org/licenses/>.
  */
 
+#include <cstring>
+
+#include <algorithm>
+
+#include "../../OpenGLWrapper/include/openglwrapper/OpenGL.hpp"
 #include "../../OpenGLWrapper/include/openglwrapper/VBO.hpp"
+#include "../../OpenGLWrapper/include/openglwrapper/Shader.hpp"
 
+#include "../../include/quickgl/Engine.hpp"
 #include "../../include/quickgl/MeshManager.hpp"
+#include "../../include/quickgl/GlobalEntityManager.hpp"
 #include "../../include/quickgl/util/RenderStageComposer.hpp"
+#include "../../include/quickgl/util/DeltaVboManager.hpp"
 
 #include "../../include/quickgl/pipelines/PipelineIdsManagedBase.hpp"
 
 namespace qgl {
 	PipelineIdsManagedBase::PipelineIdsManagedBase(
 		std::shared_ptr<Engine> engine) :
-			Pipeline(engine), perEntityMeshInfo(engine),
-			perEntityMeshInfoBoundingSphere(engine), transformMatrices(engine) {
+			Pipeline(engine), perEntityMeshId(engine), transformMatrices(engine),
+			perEntityBuffers(engine), compactTransformUploads(false), stagedTransformsTRSMaxOffset(0),
+			meshCompactionBytesPerFrame(1024*1024),
+			shaderWritesBeforeMigration(false) {
 	}
 	
 	PipelineIdsManagedBase::~PipelineIdsManagedBase() {
@@ -52,41 +63,140 @@ namespace qgl {
 		entityBufferManager = std::make_shared<EntityBufferManager>(engine,
 				shared_from_this());
 		
-		perEntityMeshInfo.Init();
-		perEntityMeshInfoBoundingSphere.Init();
+		perEntityMeshId.Init();
 		transformMatrices.Init();
 		entityBufferManager->Init();
 		
-		entityBufferManager->AddManagedSparselyUpdateVBO(&perEntityMeshInfo);
-		entityBufferManager->AddManagedSparselyUpdateVBO(&perEntityMeshInfoBoundingSphere);
+		entityBufferManager->AddManagedSparselyUpdateVBO(&perEntityMeshId);
 		entityBufferManager->AddManagedSparselyUpdateVBO(&transformMatrices);
 		
+		perEntityBuffers.Add(&perEntityMeshId);
+		perEntityBuffers.Add(&transformMatrices);
+		
+		expandTransformsTRSShader = std::make_unique<gl::Shader>();
+		if(expandTransformsTRSShader->Compile(
+					EXPAND_TRANSFORMS_TRS_COMPUTE_SHADER_SOURCE))
+			exit(31);
+		expandTransformsTRSUniformLocation =
+			expandTransformsTRSShader->GetUniformLocation("updateElements");
 		
 		stagesScheduler.AddStage(
 				"Update ID manager data",
 				STAGE_UPDATE_DATA,
 				&PipelineIdsManagedBase::UpdateIDManagerData);
 		
+		stagesScheduler.AddStage(
+				"Releasing freed mesh ranges",
+				STAGE_UPDATE_DATA,
+				&PipelineIdsManagedBase::ReleaseFreedMeshRanges);
+		
 		stagesScheduler.AddStage(
 				"Updating EntityBufferManager",
 				STAGE_GLOBAL,
 				&PipelineIdsManagedBase::UpdateEntityBufferManager);
+		
+		stagesScheduler.AddStage(
+				"Compacting mesh buffers",
+				STAGE_GLOBAL,
+				&PipelineIdsManagedBase::CompactMeshBuffers);
 	}
 	
 	void PipelineIdsManagedBase::UpdateIDManagerData(std::shared_ptr<Camera>) {
-		perEntityMeshInfo.UpdateVBO();
-		perEntityMeshInfoBoundingSphere.UpdateVBO();
-		transformMatrices.UpdateVBO();
+		perEntityBuffers.UpdateVBOs();
+		UploadTransformsTRS();
+		entityBufferManager->UpdateComponentColumns();
+		shaderWritesBeforeMigration = true;
+	}
+	
+	void PipelineIdsManagedBase::StageTransformTRS(uint32_t offset,
+			const glm::vec3& pos, const glm::quat& rot, const glm::vec3& scale) {
+		if(offset >= stagedTransformsTRSSlots.size()) {
+			stagedTransformsTRSSlots.resize(std::max<size_t>(offset+1,
+						(stagedTransformsTRSSlots.size()*3)/2 + 64), 0);
+		}
+		uint32_t& slot = stagedTransformsTRSSlots[offset];
+		if(slot == 0) {
+			stagedTransformsTRS.emplace_back();
+			slot = stagedTransformsTRS.size();
+			stagedTransformsTRSMaxOffset = std::max(
+					stagedTransformsTRSMaxOffset, offset);
+		}
+		PerEntityTransformTRS& t = stagedTransformsTRS[slot-1];
+		t.pos[0] = pos.x;
+		t.pos[1] = pos.y;
+		t.pos[2] = pos.z;
+		t.rot[0] = rot.x;
+		t.rot[1] = rot.y;
+		t.rot[2] = rot.z;
+		t.rot[3] = rot.w;
+		t.scale[0] = scale.x;
+		t.scale[1] = scale.y;
+		t.scale[2] = scale.z;
+		t.offset = offset;
+	}
+	
+	void PipelineIdsManagedBase::UploadTransformsTRS() {
+		if(stagedTransformsTRS.empty()) {
+			return;
+		}
+		transformMatrices.EnsureCapacity(stagedTransformsTRSMaxOffset+1);
+		
+		const uint32_t vs = sizeof(PerEntityTransformTRS);
+		const uint32_t count = stagedTransformsTRS.size();
+		expandTransformsTRSShader->Use();
+		for(uint32_t i=0; i<count; ) {
+			DeltaVboManager::Region region = engine->GetDeltaVboManager()
+				->Allocate((count-i)*vs, vs);
+			const uint32_t n = region.size/vs;
+			memcpy(region.data, &(stagedTransformsTRS[i]), n*vs);
+			expandTransformsTRSShader->SetUInt(
+					expandTransformsTRSUniformLocation, n);
+			region.BindBufferRange(1);
+			transformMatrices.Vbo().BindBufferBase(gl::SHADER_STORAGE_BUFFER,
+					2);
+			expandTransformsTRSShader->DispatchRoundGroupNumbers(n, 1, 1);
+			i += n;
+		}
+		gl::Shader::Unuse();
+		// expanded matrices may be read by shaders or copied by buffer copies
+		gl::MemoryBarrier(gl::SHADER_STORAGE_BARRIER_BIT |
+				gl::BUFFER_UPDATE_BARRIER_BIT);
+		
+		for(const PerEntityTransformTRS& t : stagedTransformsTRS) {
+			stagedTransformsTRSSlots[t.offset] = 0;
+		}
+		stagedTransformsTRS.clear();
 	}
 	
 	void PipelineIdsManagedBase::UpdateEntityBufferManager(
 			std::shared_ptr<Camera>) {
 		entityBufferManager->UpdateBuffers();
+		shaderWritesBeforeMigration = true;
+	}
+	
+	void PipelineIdsManagedBase::ReleaseFreedMeshRanges(
+			std::shared_ptr<Camera>) {
+		meshManager->ProcessDeferredFrees();
+	}
+	
+	void PipelineIdsManagedBase::CompactMeshBuffers(std::shared_ptr<Camera>) {
+		// entities refer to meshes through mesh table, so moved meshes only
+		// need their table records updated
+		if(meshCompactionBytesPerFrame != 0) {
+			meshManager->CompactBuffers(meshCompactionBytesPerFrame,
+					engine->GetFrameIndex());
+		}
+		meshManager->UpdateMeshTable();
 	}
 	
 	void PipelineIdsManagedBase::Destroy() {
-		perEntityMeshInfo.Destroy();
-		perEntityMeshInfoBoundingSphere.Destroy();
+		expandTransformsTRSShader->Destroy();
+		expandTransformsTRSShader = nullptr;
+		stagedTransformsTRS.clear();
+		stagedTransformsTRSSlots.clear();
+		
+		perEntityBuffers.Destroy();
+		perEntityMeshId.Destroy();
 		transformMatrices.Destroy();
 		entityBufferManager->Destroy();
 		entityBufferManager = nullptr;
@@ -97,20 +207,20 @@ namespace qgl {
 	void PipelineIdsManagedBase::SetEntityMesh(uint32_t entityId,
 			uint32_t meshId) {
 		entityId = GetEntityOffset(entityId);
-		PerEntityMeshInfo info;
-		meshManager->GetMeshIndices(meshId, info.elementsStart,
-				info.elementsCount);
-		perEntityMeshInfo.SetValue(info, entityId);
-		
-		PerEntityMeshInfoBoundingSphere info2;
-		meshManager->GetMeshBoundingSphere(meshId, info2.boundingSphereCenterOffset,
-				info2.boundingSphereRadius);
-		perEntityMeshInfoBoundingSphere.SetValue(info2, entityId);
+		if(entityId == GlobalEntityManager::INVALID_OFFSET)
+			return;
+		perEntityMeshId.SetValue(meshId, entityId);
 	}
 	
 	void PipelineIdsManagedBase::SetEntityTransformsQuat(uint32_t entityId,
 			glm::vec3 pos, glm::quat rot, glm::vec3 scale) {
 		entityId = GetEntityOffset(entityId);
+		if(entityId == GlobalEntityManager::INVALID_OFFSET)
+			return;
+		if(compactTransformUploads) {
+			StageTransformTRS(entityId, pos, rot, scale);
+			return;
+		}
 // 		glm::mat4 t = glm::translate(glm::scale(
 // 					glm::mat4_cast(rot), scale), pos);
 		glm::mat4 t = glm::translate(glm::mat4(1), pos);
@@ -124,5 +234,217 @@ namespace qgl {
 		return entityBufferManager->GetOffsetOfEntity(entityId);
 	}
 	
-}
+	void PipelineIdsManagedBase::CreateEntities(uint32_t count,
+			uint32_t* outEntityIds) {
+		if(count == 0)
+			return;
+		const uint32_t firstOffset = entityBufferManager->GetNewEntities(count,
+				outEntityIds);
+		// new entities are expected to get mesh and transform right after
+		// creation
+		perEntityMeshId.ReserveUpdates(count);
+		transformMatrices.ReserveUpdates(count);
+		InitNewEntities(firstOffset, count);
+	}
+	
+	void PipelineIdsManagedBase::InitNewEntities(uint32_t firstOffset,
+			uint32_t count) {
+	}
+	
+	void PipelineIdsManagedBase::MigrateEntities(const uint32_t* entityIds,
+			uint32_t count, std::shared_ptr<Pipeline> target,
+			const uint32_t* meshIds) {
+		std::shared_ptr<PipelineIdsManagedBase> dst
+			= std::dynamic_pointer_cast<PipelineIdsManagedBase>(target);
+		if(dst == nullptr) {
+			throw "qgl::PipelineIdsManagedBase::MigrateEntities() target pipeline does not support migration.";
+		}
+		if(dst.get() == this) {
+			if(meshIds) {
+				SetEntityMeshes(entityIds, count, meshIds);
+			}
+			return;
+		}
+		const bool sharedMeshes = dst->meshManager == meshManager;
+		if(meshIds == nullptr && !sharedMeshes) {
+			throw "qgl::PipelineIdsManagedBase::MigrateEntities() mesh ids are required when pipelines do not share MeshManager.";
+		}
+		
+		// skip entities that do not belong to this pipeline
+		GlobalEntityManager* gem = engine->GetGlobalEntityManager().get();
+		batchIds.clear();
+		batchMeshIds.clear();
+		batchOffsets.clear();
+		for(uint32_t i=0; i<count; ++i) {
+			if(gem->GetEntityPipelineId(entityIds[i]) != pipelineId)
+				continue;
+			batchIds.emplace_back(entityIds[i]);
+			batchOffsets.emplace_back(gem->GetEntityOffset(entityIds[i]));
+			if(meshIds) {
+				batchMeshIds.emplace_back(meshIds[i]);
+			}
+		}
+		const uint32_t migrated = batchIds.size();
+		if(migrated == 0) {
+			return;
+		}
+		
+		// buffer copies below read values written by shaders of earlier
+		// stages, values still staged are copied into target staging
+		if(shaderWritesBeforeMigration || dst->shaderWritesBeforeMigration) {
+			gl::MemoryBarrier(gl::BUFFER_UPDATE_BARRIER_BIT);
+			shaderWritesBeforeMigration = false;
+			dst->shaderWritesBeforeMigration = false;
+		}
+		
+		entityBufferManager->ReleaseOffsets(batchOffsets.data(), migrated);
+		const uint32_t firstOffset = dst->entityBufferManager->AdoptEntities(
+				batchIds.data(), migrated, *entityBufferManager,
+				batchOffsets.data());
+		
+		dst->transformMatrices.CopyFrom(transformMatrices,
+				batchOffsets.data(), migrated, firstOffset);
+		MigrateStagedTransformsTRS(*dst);
+		if(meshIds) {
+			dst->SetEntityMeshes(batchIds.data(), migrated,
+					batchMeshIds.data());
+		} else {
+			dst->perEntityMeshId.CopyFrom(perEntityMeshId, batchOffsets.data(),
+					migrated, firstOffset);
+		}
+		dst->InitNewEntities(firstOffset, migrated);
+	}
+	
+	void PipelineIdsManagedBase::MigrateStagedTransformsTRS(
+			PipelineIdsManagedBase& dst) {
+		if(stagedTransformsTRS.empty()) {
+			return;
+		}
+		for(uint32_t i=0; i<batchOffsets.size(); ++i) {
+			const uint32_t offset = batchOffsets[i];
+			if(offset >= stagedTransformsTRSSlots.size() ||
+					stagedTransformsTRSSlots[offset] == 0) {
+				continue;
+			}
+			const PerEntityTransformTRS& t
+				= stagedTransformsTRS[stagedTransformsTRSSlots[offset]-1];
+			dst.SetEntityTransformsQuat(batchIds[i],
+					{t.pos[0], t.pos[1], t.pos[2]},
+					glm::quat(t.rot[3], t.rot[0], t.rot[1], t.rot[2]),
+					{t.scale[0], t.scale[1], t.scale[2]});
+		}
+	}
+	
+	void PipelineIdsManagedBase::DeleteEntities(const uint32_t* entityIds,
+			uint32_t count) {
+		entityBufferManager->FreeEntities(entityIds, count);
+	}
+	
+	bool PipelineIdsManagedBase::GatherEntityOffsets(const uint32_t* entityIds,
+			uint32_t count) {
+		batchOffsets.resize(count);
+		bool contiguous = true;
+		for(uint32_t i=0; i<count; ++i) {
+			batchOffsets[i] = GetEntityOffset(entityIds[i]);
+			if(batchOffsets[i] == GlobalEntityManager::INVALID_OFFSET) {
+				contiguous = false;
+			} else if(i && batchOffsets[i] != batchOffsets[i-1]+1) {
+				contiguous = false;
+			}
+		}
+		return contiguous;
+	}
+	
+	void PipelineIdsManagedBase::SetEntityMeshes(const uint32_t* entityIds,
+			uint32_t count, const uint32_t* meshIds) {
+		if(count == 0)
+			return;
+		if(GatherEntityOffsets(entityIds, count)) {
+			perEntityMeshId.SetValues(meshIds, batchOffsets[0], count);
+		} else {
+			perEntityMeshId.SetValues(meshIds, batchOffsets.data(), count);
+		}
+	}
+	
+	void PipelineIdsManagedBase::SetEntityTransforms(const uint32_t* entityIds,
+			uint32_t count, const glm::vec3* pos, const glm::quat* rot,
+			const glm::vec3* scale) {
+		if(count == 0)
+			return;
+		const bool contiguous = GatherEntityOffsets(entityIds, count);
+		if(compactTransformUploads) {
+			const glm::quat identity = glm::angleAxis(0.0f,glm::vec3(0,1,0));
+			for(uint32_t i=0; i<count; ++i) {
+				if(batchOffsets[i] == GlobalEntityManager::INVALID_OFFSET)
+					continue;
+				StageTransformTRS(batchOffsets[i],
+						pos ? pos[i] : glm::vec3(0,0,0),
+						rot ? rot[i] : identity,
+						scale ? scale[i] : glm::vec3(1,1,1));
+			}
+			return;
+		}
+		batchTransforms.resize(count);
+		for(uint32_t i=0; i<count; ++i) {
+			glm::mat4 T(1);
+			if(pos) {
+				T = glm::translate(T, pos[i]);
+			}
+			if(rot) {
+				T = T * glm::mat4_cast(rot[i]);
+			}
+			if(scale) {
+				T = glm::scale(T, scale[i]);
+			}
+			batchTransforms[i] = T;
+		}
+		if(contiguous) {
+			transformMatrices.SetValues(batchTransforms.data(), batchOffsets[0],
+					count);
+		} else {
+			transformMatrices.SetValues(batchTransforms.data(),
+					batchOffsets.data(), count);
+		}
+	}
+	
+	const char* PipelineIdsManagedBase::EXPAND_TRANSFORMS_TRS_COMPUTE_SHADER_SOURCE = R"(
+#version 420 core
+#extension GL_ARB_compute_shader : require
+#extension GL_ARB_shader_storage_buffer_object : require
 
+struct TransformTRS {
+	float pos[3];
+	float rot[4];
+	float scale[3];
+	uint offset;
+};
+
+layout (std430, binding=1) readonly buffer updateData {
+	TransformTRS transforms[];
+};
+layout (std430, binding=2) writeonly buffer matricesBuffer {
+	mat4 matrices[];
+};
+
+layout (local_size_x = 256, local_size_y = 1, local_size_z = 1) in;
+
+uniform uint updateElements;
+
+void main() {
+	uint id = gl_GlobalInvocationID.x;
+	if(id >= updateElements)
+		return;
+	TransformTRS t = transforms[id];
+	float x = t.rot[0], y = t.rot[1], z = t.rot[2], w = t.rot[3];
+	float xx = x*x, yy = y*y, zz = z*z;
+	float xy = x*y, xz = x*z, yz = y*z;
+	float wx = w*x, wy = w*y, wz = w*z;
+	mat4 m;
+	m[0] = vec4(1.0-2.0*(yy+zz), 2.0*(xy+wz), 2.0*(xz-wy), 0.0) * t.scale[0];
+	m[1] = vec4(2.0*(xy-wz), 1.0-2.0*(xx+zz), 2.0*(yz+wx), 0.0) * t.scale[1];
+	m[2] = vec4(2.0*(xz+wy), 2.0*(yz-wx), 1.0-2.0*(xx+yy), 0.0) * t.scale[2];
+	m[3] = vec4(t.pos[0], t.pos[1], t.pos[2], 1.0);
+	matrices[t.offset] = m;
+}
+)";
+}
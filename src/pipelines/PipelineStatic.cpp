@@ -62,8 +62,14 @@ namespace qgl {
 	}
 	
 	void PipelineStatic::RenderEntities(std::shared_ptr<Camera> camera) {
+		if(frustumCulledEntitiesCount == 0) {
+			return;
+		}
+		entityBufferManager->BindComponentColumns();
 		material->RenderPassIndirect(camera, *indirectDrawBuffer,
-				frustumCulledEntitiesCount);
+				frustumCulledPageOffsets.data(),
+				frustumCulledPageCounts.data(),
+				frustumCulledPageCounts.size());
 	}
 	
 	void PipelineStatic::Destroy() {
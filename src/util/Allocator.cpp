@@ -17,15 +17,37 @@
  */
 
 #include <algorithm>
-#include <memory>
 #include <vector>
-#include <map>
-
-#include "../../OpenGLWrapper/include/openglwrapper/VBO.hpp"
+#include <unordered_map>
 
 #include "../../include/quickgl/util/Allocator.hpp"
 
 namespace qgl {
+	static inline uint32_t FindFirstSet(uint32_t word) {
+#if defined(__GNUC__) || defined(__clang__)
+		return __builtin_ctz(word);
+#else
+		uint32_t bit = 0;
+		while((word & 1) == 0) {
+			word >>= 1;
+			++bit;
+		}
+		return bit;
+#endif
+	}
+	
+	static inline uint32_t FindLastSet(uint32_t word) {
+#if defined(__GNUC__) || defined(__clang__)
+		return 31 - __builtin_clz(word);
+#else
+		uint32_t bit = 0;
+		while(word >>= 1) {
+			++bit;
+		}
+		return bit;
+#endif
+	}
+	
 	Allocator::Allocator(void* bufferObject,
 			void(*resize)(void*, uint32_t newSize),
 			void(*destructor)(void*)) {
@@ -39,6 +61,34 @@ namespace qgl {
 		this->bufferObject = bufferObject;
 		this->resize = resize;
 		this->destructor = destructor;
+		
+		blocks.clear();
+		unusedBlocks.clear();
+		usedBlockByOffset.clear();
+		firstPhysicalBlock = NONE;
+		lastPhysicalBlock = NONE;
+		mayRelocate = false;
+		relocateCursor = NONE;
+		lowestFreeCursor = NONE;
+		quarantine.clear();
+		currentEpoch = 0;
+		deferredFree = false;
+		quarantinedElements = 0;
+		liveElements = 0;
+		liveAllocations = 0;
+		freeRanges = 0;
+		growthCount = 0;
+		grownElements = 0;
+		for(uint32_t i=0; i<32; ++i) {
+			allocationSizeHistogram[i] = 0;
+		}
+		flBitmap = 0;
+		for(uint32_t fl=0; fl<FL_INDEX_COUNT; ++fl) {
+			slBitmap[fl] = 0;
+			for(uint32_t sl=0; sl<SL_INDEX_COUNT; ++sl) {
+				freeLists[fl][sl] = NONE;
+			}
+		}
 	}
 	
 	Allocator::~Allocator() {
@@ -47,81 +97,479 @@ namespace qgl {
 	}
 	
 	uint32_t Allocator::Allocate(uint32_t size) {
-		if(freeRanges.size() == 0) {
+		const uint32_t offset = TryAllocate(size);
+		if(offset != INVALID_OFFSET) {
+			return offset;
+		}
+		if(size == 0) {
+			size = 1;
+		}
+		if(lastPhysicalBlock != NONE && blocks[lastPhysicalBlock].isFree) {
+			// last free block is at the end of allocated memory
 			ReserveAdditional(
-					std::max(std::max(size, allocated/2), 4096u));
+					std::max(std::max(size-blocks[lastPhysicalBlock].size,
+							allocated), 4096u));
 		} else {
-			for(auto it : freeRanges) {
-				if(it.second >= size) {
-					uint32_t offset = it.first;
-					uint32_t elements = it.second;
-					
-					freeRanges.erase(offset);
-					if(elements > size) {
-						freeRanges[offset+size] = elements-size;
-					}
-					
-					return offset;
-				}
-			}
+			ReserveAdditional(
+					std::max(std::max(size, allocated/2), 4096u));
+		}
+		// after growing, last block has enaugh space
+		const uint32_t block = lastPhysicalBlock;
 		
-			auto p = *freeRanges.rbegin();
-			if(p.first + p.second < allocated) { // last free block is NOT at the end of allocated memory
-				ReserveAdditional(
-						std::max(std::max(size, allocated/2),
-							4096u));
-			} else { // last free block is at the end of allocated memory
-				ReserveAdditional(
-						std::max(std::max(size-p.second,
-								allocated), 4096u));
-			}
+		RemoveFreeBlock(block);
+		if(blocks[block].size > size) {
+			InsertFreeBlock(SplitBlock(block, size));
+		}
+		MarkUsed(block);
+		return blocks[block].offset;
+	}
+	
+	uint32_t Allocator::TryAllocate(uint32_t size) {
+		if(size == 0) {
+			size = 1;
+		}
+		uint32_t block = FindSuitableBlock(size);
+		if(block == NONE) {
+			block = FindFittingBlockInClass(size);
+		}
+		if(block == NONE) {
+			return INVALID_OFFSET;
 		}
 		
-		// after above code, assumes that last block has enaugh space
-		auto it = freeRanges.rbegin();
-		uint32_t offset = it->first;
-		uint32_t r = it->second - size;
-		freeRanges.erase(it->first);
-		if(r > 0) {
-			freeRanges[offset+size] = r;
+		RemoveFreeBlock(block);
+		if(blocks[block].size > size) {
+			InsertFreeBlock(SplitBlock(block, size));
 		}
-		return offset;
+		MarkUsed(block);
+		return blocks[block].offset;
 	}
 	
 	void Allocator::Free(uint32_t pos, uint32_t size) {
-		freeRanges[pos] = size;
-		if(freeRanges.size() == 0) {
-		} else {
-			freeRanges[pos] = size;
-			auto it = freeRanges.find(pos);
-			{
-				auto next = it; ++next;
-				if(next != freeRanges.end()) { // if freed block is not last
-					if(pos+size == next->first) { // if freed block ends where next starts
-						it->second += next->second;
-						freeRanges.erase(next);
-						it = freeRanges.find(pos);
-					}
-				}
-			}
-			if(it != freeRanges.begin()) { // if freed block is not first
-				auto prev = it; --prev;
-				if(prev->first + prev->second == pos) { // if previous block ends where freed starts
-					prev->second += it->second;
-					freeRanges.erase(pos);
-				}
-			}
+		uint32_t block = GetUsedBlock(pos);
+		if(block == NONE || blocks[block].isQuarantined) {
+			throw "qgl::Allocator::Free() cannot free range that was not allocated.";
+		}
+		if(size == 0) {
+			size = 1;
 		}
+		if(size > blocks[block].size) {
+			throw "qgl::Allocator::Free() cannot free more than was allocated.";
+		}
+		UnmarkUsed(block);
+		if(size < blocks[block].size) {
+			// only beginning of allocated range is freed, rest stays in use
+			MarkUsed(SplitBlock(block, size));
+		}
+		block = MergeWithNeighbours(block);
+		InsertFreeBlock(block);
+		OnBlockFreed(block);
 	}
 	
 	void Allocator::ReserveAdditional(uint32_t additionalElements) {
+		if(additionalElements == 0) {
+			return;
+		}
 		uint32_t prevSize = allocated;
 		uint32_t newSize = prevSize+additionalElements;
 		if(resize) {
 			resize(bufferObject, newSize);
 		}
-		Free(prevSize, additionalElements);
 		allocated = newSize;
+		++growthCount;
+		grownElements += additionalElements;
+		
+		uint32_t block = NewBlock();
+		blocks[block] = {prevSize, additionalElements, lastPhysicalBlock, NONE,
+			NONE, NONE, true, false};
+		if(lastPhysicalBlock != NONE) {
+			blocks[lastPhysicalBlock].nextPhysical = block;
+		} else {
+			firstPhysicalBlock = block;
+		}
+		lastPhysicalBlock = block;
+		InsertFreeBlock(MergeWithNeighbours(block));
+	}
+	
+	bool Allocator::Relocate(uint32_t maxCount, Relocation& relocation) {
+		if(mayRelocate == false) {
+			return false;
+		}
+		
+		// walk used blocks from the end of buffer towards its beginning,
+		// continuing from block where previous call stopped
+		uint32_t b = relocateCursor != NONE ? relocateCursor
+			: lastPhysicalBlock;
+		for(; b!=NONE; b=blocks[b].prevPhysical) {
+			if(blocks[b].isFree || blocks[b].isQuarantined
+					|| blocks[b].size > maxCount) {
+				continue;
+			}
+			const uint32_t size = blocks[b].size;
+			// lowest free block is preferred, so that ranges are moved only
+			// once
+			uint32_t free = FindLowestFreeBlock();
+			if(free == NONE || blocks[free].size < size) {
+				free = FindSuitableBlock(size);
+			}
+			if(free == NONE) {
+				free = FindFittingBlockInClass(size);
+			}
+			if(free == NONE || blocks[free].offset > blocks[b].offset) {
+				continue;
+			}
+			
+			relocation = {blocks[b].offset, blocks[free].offset, size};
+			relocateCursor = blocks[b].prevPhysical;
+			
+			RemoveFreeBlock(free);
+			if(blocks[free].size > size) {
+				InsertFreeBlock(SplitBlock(free, size));
+			}
+			MarkUsed(free);
+			
+			if(deferredFree) {
+				FreeDeferred(relocation.from, size);
+			} else {
+				const uint32_t cursor = relocateCursor;
+				Free(relocation.from, size);
+				relocateCursor = cursor;
+			}
+			return true;
+		}
+		
+		relocateCursor = NONE;
+		mayRelocate = false;
+		return false;
+	}
+	
+	uint32_t Allocator::ShrinkToFit(uint32_t minimalCapacity) {
+		if(lastPhysicalBlock == NONE || blocks[lastPhysicalBlock].isFree == false) {
+			return allocated;
+		}
+		const uint32_t last = lastPhysicalBlock;
+		const uint32_t usedEnd = blocks[last].offset;
+		const uint32_t newSize = std::max(usedEnd + usedEnd/4,
+				minimalCapacity);
+		if(newSize >= allocated - allocated/4) {
+			return allocated;
+		}
+		
+		RemoveFreeBlock(last);
+		if(newSize == usedEnd) {
+			const uint32_t prev = blocks[last].prevPhysical;
+			if(prev != NONE) {
+				blocks[prev].nextPhysical = NONE;
+			} else {
+				firstPhysicalBlock = NONE;
+			}
+			lastPhysicalBlock = prev;
+			ReleaseBlock(last);
+		} else {
+			blocks[last].size = newSize - usedEnd;
+			InsertFreeBlock(last);
+		}
+		
+		allocated = newSize;
+		if(resize) {
+			resize(bufferObject, newSize);
+		}
+		return allocated;
+	}
+	
+	void Allocator::BeginEpoch(uint32_t epoch) {
+		currentEpoch = epoch;
+		deferredFree = true;
+	}
+	
+	void Allocator::FreeDeferred(uint32_t pos, uint32_t size) {
+		const uint32_t block = GetUsedBlock(pos);
+		if(block == NONE || blocks[block].isQuarantined) {
+			throw "qgl::Allocator::FreeDeferred() cannot free range that was not allocated.";
+		}
+		if(size == 0) {
+			size = 1;
+		}
+		if(size > blocks[block].size) {
+			throw "qgl::Allocator::FreeDeferred() cannot free more than was allocated.";
+		}
+		UnmarkUsed(block);
+		if(size < blocks[block].size) {
+			// only beginning of allocated range is freed, rest stays in use
+			MarkUsed(SplitBlock(block, size));
+		}
+		// block keeps its range reserved until its epoch is released
+		blocks[block].isFree = false;
+		usedBlockByOffset[pos] = block;
+		blocks[block].isQuarantined = true;
+		quarantinedElements += size;
+		quarantine.push_back({currentEpoch, pos, size});
+	}
+	
+	void Allocator::ReleaseEpochs(uint32_t lastEpochToRelease) {
+		while(!quarantine.empty() &&
+				quarantine.front().epoch <= lastEpochToRelease) {
+			const QuarantinedRange range = quarantine.front();
+			quarantine.pop_front();
+			auto it = usedBlockByOffset.find(range.offset);
+			const uint32_t block = it->second;
+			usedBlockByOffset.erase(it);
+			blocks[block].isFree = true;
+			blocks[block].isQuarantined = false;
+			quarantinedElements -= range.size;
+			const uint32_t merged = MergeWithNeighbours(block);
+			InsertFreeBlock(merged);
+			OnBlockFreed(merged);
+		}
+	}
+	
+	Allocator::Stats Allocator::GetStats() const {
+		Stats stats;
+		stats.capacity = allocated;
+		stats.liveElements = liveElements;
+		stats.liveAllocations = liveAllocations;
+		stats.freeElements = allocated - liveElements - quarantinedElements;
+		stats.quarantinedElements = quarantinedElements;
+		stats.freeRanges = freeRanges;
+		stats.largestFreeRange = 0;
+		if(flBitmap) {
+			const uint32_t fl = FindLastSet(flBitmap);
+			const uint32_t sl = FindLastSet(slBitmap[fl]);
+			for(uint32_t b=freeLists[fl][sl]; b!=NONE; b=blocks[b].nextFree) {
+				stats.largestFreeRange = std::max(stats.largestFreeRange,
+						blocks[b].size);
+			}
+		}
+		if(stats.freeElements > 0) {
+			stats.fragmentation = 1.0f - (float)stats.largestFreeRange /
+				(float)stats.freeElements;
+		} else {
+			stats.fragmentation = 0.0f;
+		}
+		stats.growthCount = growthCount;
+		stats.grownElements = grownElements;
+		for(uint32_t i=0; i<32; ++i) {
+			stats.allocationSizeHistogram[i] = allocationSizeHistogram[i];
+		}
+		return stats;
+	}
+	
+	void Allocator::MarkUsed(uint32_t block) {
+		blocks[block].isFree = false;
+		usedBlockByOffset[blocks[block].offset] = block;
+		liveElements += blocks[block].size;
+		++liveAllocations;
+		++allocationSizeHistogram[FindLastSet(blocks[block].size)];
+	}
+	
+	void Allocator::UnmarkUsed(uint32_t block) {
+		blocks[block].isFree = true;
+		usedBlockByOffset.erase(blocks[block].offset);
+		liveElements -= blocks[block].size;
+		--liveAllocations;
+		--allocationSizeHistogram[FindLastSet(blocks[block].size)];
+	}
+	
+	uint32_t Allocator::FindSuitableBlock(uint32_t size) {
+		uint32_t fl, sl;
+		MappingSearch(size, fl, sl);
+		if(fl >= FL_INDEX_COUNT) {
+			return NONE;
+		}
+		uint32_t slMap = slBitmap[fl] & (~0u << sl);
+		if(slMap == 0) {
+			const uint32_t flMap = fl+1 < 32 ? flBitmap & (~0u << (fl+1)) : 0;
+			if(flMap == 0) {
+				return NONE;
+			}
+			fl = FindFirstSet(flMap);
+			slMap = slBitmap[fl];
+		}
+		sl = FindFirstSet(slMap);
+		return freeLists[fl][sl];
+	}
+	
+	/*
+	 * Good-fit search rounds size up to the next class, so a block from the
+	 * class of size itself is never considered. Before growing the buffer
+	 * check the head of that class, only single block is checked to keep
+	 * allocation constant time.
+	 */
+	uint32_t Allocator::FindFittingBlockInClass(uint32_t size) {
+		uint32_t fl, sl;
+		MappingInsert(size, fl, sl);
+		const uint32_t b = freeLists[fl][sl];
+		if(b != NONE && blocks[b].size >= size) {
+			return b;
+		}
+		return NONE;
+	}
+	
+	uint32_t Allocator::GetUsedBlock(uint32_t offset) const {
+		auto it = usedBlockByOffset.find(offset);
+		if(it == usedBlockByOffset.end()) {
+			return NONE;
+		}
+		return it->second;
+	}
+	
+	void Allocator::InsertFreeBlock(uint32_t block) {
+		uint32_t fl, sl;
+		MappingInsert(blocks[block].size, fl, sl);
+		const uint32_t head = freeLists[fl][sl];
+		blocks[block].prevFree = NONE;
+		blocks[block].nextFree = head;
+		if(head != NONE) {
+			blocks[head].prevFree = block;
+		}
+		freeLists[fl][sl] = block;
+		flBitmap |= 1u << fl;
+		slBitmap[fl] |= 1u << sl;
+		++freeRanges;
+	}
+	
+	void Allocator::RemoveFreeBlock(uint32_t block) {
+		uint32_t fl, sl;
+		MappingInsert(blocks[block].size, fl, sl);
+		const uint32_t prev = blocks[block].prevFree;
+		const uint32_t next = blocks[block].nextFree;
+		if(next != NONE) {
+			blocks[next].prevFree = prev;
+		}
+		if(prev != NONE) {
+			blocks[prev].nextFree = next;
+		} else {
+			freeLists[fl][sl] = next;
+			if(next == NONE) {
+				slBitmap[fl] &= ~(1u << sl);
+				if(slBitmap[fl] == 0) {
+					flBitmap &= ~(1u << fl);
+				}
+			}
+		}
+		blocks[block].prevFree = NONE;
+		blocks[block].nextFree = NONE;
+		--freeRanges;
+	}
+	
+	/*
+	 * Shrinks block to size and returns new free block holding the remainder.
+	 * Returned block is not inserted into free lists.
+	 */
+	uint32_t Allocator::SplitBlock(uint32_t block, uint32_t size) {
+		uint32_t rest = NewBlock();
+		Block& b = blocks[block];
+		blocks[rest] = {b.offset+size, b.size-size, block, b.nextPhysical,
+			NONE, NONE, true, false};
+		if(b.nextPhysical != NONE) {
+			blocks[b.nextPhysical].prevPhysical = rest;
+		} else {
+			lastPhysicalBlock = rest;
+		}
+		b.nextPhysical = rest;
+		b.size = size;
+		return rest;
+	}
+	
+	/*
+	 * Merges free block with free physical neighbours (removing them from free
+	 * lists) and returns resulting block. Returned block is not inserted into
+	 * free lists.
+	 */
+	uint32_t Allocator::MergeWithNeighbours(uint32_t block) {
+		const uint32_t next = blocks[block].nextPhysical;
+		if(next != NONE && blocks[next].isFree) {
+			RemoveFreeBlock(next);
+			blocks[block].size += blocks[next].size;
+			blocks[block].nextPhysical = blocks[next].nextPhysical;
+			if(blocks[next].nextPhysical != NONE) {
+				blocks[blocks[next].nextPhysical].prevPhysical = block;
+			} else {
+				lastPhysicalBlock = block;
+			}
+			ReleaseBlock(next);
+		}
+		const uint32_t prev = blocks[block].prevPhysical;
+		if(prev != NONE && blocks[prev].isFree) {
+			RemoveFreeBlock(prev);
+			blocks[prev].size += blocks[block].size;
+			blocks[prev].nextPhysical = blocks[block].nextPhysical;
+			if(blocks[block].nextPhysical != NONE) {
+				blocks[blocks[block].nextPhysical].prevPhysical = prev;
+			} else {
+				lastPhysicalBlock = prev;
+			}
+			ReleaseBlock(block);
+			block = prev;
+		}
+		return block;
+	}
+	
+	uint32_t Allocator::NewBlock() {
+		if(unusedBlocks.empty()) {
+			blocks.emplace_back();
+			return blocks.size()-1;
+		}
+		uint32_t block = unusedBlocks.back();
+		unusedBlocks.pop_back();
+		return block;
+	}
+	
+	uint32_t Allocator::FindLowestFreeBlock() {
+		if(flBitmap == 0) {
+			return NONE;
+		}
+		if(lowestFreeCursor == NONE) {
+			lowestFreeCursor = firstPhysicalBlock;
+		}
+		while(lowestFreeCursor != NONE && !blocks[lowestFreeCursor].isFree) {
+			lowestFreeCursor = blocks[lowestFreeCursor].nextPhysical;
+		}
+		return lowestFreeCursor;
+	}
+	
+	void Allocator::OnBlockFreed(uint32_t block) {
+		mayRelocate = true;
+		// new hole may allow moving blocks that were already skipped
+		relocateCursor = NONE;
+		if(lowestFreeCursor != NONE
+				&& blocks[block].offset < blocks[lowestFreeCursor].offset) {
+			lowestFreeCursor = block;
+		}
+	}
+	
+	void Allocator::ReleaseBlock(uint32_t block) {
+		// released block is always merged into or cut off after its physical
+		// predecessor
+		if(relocateCursor == block) {
+			relocateCursor = blocks[block].prevPhysical;
+		}
+		if(lowestFreeCursor == block) {
+			lowestFreeCursor = blocks[block].prevPhysical;
+		}
+		unusedBlocks.emplace_back(block);
+	}
+	
+	void Allocator::MappingInsert(uint32_t size, uint32_t& fl, uint32_t& sl) {
+		if(size < SL_INDEX_COUNT) {
+			fl = 0;
+			sl = size;
+		} else {
+			const uint32_t msb = FindLastSet(size);
+			fl = msb - (SL_INDEX_COUNT_LOG2 - 1);
+			sl = (size >> (msb - SL_INDEX_COUNT_LOG2)) - SL_INDEX_COUNT;
+		}
+	}
+	
+	void Allocator::MappingSearch(uint32_t size, uint32_t& fl, uint32_t& sl) {
+		uint64_t rounded = size;
+		if(size >= SL_INDEX_COUNT) {
+			rounded += (1ull << (FindLastSet(size) - SL_INDEX_COUNT_LOG2)) - 1;
+		}
+		if(rounded > 0xFFFFFFFFull) {
+			fl = FL_INDEX_COUNT;
+			sl = 0;
+			return;
+		}
+		MappingInsert(rounded, fl, sl);
 	}
 }
-
@@ -0,0 +1,68 @@
+/*
+ *  This file is part of QuickGL.
+ *  Copyright (C) 2023 Marek Zalewski aka Drwalin
+ *
+ *  QuickGL is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  QuickGL is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "../../include/quickgl/Engine.hpp"
+#include "../../include/quickgl/GlobalEntityManager.hpp"
+
+#include "../../include/quickgl/util/ComponentColumn.hpp"
+
+namespace qgl {
+	UntypedComponentColumn::UntypedComponentColumn(
+			std::shared_ptr<Engine> engine, const std::string& name,
+			uint32_t elementSize, ComponentStorage storage,
+			uint32_t pipelineId) :
+			name(name), storage(storage), pipelineId(pipelineId) {
+		if(engine == nullptr) {
+			if(storage & COMPONENT_STORAGE_GPU) {
+				throw "qgl::UntypedComponentColumn::UntypedComponentColumn() column with GPU storage requires engine.";
+			}
+			globalEntityManager = nullptr;
+			return;
+		}
+		globalEntityManager = engine->GetGlobalEntityManager().get();
+		if(storage & COMPONENT_STORAGE_GPU) {
+			gpu = std::make_unique<UntypedManagedSparselyUpdatedVBO>(engine,
+					elementSize);
+		}
+	}
+	
+	UntypedComponentColumn::~UntypedComponentColumn() {
+		Destroy();
+	}
+	
+	void UntypedComponentColumn::Init() {
+		if(gpu) {
+			gpu->Init();
+		}
+	}
+	
+	void UntypedComponentColumn::Destroy() {
+		if(gpu) {
+			gpu->Destroy();
+		}
+	}
+	
+	uint32_t UntypedComponentColumn::ResolveOffset(uint32_t entity) const {
+		if(globalEntityManager == nullptr)
+			return GlobalEntityManager::INVALID_OFFSET;
+		if(globalEntityManager->GetEntityPipelineId(entity) != pipelineId)
+			return GlobalEntityManager::INVALID_OFFSET;
+		return globalEntityManager->GetEntityOffset(entity);
+	}
+}
+
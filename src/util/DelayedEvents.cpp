@@ -18,40 +18,324 @@
 
 #include <chrono>
 #include <mutex>
+#include <algorithm>
 
 #include "../../include/quickgl/util/DelayedEvents.hpp"
 
 namespace qgl {
-	void DelayedEvents::PushEvent_(int msDelay, std::function<void()> event) {
-		auto t = std::chrono::steady_clock::now()
-			+ std::chrono::milliseconds(msDelay);
+	static inline uint32_t FindFirstSet(uint64_t word) {
+#if defined(__GNUC__) || defined(__clang__)
+		return __builtin_ctzll(word);
+#else
+		uint32_t bit = 0;
+		while((word & 1) == 0) {
+			word >>= 1;
+			++bit;
+		}
+		return bit;
+#endif
+	}
+	
+	DelayedEvents::DelayedEvents() :
+		start(std::chrono::steady_clock::now()), currentTick(0),
+		nextSequence(0), wheelCount(0), eventsCount(0), nextDueTick(NO_TICK) {
+		std::fill(heads, heads+LISTS, NONE);
+		std::fill(tails, tails+LISTS, NONE);
+		for(uint32_t l=0; l<LEVELS; ++l) {
+			std::fill(occupied[l], occupied[l]+SLOTS/64, 0);
+		}
+	}
+	
+	DelayedEvents::Handle DelayedEvents::PushEvent_(int msDelay,
+			Task&& event) {
+		// deadline is rounded up to whole tick, so that event is never
+		// executed before its delay passes
+		const auto deadline = std::chrono::steady_clock::now()
+			+ std::chrono::milliseconds(std::max(msDelay, 0)) - start;
+		const uint64_t deadlineTick = (std::chrono::duration_cast<
+				std::chrono::nanoseconds>(deadline).count() + 999999) / 1000000;
+		
 		std::lock_guard lock(mutex);
-		events.insert({t, event});
+		uint32_t id;
+		if(freeTimers.empty()) {
+			id = timers.size();
+			timers.emplace_back();
+			timers[id].generation = 0;
+		} else {
+			id = freeTimers.back();
+			freeTimers.pop_back();
+		}
+		Timer& t = timers[id];
+		t.task = std::move(event);
+		t.deadline = deadlineTick;
+		t.sequence = nextSequence++;
+		Insert(id);
+		eventsCount++;
+		if(deadlineTick < nextDueTick.load(std::memory_order_relaxed)) {
+			nextDueTick.store(deadlineTick, std::memory_order_release);
+		}
+		return {id, t.generation};
 	}
-
+	
+	bool DelayedEvents::Cancel(Handle handle) {
+		Task task;
+		{
+			std::lock_guard lock(mutex);
+			if(handle.index >= timers.size()) {
+				return false;
+			}
+			Timer& t = timers[handle.index];
+			if(t.generation != handle.generation || t.list == NONE) {
+				return false;
+			}
+			if(t.list != READY_LIST) {
+				--wheelCount;
+			}
+			Unlink(handle.index);
+			task = std::move(t.task);
+			t.list = NONE;
+			t.generation++;
+			freeTimers.emplace_back(handle.index);
+			eventsCount--;
+		}
+		// captures are destroyed outside of lock
+		return true;
+	}
+	
 	bool DelayedEvents::ExecuteOneEvent() {
-		std::function<void()> event;
+		if(eventsCount == 0 || IsBeforeNextDue()) {
+			return false;
+		}
+		Task event;
 		{
 			std::lock_guard lock(mutex);
-			auto it = events.begin();
-			if(it != events.end()) {
-				if(it->first < std::chrono::steady_clock::now()) {
-					event = it->second;
-					events.erase(it);
-				} else {
+			if(heads[READY_LIST] == NONE) {
+				Advance(NowTick());
+				if(heads[READY_LIST] == NONE) {
+					UpdateNextDueTick();
 					return false;
 				}
-			} else {
-				return false;
 			}
+			event = TakeReady();
+			UpdateNextDueTick();
 		}
 		event();
 		return true;
 	}
 	
+	uint32_t DelayedEvents::ExecuteExpiredEvents(uint32_t maxEvents) {
+		if(eventsCount == 0 || IsBeforeNextDue()) {
+			return 0;
+		}
+		std::vector<Task> batch;
+		{
+			std::lock_guard lock(mutex);
+			Advance(NowTick());
+			while(batch.size() < maxEvents && heads[READY_LIST] != NONE) {
+				batch.emplace_back(TakeReady());
+			}
+			UpdateNextDueTick();
+		}
+		for(Task& event : batch) {
+			event();
+		}
+		return batch.size();
+	}
+	
 	bool DelayedEvents::HasAnyEvents() {
-		std::lock_guard lock(mutex);
-		return !events.empty();
+		return eventsCount != 0;
+	}
+	
+	std::chrono::steady_clock::time_point DelayedEvents::GetNextEventTime() {
+		const uint64_t tick = nextDueTick.load(std::memory_order_acquire);
+		if(eventsCount == 0 || tick == NO_TICK) {
+			return std::chrono::steady_clock::time_point::max();
+		}
+		return start + std::chrono::milliseconds(tick);
+	}
+	
+	bool DelayedEvents::IsBeforeNextDue() const {
+		return NowTick() < nextDueTick.load(std::memory_order_acquire);
+	}
+	
+	void DelayedEvents::UpdateNextDueTick() {
+		nextDueTick.store(ComputeNextDueTick(), std::memory_order_release);
+	}
+	
+	uint64_t DelayedEvents::ComputeNextDueTick() const {
+		if(heads[READY_LIST] != NONE) {
+			return currentTick;
+		}
+		if(wheelCount == 0) {
+			return NO_TICK;
+		}
+		for(uint32_t l=0; l<LEVELS; ++l) {
+			const uint32_t shift = l*SLOT_BITS;
+			const uint32_t slot = FindOccupiedSlot(l,
+					((currentTick >> shift) & (SLOTS-1)) + (l==0 ? 1 : 0));
+			if(slot < SLOTS) {
+				// beginning of period covered by that slot
+				const uint64_t base = (currentTick >> (shift+SLOT_BITS))
+					<< (shift+SLOT_BITS);
+				const uint64_t tick = base + ((uint64_t)slot << shift);
+				return std::max(tick, currentTick);
+			}
+		}
+		return NO_TICK;
+	}
+	
+	uint64_t DelayedEvents::NowTick() const {
+		return std::chrono::duration_cast<std::chrono::milliseconds>(
+				std::chrono::steady_clock::now() - start).count();
+	}
+	
+	void DelayedEvents::Advance(uint64_t targetTick) {
+		while(currentTick < targetTick) {
+			if(wheelCount == 0) {
+				currentTick = targetTick;
+				return;
+			}
+			// skip empty slots up to next occupied slot of level 0 or end of
+			// its rotation
+			const uint32_t slot = FindOccupiedSlot(0,
+					(currentTick & (SLOTS-1)) + 1);
+			uint64_t nextTick;
+			if(slot < SLOTS) {
+				nextTick = (currentTick & ~(uint64_t)(SLOTS-1)) + slot;
+			} else {
+				nextTick = (currentTick | (SLOTS-1)) + 1;
+			}
+			if(nextTick > targetTick) {
+				currentTick = targetTick;
+				return;
+			}
+			currentTick = nextTick;
+			if((currentTick & (SLOTS-1)) == 0) {
+				Cascade();
+			}
+			ExpireSlot(currentTick & (SLOTS-1));
+		}
+	}
+	
+	void DelayedEvents::Cascade() {
+		// levels whose slot index wrapped to 0 together with level 0
+		uint32_t top = 1;
+		while(top+1 < LEVELS
+				&& ((currentTick >> (top*SLOT_BITS)) & (SLOTS-1)) == 0) {
+			++top;
+		}
+		for(uint32_t l=top; l>=1; --l) {
+			const uint32_t slot = (currentTick >> (l*SLOT_BITS)) & (SLOTS-1);
+			const uint32_t list = l*SLOTS + slot;
+			uint32_t id = heads[list];
+			heads[list] = tails[list] = NONE;
+			occupied[l][slot/64] &= ~(1ull << (slot%64));
+			while(id != NONE) {
+				const uint32_t next = timers[id].next;
+				--wheelCount;
+				Insert(id);
+				id = next;
+			}
+		}
+	}
+	
+	void DelayedEvents::ExpireSlot(uint32_t slot) {
+		uint32_t id = heads[slot];
+		if(id == NONE) {
+			return;
+		}
+		heads[slot] = tails[slot] = NONE;
+		occupied[0][slot/64] &= ~(1ull << (slot%64));
+		
+		// timers cascaded from higher levels are appended after ones inserted
+		// later directly into level 0, restore order of insertion
+		expired.clear();
+		for(; id != NONE; id = timers[id].next) {
+			expired.emplace_back(id);
+		}
+		std::sort(expired.begin(), expired.end(), [this](uint32_t a,
+					uint32_t b) {
+				return timers[a].sequence < timers[b].sequence;
+			});
+		for(uint32_t e : expired) {
+			--wheelCount;
+			Append(READY_LIST, e);
+		}
+	}
+	
+	void DelayedEvents::Insert(uint32_t id) {
+		Timer& t = timers[id];
+		if(t.deadline <= currentTick) {
+			Append(READY_LIST, id);
+			return;
+		}
+		uint64_t diff = t.deadline ^ currentTick;
+		uint32_t level = 0;
+		while(diff >= SLOTS && level+1 < LEVELS) {
+			diff >>= SLOT_BITS;
+			++level;
+		}
+		const uint32_t slot = (t.deadline >> (level*SLOT_BITS)) & (SLOTS-1);
+		Append(level*SLOTS + slot, id);
+		occupied[level][slot/64] |= 1ull << (slot%64);
+		++wheelCount;
+	}
+	
+	void DelayedEvents::Append(uint32_t list, uint32_t id) {
+		Timer& t = timers[id];
+		t.list = list;
+		t.next = NONE;
+		t.prev = tails[list];
+		if(tails[list] != NONE) {
+			timers[tails[list]].next = id;
+		} else {
+			heads[list] = id;
+		}
+		tails[list] = id;
+	}
+	
+	void DelayedEvents::Unlink(uint32_t id) {
+		Timer& t = timers[id];
+		if(t.prev != NONE) {
+			timers[t.prev].next = t.next;
+		} else {
+			heads[t.list] = t.next;
+		}
+		if(t.next != NONE) {
+			timers[t.next].prev = t.prev;
+		} else {
+			tails[t.list] = t.prev;
+		}
+		if(heads[t.list] == NONE && t.list != READY_LIST) {
+			const uint32_t level = t.list / SLOTS;
+			const uint32_t slot = t.list % SLOTS;
+			occupied[level][slot/64] &= ~(1ull << (slot%64));
+		}
+	}
+	
+	uint32_t DelayedEvents::FindOccupiedSlot(uint32_t level,
+			uint32_t fromSlot) const {
+		for(uint32_t w=fromSlot/64; w<SLOTS/64; ++w) {
+			uint64_t word = occupied[level][w];
+			if(w == fromSlot/64) {
+				word &= ~0ull << (fromSlot%64);
+			}
+			if(word) {
+				return w*64 + FindFirstSet(word);
+			}
+		}
+		return SLOTS;
+	}
+	
+	Task DelayedEvents::TakeReady() {
+		const uint32_t id = heads[READY_LIST];
+		Timer& t = timers[id];
+		Unlink(id);
+		Task task = std::move(t.task);
+		t.list = NONE;
+		t.generation++;
+		freeTimers.emplace_back(id);
+		eventsCount--;
+		return task;
 	}
 }
-
@@ -16,15 +16,28 @@
  *  along with this program.  If not, see <https://www.gnu.org/licenses/>.
  */
 
+#include <algorithm>
+
+#include "../../OpenGLWrapper/include/openglwrapper/OpenGL.hpp"
 #include "../../OpenGLWrapper/include/openglwrapper/VBO.hpp"
+#include "../../OpenGLWrapper/include/openglwrapper/Sync.hpp"
 
 #include "../../include/quickgl/util/DeltaVboManager.hpp"
 
 namespace qgl {
-	DeltaVboManager::DeltaVboManager(uint32_t bytesPerVbo,
-			uint32_t numberOfVbos) {
-		vboSize = bytesPerVbo;
-		vbos.resize(numberOfVbos);
+	void DeltaVboManager::Region::BindBufferRange(
+			uint32_t shaderStorageBinding) const {
+		vbo->BindBufferRange(gl::SHADER_STORAGE_BUFFER, shaderStorageBinding,
+				offset, size);
+	}
+	
+	DeltaVboManager::DeltaVboManager(uint32_t bytesPerSegment,
+			uint32_t numberOfSegments) {
+		segmentSize = bytesPerSegment - (bytesPerSegment % OFFSET_ALIGNMENT);
+		segmentsCount = numberOfSegments;
+		mappedPointer = nullptr;
+		minCapacity = 1024*1024;
+		maxCapacity = 256*1024*1024;
 	}
 	
 	DeltaVboManager::~DeltaVboManager() {
@@ -32,27 +45,179 @@ namespace qgl {
 	}
 	
 	void DeltaVboManager::Init() {
-		lastUsedVbo = 0;
-		if(vbos[0] == nullptr) {
-			for(std::shared_ptr<gl::VBO>& vbo : vbos) {
-				vbo = std::make_shared<gl::VBO>(1, gl::SHADER_STORAGE_BUFFER,
-						gl::DYNAMIC_DRAW);
-				vbo->InitImmutable(nullptr, vboSize, gl::DYNAMIC_STORAGE_BIT);
-			}
+		currentSegment = 0;
+		currentOffset = 0;
+		capacityHighWaterMark = GetCapacity();
+		frameBytes = 0;
+		lastFrameBytes = 0;
+		frameBytesHighWaterMark = 0;
+		for(uint32_t i=0; i<RECENT_FRAMES; ++i) {
+			recentFramesBytes[i] = 0;
+		}
+		recentFrameId = 0;
+		oversizedFrames = 0;
+		if(vbo == nullptr) {
+			vbo = std::make_shared<gl::VBO>(1, gl::SHADER_STORAGE_BUFFER,
+					gl::DYNAMIC_DRAW);
+			mappedPointer = (uint8_t*)vbo->InitMapPersistent(nullptr,
+					segmentSize*segmentsCount,
+					gl::MAP_WRITE_BIT | gl::MAP_PERSISTENT_BIT |
+					gl::MAP_COHERENT_BIT);
+			segmentFences.resize(segmentsCount);
 		}
 	}
 	
 	void DeltaVboManager::Destroy() {
-		for(std::shared_ptr<gl::VBO>& vbo : vbos) {
+		for(RetiredBuffer& retired : retiredBuffers) {
+			retired.sync->Destroy();
+			retired.vbo->Destroy();
+		}
+		retiredBuffers.clear();
+		for(std::shared_ptr<gl::Sync>& sync : segmentFences) {
+			if(sync) {
+				sync->Destroy();
+				sync = nullptr;
+			}
+		}
+		segmentFences.clear();
+		if(vbo) {
 			vbo->Destroy();
 			vbo = nullptr;
 		}
+		mappedPointer = nullptr;
+	}
+	
+	DeltaVboManager::Region DeltaVboManager::Allocate(uint32_t bytes,
+			uint32_t elementSize) {
+		bytes = std::min(bytes, segmentSize);
+		bytes -= bytes % elementSize;
+		if(currentOffset + bytes > segmentSize) {
+			AdvanceSegment();
+		}
+		
+		Region region;
+		region.vbo = vbo.get();
+		region.offset = currentSegment*segmentSize + currentOffset;
+		region.size = bytes;
+		region.data = mappedPointer + region.offset;
+		
+		const uint32_t previousOffset = currentOffset;
+		currentOffset += bytes;
+		currentOffset += (OFFSET_ALIGNMENT - (currentOffset % OFFSET_ALIGNMENT))
+			% OFFSET_ALIGNMENT;
+		frameBytes += currentOffset - previousOffset;
+		return region;
+	}
+	
+	void DeltaVboManager::AdvanceSegment() {
+		// fence commands that read from segment being left
+		std::shared_ptr<gl::Sync>& sync = segmentFences[currentSegment];
+		if(sync == nullptr) {
+			sync = std::make_shared<gl::Sync>();
+		}
+		sync->StartFence();
+		
+		currentSegment = (currentSegment+1) % segmentsCount;
+		currentOffset = 0;
+		
+		// wait until GPU stops reading from segment which will be overwritten
+		std::shared_ptr<gl::Sync>& next = segmentFences[currentSegment];
+		if(next) {
+			if(next->WaitClient(100*1000*1000) == gl::SYNC_TIMEOUT) {
+				gl::Finish();
+			}
+			next->Destroy();
+			next = nullptr;
+		}
 	}
 	
-	std::shared_ptr<gl::VBO> DeltaVboManager::GetNextUpdateVBO() {
-		std::shared_ptr<gl::VBO> ret = vbos[lastUsedVbo];
-		lastUsedVbo = (lastUsedVbo+1) % vbos.size();
-		return ret;
+	void DeltaVboManager::EndFrame() {
+		ReleaseRetiredBuffers();
+		
+		lastFrameBytes = frameBytes;
+		frameBytesHighWaterMark = std::max(frameBytesHighWaterMark, frameBytes);
+		recentFramesBytes[recentFrameId] = frameBytes;
+		recentFrameId = (recentFrameId+1) % RECENT_FRAMES;
+		frameBytes = 0;
+		
+		uint32_t recentPeak = 0;
+		for(uint32_t i=0; i<RECENT_FRAMES; ++i) {
+			recentPeak = std::max(recentPeak, recentFramesBytes[i]);
+		}
+		
+		const uint64_t desired = std::min<uint64_t>(std::max<uint64_t>(
+					(uint64_t)recentPeak * FRAMES_IN_FLIGHT, minCapacity),
+				maxCapacity);
+		const uint32_t capacity = GetCapacity();
+		if(desired > capacity) {
+			oversizedFrames = 0;
+			Reallocate(desired);
+		} else if(desired*4 <= capacity) {
+			++oversizedFrames;
+			if(oversizedFrames >= SHRINK_DELAY_FRAMES) {
+				oversizedFrames = 0;
+				Reallocate(std::max<uint64_t>(desired*2, minCapacity));
+			}
+		} else {
+			oversizedFrames = 0;
+		}
+	}
+	
+	void DeltaVboManager::SetCapacityLimits(uint32_t minCapacityBytes,
+			uint32_t maxCapacityBytes) {
+		minCapacity = minCapacityBytes;
+		maxCapacity = std::max(maxCapacityBytes, minCapacityBytes);
+	}
+	
+	void DeltaVboManager::Reallocate(uint32_t newCapacity) {
+		uint32_t newSegmentSize = MIN_SEGMENT_SIZE;
+		while(newSegmentSize < MAX_SEGMENT_SIZE &&
+				newSegmentSize*TARGET_SEGMENTS_COUNT < newCapacity) {
+			newSegmentSize *= 2;
+		}
+		const uint32_t newSegmentsCount = std::max<uint32_t>(
+				(newCapacity + newSegmentSize - 1) / newSegmentSize, 2);
+		if(newSegmentSize == segmentSize && newSegmentsCount == segmentsCount) {
+			return;
+		}
+		
+		// old buffer may still be read by GPU, it is destroyed after fence
+		std::shared_ptr<gl::Sync> sync = std::make_shared<gl::Sync>();
+		sync->StartFence();
+		retiredBuffers.push_back({vbo, sync});
+		for(std::shared_ptr<gl::Sync>& fence : segmentFences) {
+			if(fence) {
+				fence->Destroy();
+				fence = nullptr;
+			}
+		}
+		segmentFences.clear();
+		vbo = nullptr;
+		
+		segmentSize = newSegmentSize;
+		segmentsCount = newSegmentsCount;
+		currentSegment = 0;
+		currentOffset = 0;
+		vbo = std::make_shared<gl::VBO>(1, gl::SHADER_STORAGE_BUFFER,
+				gl::DYNAMIC_DRAW);
+		mappedPointer = (uint8_t*)vbo->InitMapPersistent(nullptr,
+				segmentSize*segmentsCount,
+				gl::MAP_WRITE_BIT | gl::MAP_PERSISTENT_BIT |
+				gl::MAP_COHERENT_BIT);
+		segmentFences.resize(segmentsCount);
+		capacityHighWaterMark = std::max(capacityHighWaterMark, GetCapacity());
+	}
+	
+	void DeltaVboManager::ReleaseRetiredBuffers() {
+		for(uint32_t i=0; i<retiredBuffers.size();) {
+			if(retiredBuffers[i].sync->IsDone()) {
+				retiredBuffers[i].sync->Destroy();
+				retiredBuffers[i].vbo->Destroy();
+				retiredBuffers[i] = retiredBuffers.back();
+				retiredBuffers.pop_back();
+			} else {
+				++i;
+			}
+		}
 	}
 }
-
@@ -17,6 +17,11 @@
  */
 
 #include <cstdio>
+#include <cstring>
+
+#include <algorithm>
+#include <thread>
+#include <atomic>
 
 #include "../../OpenGLWrapper/include/openglwrapper/VBO.hpp"
 #include "../../OpenGLWrapper/include/openglwrapper/OpenGL.hpp"
@@ -24,6 +29,7 @@
 #include "../../include/quickgl/Engine.hpp"
 #include "../../include/quickgl/util/DeltaVboManager.hpp"
 #include "../../include/quickgl/util/MoveVboUpdater.hpp"
+#include "../../include/quickgl/util/Scheduler.hpp"
 #include "../../include/quickgl/pipelines/Pipeline.hpp"
 #include "../../include/quickgl/GlobalEntityManager.hpp"
 
@@ -33,6 +39,7 @@ namespace qgl {
 	EntityBufferManager::EntityBufferManager(std::shared_ptr<Engine> engine,
 			std::shared_ptr<Pipeline> pipeline) :
 		mapOffsetToEntity(engine), engine(engine), pipeline(pipeline) {
+		globalEntityManager = engine->GetGlobalEntityManager().get();
 	}
 	
 	uint64_t EntityBufferManager::allEntitiesAdded = 0;
@@ -50,19 +57,27 @@ namespace qgl {
 	void EntityBufferManager::Destroy() {
 		mapOffsetToEntity.Destroy();
 		
-		deltaFromTo.clear();
+		for(auto& it : componentColumns) {
+			it.second->Destroy();
+		}
+		componentColumns.clear();
+		componentColumnBindings.clear();
+		
 		deltaBuffer.clear();
-		freeingEntites.clear();
+		freedOffsets.clear();
+		movedEntities.clear();
 		buffers.clear();
+		gpuBuffers.clear();
 	}
 	
 	uint32_t EntityBufferManager::GetNewEntity() {
 		allEntitiesAdded++;
 		uint32_t offset = entitiesBufferSize;
-		uint32_t entity = engine->GetGlobalEntityManager()
+		uint32_t entity = globalEntityManager
 			->GetNewEntity(pipeline->shared_from_this(), offset);
 		
 		mapOffsetToEntity.SetValue(entity, offset);
+		ResetComponentColumns(offset, 1);
 		
 		entitiesBufferSize++;
 		entitiesCount++;
@@ -70,48 +85,141 @@ namespace qgl {
 		return entity;
 	}
 	
+	uint32_t EntityBufferManager::GetNewEntities(uint32_t count,
+			uint32_t* outEntities) {
+		allEntitiesAdded += count;
+		const uint32_t firstOffset = entitiesBufferSize;
+		globalEntityManager->GetNewEntities(pipeline->shared_from_this(),
+				firstOffset, count, outEntities);
+		
+		mapOffsetToEntity.SetValues(outEntities, firstOffset, count);
+		ResetComponentColumns(firstOffset, count);
+		
+		entitiesBufferSize += count;
+		entitiesCount += count;
+		
+		return firstOffset;
+	}
+	
 	void EntityBufferManager::FreeEntity(uint32_t entity) {
-		freeingEntites.emplace_back(entity);
+		// offset is resolved now, entity handle becomes invalid immediately
+		const uint32_t offset = globalEntityManager->GetEntityOffset(entity);
+		if(offset == GlobalEntityManager::INVALID_OFFSET)
+			return;
+		globalEntityManager->FreeEntity(entity);
+		freedOffsets.emplace_back(offset);
 		entitiesCount--;
 	}
 	
+	void EntityBufferManager::FreeEntities(const uint32_t* entities,
+			uint32_t count) {
+		freedOffsets.reserve(freedOffsets.size() + count);
+		for(uint32_t i=0; i<count; ++i) {
+			FreeEntity(entities[i]);
+		}
+	}
+	
+	uint32_t EntityBufferManager::AdoptEntities(const uint32_t* entities,
+			uint32_t count, EntityBufferManager& source,
+			const uint32_t* srcOffsets) {
+		const uint32_t firstOffset = entitiesBufferSize;
+		const uint32_t pipelineId = pipeline->GetPipelineId();
+		for(uint32_t i=0; i<count; ++i) {
+			globalEntityManager->SetEntityPipeline(entities[i], pipelineId,
+					firstOffset+i);
+		}
+		mapOffsetToEntity.SetValues(entities, firstOffset, count);
+		for(auto& it : componentColumns) {
+			std::shared_ptr<UntypedComponentColumn> srcColumn
+				= source.GetUntypedComponentColumn(it.first);
+			if(srcColumn == nullptr || !it.second->CopyFrom(*srcColumn,
+						srcOffsets, count, firstOffset)) {
+				it.second->Reset(firstOffset, count);
+			}
+		}
+		entitiesBufferSize += count;
+		entitiesCount += count;
+		return firstOffset;
+	}
+	
+	void EntityBufferManager::ReleaseOffsets(const uint32_t* offsets,
+			uint32_t count) {
+		freedOffsets.insert(freedOffsets.end(), offsets, offsets+count);
+		entitiesCount -= count;
+	}
+	
 	uint32_t EntityBufferManager::Count() const {
 		return entitiesCount;
 	}
 	
 	void EntityBufferManager::UpdateBuffers() {
-		if(freeingEntites.empty()) {
+		if(freedOffsets.empty()) {
 			return;
 		}
 		GenerateDeltaBuffer();
 		
 		const uint32_t elements = deltaBuffer.size();
+		gpuBuffers.clear();
+		for(BufferInfo& buf : buffers) {
+			if(buf.getVbo) {
+				gpuBuffers.emplace_back(buf.getVbo(buf.data));
+			}
+		}
+		
 		if(elements < 128) {
+			// Moves are ordered by both source and destination, runs of
+			// consecutive moves are copied at once. Sources lie past new end
+			// of buffer and destinations before it, so ranges never overlap.
+			for(uint32_t i=0; i<elements;) {
+				const PairMove first = deltaBuffer[i];
+				uint32_t run = 1;
+				while(i+run < elements
+						&& deltaBuffer[i+run].from == first.from+run
+						&& deltaBuffer[i+run].to == first.to+run) {
+					++run;
+				}
+				for(gl::VBO* vbo : gpuBuffers) {
+					const uint32_t vs = vbo->VertexSize();
+					vbo->Copy(vbo, first.from*vs, first.to*vs, run*vs);
+				}
+				i += run;
+			}
 			for(BufferInfo& buf : buffers) {
+				if(buf.getVbo) {
+					continue;
+				} else if(buf.moveByDelta) {
+					buf.moveByDelta(buf.data, deltaBuffer.data(), elements);
+					continue;
+				}
 				for(PairMove& p : deltaBuffer) {
 					buf.moveByOne(buf.data, p.from, p.to);
 				}
 			}
 		} else {
 			for(uint32_t i=0; i<elements;) {
-				auto deltaVbo = engine->GetDeltaVboManager()
-					->GetNextUpdateVBO();
-				const uint32_t elem = std::min<uint32_t>(
-						deltaVbo->GetVertexCount()/sizeof(PairMove),
-						elements-i);
+				DeltaVboManager::Region region = engine->GetDeltaVboManager()
+					->Allocate((elements-i)*sizeof(PairMove), sizeof(PairMove));
+				const uint32_t elem = region.size/sizeof(PairMove);
 				
-				deltaVbo->Update(&(deltaBuffer[i]), 0, elem*sizeof(PairMove));
-				gl::MemoryBarrier(gl::BUFFER_UPDATE_BARRIER_BIT);
+				memcpy(region.data, &(deltaBuffer[i]), elem*sizeof(PairMove));
 				
+				if(!gpuBuffers.empty()) {
+					engine->GetMoveVboManager()->Update(gpuBuffers.data(),
+							gpuBuffers.size(), region, elem);
+				}
 				for(BufferInfo& buf : buffers) {
-					if(buf.moveByVbo) {
-						buf.moveByVbo(buf.data, engine, deltaVbo.get(), elem);
+					if(buf.moveByVbo && !buf.getVbo) {
+						buf.moveByVbo(buf.data, engine, region, elem);
 					}
 				}
 				gl::Flush();
 				
 				for(BufferInfo& buf : buffers) {
-					if(!buf.moveByVbo) {
+					if(buf.moveByVbo || buf.getVbo) {
+						continue;
+					} else if(buf.moveByDelta) {
+						buf.moveByDelta(buf.data, &(deltaBuffer[i]), elem);
+					} else {
 						uint32_t end = i+elem;
 						for(uint32_t j=i; j<end; ++j) {
 							PairMove p = deltaBuffer[j];
@@ -134,16 +242,21 @@ namespace qgl {
 			[](void* vbo, uint32_t size) { // resize
 				((gl::VBO*)vbo)->Resize(size);
 			},
-			[](void* vbo, std::shared_ptr<Engine> engine, gl::VBO* deltaVbo, uint32_t elements) { // update with delta buffer
+			[](void* vbo, std::shared_ptr<Engine> engine, const DeltaVboManager::Region& deltaRegion, uint32_t elements) { // update with delta buffer
 				engine->GetMoveVboManager()->Update(((gl::VBO*)vbo),
-						deltaVbo, elements, ((gl::VBO*)vbo)->VertexSize());
+						deltaRegion, elements, ((gl::VBO*)vbo)->VertexSize());
 			},
 			[](void* vbo, uint32_t from, uint32_t to) { // move by one
 				const uint32_t vs = ((gl::VBO*)vbo)->VertexSize();
 				((gl::VBO*)vbo)->Copy(((gl::VBO*)vbo), from*vs, to*vs, vs);
 			},
 			nullptr,
-			vbo
+			vbo,
+			nullptr,
+			nullptr,
+			[](void* vbo) { // get vbo
+				return (gl::VBO*)vbo;
+			}
 		});
 	}
 	
@@ -156,10 +269,10 @@ namespace qgl {
 			[](void* vbo, uint32_t size) { // resize
 				((UntypedManagedSparselyUpdatedVBO*)vbo)->Resize(size);
 			},
-			[](void* vbo, std::shared_ptr<Engine> engine, gl::VBO* deltaVbo, uint32_t elements) { // update with delta buffer
+			[](void* vbo, std::shared_ptr<Engine> engine, const DeltaVboManager::Region& deltaRegion, uint32_t elements) { // update with delta buffer
 				engine->GetMoveVboManager()->Update(
 						&(((qgl::UntypedManagedSparselyUpdatedVBO*)vbo)->Vbo()),
-						deltaVbo, elements,
+						deltaRegion, elements,
 						((qgl::UntypedManagedSparselyUpdatedVBO*)vbo)->Vbo()
 							.VertexSize());
 			},
@@ -177,52 +290,194 @@ namespace qgl {
 				((qgl::UntypedManagedSparselyUpdatedVBO*)vbo)
 					->UpdateVBO();
 			},
-			vbo
+			vbo,
+			nullptr,
+			nullptr,
+			[](void* vbo) { // get vbo
+				return &(((qgl::UntypedManagedSparselyUpdatedVBO*)vbo)->Vbo());
+			}
 			});
 	}
 	
 	uint32_t EntityBufferManager::GetOffsetOfEntity(uint32_t entity) const {
-		return engine->GetGlobalEntityManager()->GetEntityOffset(entity);
+		return globalEntityManager->GetEntityOffset(entity);
+	}
+	
+	uint32_t EntityBufferManager::GetPipelineId() const {
+		return pipeline->GetPipelineId();
+	}
+	
+	void EntityBufferManager::ResetComponentColumns(uint32_t firstOffset,
+			uint32_t count) {
+		for(auto& it : componentColumns) {
+			it.second->Reset(firstOffset, count);
+		}
+	}
+	
+	void EntityBufferManager::AddUntypedComponentColumn(
+			std::shared_ptr<UntypedComponentColumn> column) {
+		if(componentColumns.find(column->GetName()) != componentColumns.end()) {
+			throw "qgl::EntityBufferManager::AddComponentColumn() column with this name already exists.";
+		}
+		column->Init();
+		componentColumns[column->GetName()] = column;
+		if(column->HasGpu()) {
+			AddManagedSparselyUpdateVBO(column->GetGpu());
+		}
+		if(column->HasHost()) {
+			buffers.push_back(BufferInfo{
+				nullptr,
+				nullptr,
+				nullptr,
+				[](void* column, uint32_t from, uint32_t to) { // move by one
+					const PairMove move{from, to};
+					((UntypedComponentColumn*)column)->MoveHost(&move, 1);
+				},
+				nullptr,
+				column.get(),
+				nullptr,
+				[](void* column, const PairMove* moves, uint32_t count) {
+					((UntypedComponentColumn*)column)->MoveHost(moves, count);
+				}
+			});
+		}
+	}
+	
+	std::shared_ptr<UntypedComponentColumn>
+		EntityBufferManager::GetUntypedComponentColumn(
+				const std::string& name) const {
+		auto it = componentColumns.find(name);
+		if(it == componentColumns.end()) {
+			return nullptr;
+		}
+		return it->second;
+	}
+	
+	bool EntityBufferManager::BindComponentColumn(const std::string& name,
+			uint32_t binding) {
+		auto it = componentColumns.find(name);
+		if(it == componentColumns.end() || !it->second->HasGpu()) {
+			return false;
+		}
+		it->second->GetGpu()->Vbo().BindBufferBase(gl::SHADER_STORAGE_BUFFER,
+				binding);
+		return true;
+	}
+	
+	void EntityBufferManager::SetComponentColumnBinding(
+			const std::string& name, uint32_t binding) {
+		auto it = componentColumns.find(name);
+		if(it == componentColumns.end() || !it->second->HasGpu()) {
+			throw "qgl::EntityBufferManager::SetComponentColumnBinding() column does not exist or has no GPU storage.";
+		}
+		componentColumnBindings[name] = binding;
+	}
+	
+	void EntityBufferManager::BindComponentColumns() {
+		for(auto& it : componentColumnBindings) {
+			BindComponentColumn(it.first, it.second);
+		}
+	}
+	
+	void EntityBufferManager::UpdateComponentColumns() {
+		for(auto& it : componentColumns) {
+			if(it.second->HasGpu()) {
+				it.second->GetGpu()->UpdateVBO();
+			}
+		}
 	}
 	
 	void EntityBufferManager::GenerateDeltaBuffer() {
 		deltaBuffer.clear();
-		deltaFromTo.clear();
-		for(const uint32_t entity : freeingEntites) {
-			const uint32_t offset = engine->GetGlobalEntityManager()
-				->GetEntityOffset(entity);
-			engine->GetGlobalEntityManager()->FreeEntity(entity);
-			deltaFromTo.erase(entity);
-			entitiesBufferSize--;
-			
-			if(entitiesBufferSize == offset) {
-				continue;
-			}
-			
-			const uint32_t otherOffset = entitiesBufferSize;
-			const uint32_t otherEntity = mapOffsetToEntity.GetValue(otherOffset);
-			
-			mapOffsetToEntity.SetValue(otherEntity, offset);
-			
-			engine->GetGlobalEntityManager()
-				->SetEntityOffset(otherEntity, offset);
-			
-			auto it = deltaFromTo.find(otherEntity);
-			if(it == deltaFromTo.end()) {
-				deltaFromTo[otherEntity] = {otherOffset, offset};
-			} else {
-				it->second.to = offset;
+		if(freedOffsets.empty()) {
+			return;
+		}
+		
+		// Every surviving entity from the tail [newSize, oldSize) is moved
+		// exactly once into a hole below newSize, so there are no move chains
+		// to collapse. Both sequences are ascending, which keeps moves
+		// ordered by destination.
+		std::sort(freedOffsets.begin(), freedOffsets.end());
+		const uint32_t oldSize = entitiesBufferSize;
+		const uint32_t newSize = oldSize - freedOffsets.size();
+		const uint32_t holes = std::lower_bound(freedOffsets.begin(),
+				freedOffsets.end(), newSize) - freedOffsets.begin();
+		
+		deltaBuffer.resize(holes);
+		uint32_t nextFreedInTail = holes;
+		uint32_t from = newSize;
+		for(uint32_t i=0; i<holes; ++i, ++from) {
+			while(nextFreedInTail < freedOffsets.size()
+					&& freedOffsets[nextFreedInTail] == from) {
+				++nextFreedInTail;
+				++from;
 			}
+			deltaBuffer[i] = {from, freedOffsets[i]};
 		}
+		entitiesBufferSize = newSize;
 		
-		for(auto it : deltaFromTo) {
-			if(it.first > 0) {
-				deltaBuffer.push_back(it.second);
+		movedEntities.resize(holes);
+		if(holes < PARALLEL_FIXUP_THRESHOLD) {
+			UpdateMovedEntitiesOffsets(0, holes);
+		} else {
+			// each move touches different registry slot, so chunks of moves
+			// are fixed concurrently by scheduler workers and this thread;
+			// chunks are claimed dynamically, so this thread finishes all of
+			// them itself when workers are busy
+			struct FixupState {
+				EntityBufferManager* self;
+				uint32_t moves;
+				uint32_t chunks;
+				std::atomic<uint32_t> nextChunk;
+				std::atomic<uint32_t> finishedChunks;
+				
+				void Run() {
+					for(;;) {
+						const uint32_t c = nextChunk.fetch_add(1);
+						if(c >= chunks)
+							return;
+						const uint32_t begin = c*FIXUP_CHUNK_SIZE;
+						self->UpdateMovedEntitiesOffsets(begin,
+								std::min(moves, begin+FIXUP_CHUNK_SIZE));
+						finishedChunks.fetch_add(1, std::memory_order_release);
+					}
+				}
+			};
+			std::shared_ptr<FixupState> state = std::make_shared<FixupState>();
+			state->self = this;
+			state->moves = holes;
+			state->chunks = (holes+FIXUP_CHUNK_SIZE-1)/FIXUP_CHUNK_SIZE;
+			state->nextChunk = 0;
+			state->finishedChunks = 0;
+			
+			std::shared_ptr<Scheduler> scheduler = engine->GetScheduler();
+			if(scheduler) {
+				const uint32_t tasks = std::min(state->chunks-1,
+						scheduler->GetWorkersCount());
+				for(uint32_t t=0; t<tasks; ++t) {
+					scheduler->ScheduleTask_(Task([state]() { state->Run(); }));
+				}
+			}
+			state->Run();
+			while(state->finishedChunks.load(std::memory_order_acquire)
+					!= state->chunks) {
+				std::this_thread::yield();
 			}
 		}
 		
-		deltaFromTo.clear();
-		freeingEntites.clear();
+		// holes are the first destinations in freedOffsets
+		mapOffsetToEntity.SetValues(movedEntities.data(), freedOffsets.data(),
+				holes);
+		freedOffsets.clear();
+	}
+	
+	void EntityBufferManager::UpdateMovedEntitiesOffsets(uint32_t begin,
+			uint32_t end) {
+		for(uint32_t i=begin; i<end; ++i) {
+			const PairMove p = deltaBuffer[i];
+			const uint32_t entity = mapOffsetToEntity.GetValue(p.from);
+			movedEntities[i] = entity;
+			globalEntityManager->SetEntityOffset(entity, p.to);
+		}
 	}
 }
-
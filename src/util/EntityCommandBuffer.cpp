@@ -0,0 +1,255 @@
+/*
+ *  This file is part of QuickGL.
+ *  Copyright (C) 2023 Marek Zalewski aka Drwalin
+ *
+ *  QuickGL is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  QuickGL is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "../../include/quickgl/Engine.hpp"
+#include "../../include/quickgl/GlobalEntityManager.hpp"
+#include "../../include/quickgl/pipelines/Pipeline.hpp"
+#include "../../include/quickgl/pipelines/PipelineBoneAnimated.hpp"
+
+#include "../../include/quickgl/util/EntityCommandBuffer.hpp"
+
+namespace qgl {
+	EntityCommandBuffer::EntityCommandBuffer(uint32_t sortKey) :
+		sortKey(sortKey) {
+		nextPlaceholder = 0;
+		firstPendingPlaceholder = 0;
+		resolvedBase = 0;
+		createdBase = 0;
+	}
+	
+	EntityCommandBuffer::~EntityCommandBuffer() {
+	}
+	
+	EntityCommandBuffer::Command EntityCommandBuffer::MakeCommand(
+			CommandType type, EntityRef entity) {
+		Command cmd;
+		cmd.type = type;
+		cmd.flags = entity.placeholder ? COMMAND_FLAG_PLACEHOLDER : 0;
+		cmd.entity = entity.entity;
+		return cmd;
+	}
+	
+	void EntityCommandBuffer::Record(const Command& cmd) {
+		std::lock_guard<std::mutex> lock(mutex);
+		commands.push_back(cmd);
+	}
+	
+	bool EntityCommandBuffer::Empty() const {
+		std::lock_guard<std::mutex> lock(mutex);
+		return commands.empty();
+	}
+	
+	EntityCommandBuffer::Placeholder EntityCommandBuffer::CreateEntity(
+			uint32_t pipelineId) {
+		Command cmd = MakeCommand(COMMAND_CREATE, pipelineId);
+		std::lock_guard<std::mutex> lock(mutex);
+		const uint32_t placeholder = nextPlaceholder++;
+		cmd.args[0] = placeholder;
+		commands.push_back(cmd);
+		return {placeholder};
+	}
+	
+	void EntityCommandBuffer::DeleteEntity(EntityRef entity) {
+		Record(MakeCommand(COMMAND_DELETE, entity));
+	}
+	
+	void EntityCommandBuffer::SetEntityMesh(EntityRef entity,
+			uint32_t meshId) {
+		Command cmd = MakeCommand(COMMAND_SET_MESH, entity);
+		cmd.args[0] = meshId;
+		Record(cmd);
+	}
+	
+	void EntityCommandBuffer::SetEntityTransformsQuat(EntityRef entity,
+			glm::vec3 pos, glm::quat rot, glm::vec3 scale) {
+		Command cmd = MakeCommand(COMMAND_SET_TRANSFORM, entity);
+		cmd.values[0] = pos.x;
+		cmd.values[1] = pos.y;
+		cmd.values[2] = pos.z;
+		cmd.values[3] = rot.x;
+		cmd.values[4] = rot.y;
+		cmd.values[5] = rot.z;
+		cmd.values[6] = rot.w;
+		cmd.values[7] = scale.x;
+		cmd.values[8] = scale.y;
+		cmd.values[9] = scale.z;
+		Record(cmd);
+	}
+	
+	void EntityCommandBuffer::SetAnimationState(EntityRef entity,
+			uint32_t animationId, float timeOffset, bool enableUpdateTime,
+			uint32_t animationIdAfter, bool continueNextAnimation) {
+		Command cmd = MakeCommand(COMMAND_SET_ANIMATION_STATE, entity);
+		cmd.args[0] = animationId;
+		cmd.args[1] = animationIdAfter;
+		cmd.args[2] = (continueNextAnimation?1u:0u) | (enableUpdateTime?2u:0u);
+		cmd.values[0] = timeOffset;
+		Record(cmd);
+	}
+	
+	uint32_t EntityCommandBuffer::ResolvePlaceholder(
+			Placeholder placeholder) const {
+		std::lock_guard<std::mutex> lock(mutex);
+		const uint32_t id = placeholder.id - resolvedBase;
+		if(id >= resolved.size())
+			return 0;
+		return resolved[id];
+	}
+	
+	uint32_t EntityCommandBuffer::Resolve(const Command& cmd) const {
+		if((cmd.flags & COMMAND_FLAG_PLACEHOLDER) == 0)
+			return cmd.entity;
+		const uint32_t id = cmd.entity - createdBase;
+		if(id < created.size())
+			return created[id];
+		// placeholder created by previous Apply(), resolved is not written
+		// by other threads
+		const uint32_t previous = cmd.entity - resolvedBase;
+		if(previous < resolved.size())
+			return resolved[previous];
+		return 0;
+	}
+	
+	Pipeline* EntityCommandBuffer::GetPipeline(Engine& engine, uint32_t entity,
+			uint32_t& pipelineId) {
+		pipelineId = engine.GetGlobalEntityManager()
+			->GetEntityPipelineId(entity);
+		if(pipelineId == EntityRegistry::INVALID_PIPELINE)
+			return nullptr;
+		return engine.GetPipeline(pipelineId).get();
+	}
+	
+	void EntityCommandBuffer::Apply(Engine& engine) {
+		uint32_t placeholders;
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			applying.swap(commands);
+			createdBase = firstPendingPlaceholder;
+			placeholders = nextPlaceholder - firstPendingPlaceholder;
+			firstPendingPlaceholder = nextPlaceholder;
+		}
+		created.clear();
+		created.resize(placeholders, 0);
+		
+		for(uint32_t i=0; i<applying.size();) {
+			const Command& cmd = applying[i];
+			switch(cmd.type) {
+				case COMMAND_CREATE:
+					ApplyCreate(engine, i);
+					break;
+				case COMMAND_SET_MESH:
+				case COMMAND_SET_TRANSFORM:
+					ApplyRun(engine, i);
+					break;
+				case COMMAND_DELETE: {
+					uint32_t pipelineId;
+					const uint32_t entity = Resolve(cmd);
+					Pipeline* pipeline = GetPipeline(engine, entity,
+							pipelineId);
+					if(pipeline) {
+						pipeline->DeleteEntity(entity);
+					}
+					++i;
+				} break;
+				case COMMAND_SET_ANIMATION_STATE: {
+					uint32_t pipelineId;
+					const uint32_t entity = Resolve(cmd);
+					PipelineBoneAnimated* pipeline =
+						dynamic_cast<PipelineBoneAnimated*>(
+								GetPipeline(engine, entity, pipelineId));
+					if(pipeline) {
+						pipeline->SetAnimationState(entity, cmd.args[0],
+								cmd.values[0], cmd.args[2] & 2, cmd.args[1],
+								cmd.args[2] & 1);
+					}
+					++i;
+				} break;
+			}
+		}
+		
+		applying.clear();
+		if(placeholders != 0) {
+			std::lock_guard<std::mutex> lock(mutex);
+			resolved.swap(created);
+			resolvedBase = createdBase;
+		}
+		created.clear();
+	}
+	
+	void EntityCommandBuffer::ApplyCreate(Engine& engine, uint32_t& i) {
+		// consecutive creations in the same pipeline have consecutive
+		// placeholders and are created with single batched call
+		const uint32_t pipelineId = applying[i].entity;
+		const uint32_t firstPlaceholder = applying[i].args[0];
+		uint32_t count = 0;
+		for(; i<applying.size(); ++i, ++count) {
+			if(applying[i].type != COMMAND_CREATE ||
+					applying[i].entity != pipelineId) {
+				break;
+			}
+		}
+		std::shared_ptr<Pipeline> pipeline = engine.GetPipeline(pipelineId);
+		if(pipeline) {
+			pipeline->CreateEntities(count, created.data()+(firstPlaceholder-createdBase));
+		}
+	}
+	
+	void EntityCommandBuffer::ApplyRun(Engine& engine, uint32_t& i) {
+		// consecutive updates of the same kind of entities of the same
+		// pipeline are applied with single batched call
+		const CommandType type = applying[i].type;
+		uint32_t pipelineId;
+		Pipeline* pipeline = GetPipeline(engine, Resolve(applying[i]),
+				pipelineId);
+		if(pipeline == nullptr) {
+			++i;
+			return;
+		}
+		GlobalEntityManager* gem = engine.GetGlobalEntityManager().get();
+		batchIds.clear();
+		batchMeshes.clear();
+		batchPos.clear();
+		batchRot.clear();
+		batchScale.clear();
+		for(; i<applying.size() && applying[i].type == type; ++i) {
+			const Command& cmd = applying[i];
+			const uint32_t entity = Resolve(cmd);
+			if(gem->GetEntityPipelineId(entity) != pipelineId)
+				break;
+			batchIds.push_back(entity);
+			if(type == COMMAND_SET_MESH) {
+				batchMeshes.push_back(cmd.args[0]);
+			} else {
+				batchPos.emplace_back(cmd.values[0], cmd.values[1],
+						cmd.values[2]);
+				batchRot.emplace_back(cmd.values[6], cmd.values[3],
+						cmd.values[4], cmd.values[5]);
+				batchScale.emplace_back(cmd.values[7], cmd.values[8],
+						cmd.values[9]);
+			}
+		}
+		if(type == COMMAND_SET_MESH) {
+			pipeline->SetEntityMeshes(batchIds.data(), batchIds.size(),
+					batchMeshes.data());
+		} else {
+			pipeline->SetEntityTransforms(batchIds.data(), batchIds.size(),
+					batchPos.data(), batchRot.data(), batchScale.data());
+		}
+	}
+}
+
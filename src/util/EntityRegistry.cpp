@@ -0,0 +1,114 @@
+/*
+ *  This file is part of QuickGL.
+ *  Copyright (C) 2023 Marek Zalewski aka Drwalin
+ *
+ *  QuickGL is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  QuickGL is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "../../include/quickgl/util/EntityRegistry.hpp"
+
+namespace qgl {
+	EntityRegistry::EntityRegistry() {
+		Clear();
+	}
+	
+	EntityRegistry::~EntityRegistry() {
+	}
+	
+	uint32_t EntityRegistry::AcquireSlot() {
+		uint32_t index;
+		if(freeFront < freeSlots.size()) {
+			index = freeSlots[freeFront++];
+			if(freeFront == freeSlots.size()) {
+				freeSlots.clear();
+				freeFront = 0;
+			} else if(freeFront >= 4096 && freeFront*2 >= freeSlots.size()) {
+				freeSlots.erase(freeSlots.begin(), freeSlots.begin()+freeFront);
+				freeFront = 0;
+			}
+		} else {
+			index = slots.size();
+			if(index > MAX_ENTITIES)
+				throw "qgl::EntityRegistry::AcquireSlot() run out of entity handles.";
+			slots.push_back({0, 0, 0, 0});
+		}
+		Slot& slot = slots[index];
+		slot.generation = (slot.generation + 1) & GENERATION_MASK;
+		slot.handle = index | (slot.generation << INDEX_BITS);
+		++count;
+		return index;
+	}
+	
+	uint32_t EntityRegistry::Create(uint32_t pipelineId, uint32_t offset) {
+		Slot& slot = slots[AcquireSlot()];
+		slot.offset = offset;
+		slot.pipelineId = pipelineId;
+		return slot.handle;
+	}
+	
+	void EntityRegistry::Create(uint32_t pipelineId, uint32_t firstOffset,
+			uint32_t count, uint32_t* outHandles) {
+		Reserve(this->count + count);
+		for(uint32_t i=0; i<count; ++i) {
+			Slot& slot = slots[AcquireSlot()];
+			slot.offset = firstOffset+i;
+			slot.pipelineId = pipelineId;
+			outHandles[i] = slot.handle;
+		}
+	}
+	
+	bool EntityRegistry::Destroy(uint32_t handle) {
+		if(!IsValid(handle))
+			return false;
+		const uint32_t index = handle & INDEX_MASK;
+		Slot& slot = slots[index];
+		slot.handle = 0;
+		slot.offset = INVALID_OFFSET;
+		slot.pipelineId = INVALID_PIPELINE;
+		freeSlots.emplace_back(index);
+		--count;
+		return true;
+	}
+	
+	bool EntityRegistry::SetOffset(uint32_t handle, uint32_t offset) {
+		if(!IsValid(handle))
+			return false;
+		slots[handle & INDEX_MASK].offset = offset;
+		return true;
+	}
+	
+	bool EntityRegistry::SetPipeline(uint32_t handle, uint32_t pipelineId,
+			uint32_t offset) {
+		if(!IsValid(handle))
+			return false;
+		Slot& slot = slots[handle & INDEX_MASK];
+		slot.pipelineId = pipelineId;
+		slot.offset = offset;
+		return true;
+	}
+	
+	void EntityRegistry::Reserve(uint32_t entities) {
+		// slot 0 is reserved
+		slots.reserve(entities+1);
+	}
+	
+	void EntityRegistry::Clear() {
+		slots.clear();
+		slots.push_back({0, 0, INVALID_PIPELINE, 0});
+		freeSlots.clear();
+		freeFront = 0;
+		count = 0;
+	}
+}
+
@@ -16,35 +16,120 @@
  *  along with this program.  If not, see <https://www.gnu.org/licenses/>.
  */
 
-#include "../../include/quickgl/util/EventQueue.hpp"
-
 #include <mutex>
 
+#include "../../include/quickgl/util/EventQueue.hpp"
+
 namespace qgl {
 	
-	void EventQueue::PushEvent_(std::function<void()> event) {
-		std::lock_guard lock(mutex);
-		eventsQueue.push(event);
+	static size_t RoundUpToPowerOf2(size_t v) {
+		size_t p = 2;
+		while(p < v) {
+			p <<= 1;
+		}
+		return p;
+	}
+	
+	EventQueue::EventQueue(uint32_t ringCapacity) :
+		mask(RoundUpToPowerOf2(ringCapacity)-1),
+		ring(new Cell[mask+1]), enqueuePosition(0), dequeuePosition(0),
+		counter(0), overflowCount(0) {
+		for(size_t i=0; i<=mask; ++i) {
+			ring[i].sequence.store(i, std::memory_order_relaxed);
+		}
+	}
+	
+	EventQueue::~EventQueue() {
+	}
+	
+	void EventQueue::PushEvent_(Task&& event) {
 		counter++;
+		// while overflow is not empty new tasks go after it
+		if(overflowCount.load(std::memory_order_acquire) == 0) {
+			if(TryPushRing(event)) {
+				return;
+			}
+		}
+		std::lock_guard lock(overflowMutex);
+		overflow.emplace_back(std::move(event));
+		overflowCount.fetch_add(1, std::memory_order_release);
 	}
 	
-	bool EventQueue::ExecuteOneEvent() {
-		if(popedEventsForRunningThreads.empty()) {
-			std::lock_guard lock(mutex);
-			std::swap(eventsQueue, popedEventsForRunningThreads);
-		}
-		
-		if(popedEventsForRunningThreads.empty() == false) {
-			popedEventsForRunningThreads.front()();
-			popedEventsForRunningThreads.pop();
+	bool EventQueue::PopEvent(Task& event) {
+		if(TryPopRing(event)) {
 			counter--;
 			return true;
 		}
+		if(overflowCount.load(std::memory_order_acquire) == 0) {
+			return false;
+		}
+		std::lock_guard lock(overflowMutex);
+		if(overflow.empty()) {
+			return false;
+		}
+		event = std::move(overflow.front());
+		overflow.pop_front();
+		overflowCount.fetch_sub(1, std::memory_order_release);
+		counter--;
+		return true;
+	}
+	
+	bool EventQueue::ExecuteOneEvent() {
+		Task event;
+		if(PopEvent(event)) {
+			event();
+			return true;
+		}
 		return false;
 	}
 	
 	bool EventQueue::HasAnyEvents() {
 		return counter != 0;
 	}
+	
+	bool EventQueue::TryPushRing(Task& event) {
+		size_t pos = enqueuePosition.load(std::memory_order_relaxed);
+		Cell* cell;
+		for(;;) {
+			cell = &ring[pos & mask];
+			const size_t seq = cell->sequence.load(std::memory_order_acquire);
+			const intptr_t diff = (intptr_t)seq - (intptr_t)pos;
+			if(diff == 0) {
+				if(enqueuePosition.compare_exchange_weak(pos, pos+1,
+							std::memory_order_relaxed)) {
+					break;
+				}
+			} else if(diff < 0) {
+				return false; // full
+			} else {
+				pos = enqueuePosition.load(std::memory_order_relaxed);
+			}
+		}
+		cell->task = std::move(event);
+		cell->sequence.store(pos+1, std::memory_order_release);
+		return true;
+	}
+	
+	bool EventQueue::TryPopRing(Task& event) {
+		size_t pos = dequeuePosition.load(std::memory_order_relaxed);
+		Cell* cell;
+		for(;;) {
+			cell = &ring[pos & mask];
+			const size_t seq = cell->sequence.load(std::memory_order_acquire);
+			const intptr_t diff = (intptr_t)seq - (intptr_t)(pos+1);
+			if(diff == 0) {
+				if(dequeuePosition.compare_exchange_weak(pos, pos+1,
+							std::memory_order_relaxed)) {
+					break;
+				}
+			} else if(diff < 0) {
+				return false; // empty
+			} else {
+				pos = dequeuePosition.load(std::memory_order_relaxed);
+			}
+		}
+		event = std::move(cell->task);
+		cell->sequence.store(pos+mask+1, std::memory_order_release);
+		return true;
+	}
 }
-
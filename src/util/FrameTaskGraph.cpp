@@ -0,0 +1,245 @@
+/*
+ *  This file is part of QuickGL.
+ *  Copyright (C) 2023 Marek Zalewski aka Drwalin
+ *
+ *  QuickGL is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  QuickGL is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <thread>
+#include <chrono>
+
+#include "../../include/quickgl/util/Scheduler.hpp"
+#include "../../include/quickgl/util/RenderStageComposer.hpp"
+
+#include "../../include/quickgl/util/FrameTaskGraph.hpp"
+
+namespace qgl {
+	FrameTaskGraph::FrameTaskGraph(std::shared_ptr<Scheduler> scheduler) :
+		scheduler(scheduler), unfinishedJobs(0), running(false) {
+		readyJobs = std::make_shared<ReadyJobs>();
+		readyJobs->graph = this;
+	}
+	
+	FrameTaskGraph::~FrameTaskGraph() {
+		while(HasPendingJobs()) {
+			if(!ExecuteOne()) {
+				WaitForJob(END_FRAME_WAIT_NANOSECONDS);
+			}
+		}
+		// last finished worker job may still hold the mutex
+		std::lock_guard lock(jobFinishedMutex);
+	}
+	
+	FrameTaskGraph::JobId FrameTaskGraph::AddJob(std::string name, Task&& job,
+			uint32_t flags) {
+		if(running) {
+			throw "qgl::FrameTaskGraph::AddJob() cannot add jobs while frame is rendered.";
+		}
+		const JobId id = jobs.size();
+		jobs.emplace_back(std::make_unique<Job>());
+		Job& j = *jobs.back();
+		j.name = name;
+		j.task = std::move(job);
+		j.flags = flags;
+		j.dependenciesCount = 0;
+		j.remainingDependencies = 0;
+		j.finished = false;
+		return id;
+	}
+	
+	void FrameTaskGraph::AddDependency(JobId job, JobId dependsOn) {
+		Job& j = GetJob(job);
+		Job& d = GetJob(dependsOn);
+		if(running) {
+			throw "qgl::FrameTaskGraph::AddDependency() cannot add dependencies while frame is rendered.";
+		}
+		d.dependents.emplace_back(job);
+		j.dependenciesCount++;
+	}
+	
+	void FrameTaskGraph::RunAfterStage(JobId job, std::string stageName) {
+		Job& j = GetJob(job);
+		if(running) {
+			throw "qgl::FrameTaskGraph::RunAfterStage() cannot add dependencies while frame is rendered.";
+		}
+		j.afterStages.emplace_back(stageName);
+		j.dependenciesCount++;
+	}
+	
+	void FrameTaskGraph::RunBeforeStage(JobId job, std::string stageName) {
+		GetJob(job);
+		if(running) {
+			throw "qgl::FrameTaskGraph::RunBeforeStage() cannot add dependencies while frame is rendered.";
+		}
+		stageBlockers[stageName].emplace_back(job);
+	}
+	
+	void FrameTaskGraph::BeginFrame() {
+		running = true;
+		unfinishedJobs = jobs.size();
+		jobsWaitingForStages.clear();
+		for(JobId i=0; i<jobs.size(); ++i) {
+			Job& j = *jobs[i];
+			j.remainingDependencies = j.dependenciesCount;
+			if(!j.afterStages.empty()) {
+				jobsWaitingForStages.emplace_back(i);
+			}
+		}
+		for(JobId i=0; i<jobs.size(); ++i) {
+			if(jobs[i]->dependenciesCount == 0) {
+				Submit(i);
+			}
+		}
+	}
+	
+	void FrameTaskGraph::UpdateStageDependencies(
+			RenderStageComposer* composer) {
+		for(uint32_t i=0; i<jobsWaitingForStages.size();) {
+			Job& j = *jobs[jobsWaitingForStages[i]];
+			const JobId id = jobsWaitingForStages[i];
+			while(!j.afterStages.empty()
+					&& composer->IsStageFinished(j.afterStages.back())) {
+				j.afterStages.pop_back();
+				ResolveDependency(id);
+			}
+			if(j.afterStages.empty()) {
+				jobsWaitingForStages[i] = jobsWaitingForStages.back();
+				jobsWaitingForStages.pop_back();
+			} else {
+				++i;
+			}
+		}
+	}
+	
+	bool FrameTaskGraph::IsStageBlocked(const std::string& stageName) const {
+		auto it = stageBlockers.find(stageName);
+		if(it == stageBlockers.end()) {
+			return false;
+		}
+		for(JobId id : it->second) {
+			if(jobs[id]->finished.load(std::memory_order_acquire) == false) {
+				return true;
+			}
+		}
+		return false;
+	}
+	
+	bool FrameTaskGraph::ExecuteOne() {
+		JobId id = 0;
+		bool found = false;
+		{
+			std::lock_guard lock(renderThreadJobsMutex);
+			if(!renderThreadJobs.empty()) {
+				id = renderThreadJobs.back();
+				renderThreadJobs.pop_back();
+				found = true;
+			}
+		}
+		if(found || readyJobs->Pop(id)) {
+			RunJob(id);
+			return true;
+		}
+		return false;
+	}
+	
+	bool FrameTaskGraph::HasPendingJobs() const {
+		return unfinishedJobs.load(std::memory_order_acquire) != 0;
+	}
+	
+	bool FrameTaskGraph::WaitForJob(int64_t maxWaitNanoseconds) {
+		const uint32_t unfinished
+			= unfinishedJobs.load(std::memory_order_acquire);
+		if(unfinished == 0) {
+			return false;
+		}
+		std::unique_lock lock(jobFinishedMutex);
+		jobFinished.wait_for(lock, std::chrono::nanoseconds(maxWaitNanoseconds),
+				[this, unfinished]() {
+					return unfinishedJobs.load(std::memory_order_acquire)
+						!= unfinished;
+				});
+		return true;
+	}
+	
+	void FrameTaskGraph::EndFrame() {
+		while(HasPendingJobs()) {
+			if(!ExecuteOne()) {
+				WaitForJob(END_FRAME_WAIT_NANOSECONDS);
+			}
+		}
+		// last finished worker job may still hold the mutex
+		std::lock_guard lock(jobFinishedMutex);
+		jobs.clear();
+		stageBlockers.clear();
+		jobsWaitingForStages.clear();
+		running = false;
+	}
+	
+	void FrameTaskGraph::Submit(JobId id) {
+		if(scheduler && (jobs[id]->flags & JOB_RENDER_THREAD) == 0) {
+			{
+				std::lock_guard lock(readyJobs->mutex);
+				readyJobs->jobs.emplace_back(id);
+			}
+			std::shared_ptr<ReadyJobs> queue = readyJobs;
+			scheduler->ScheduleTask_(Task([queue]() {
+				JobId job;
+				if(queue->Pop(job)) {
+					queue->graph->RunJob(job);
+				}
+			}));
+		} else {
+			std::lock_guard lock(renderThreadJobsMutex);
+			renderThreadJobs.emplace_back(id);
+		}
+	}
+	
+	void FrameTaskGraph::RunJob(JobId id) {
+		Job& j = *jobs[id];
+		j.task();
+		j.task = Task();
+		j.finished.store(true, std::memory_order_release);
+		for(JobId d : j.dependents) {
+			ResolveDependency(d);
+		}
+		// decremented under mutex, so waiter cannot miss notification
+		std::lock_guard lock(jobFinishedMutex);
+		unfinishedJobs.fetch_sub(1, std::memory_order_acq_rel);
+		jobFinished.notify_all();
+	}
+	
+	bool FrameTaskGraph::ReadyJobs::Pop(JobId& id) {
+		std::lock_guard lock(mutex);
+		if(jobs.empty()) {
+			return false;
+		}
+		id = jobs.back();
+		jobs.pop_back();
+		return true;
+	}
+	
+	void FrameTaskGraph::ResolveDependency(JobId id) {
+		if(jobs[id]->remainingDependencies.fetch_sub(1,
+					std::memory_order_acq_rel) == 1) {
+			Submit(id);
+		}
+	}
+	
+	FrameTaskGraph::Job& FrameTaskGraph::GetJob(JobId id) {
+		if(id >= jobs.size()) {
+			throw "qgl::FrameTaskGraph::GetJob() invalid job id.";
+		}
+		return *jobs[id];
+	}
+}
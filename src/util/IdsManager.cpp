@@ -16,87 +16,117 @@
  *  along with this program.  If not, see <https://www.gnu.org/licenses/>.
  */
 
-#include <cmath>
+#include <algorithm>
 
 #include "../../include/quickgl/util/IdsManager.hpp"
 
 namespace qgl {
 	
 	uint32_t IdsManager::GetNewId() {
+		uint32_t id;
 		if(freeIdsStack.size()) {
-			uint32_t id = freeIdsStack.back();
-			freeIdsStack.resize(freeIdsStack.size()-1);
-			uint32_t arrayOfUsedIdsOffset = arrayOfUsedIds.size();
-			mapIdToOffsetInArrayOfUsedIds[id] = arrayOfUsedIdsOffset;
-			arrayOfUsedIds.emplace_back(id);
-			return id;
+			id = freeIdsStack.back();
+			freeIdsStack.pop_back();
 		} else {
-			uint32_t id = ids.size();
-			ids.resize(id+1);
-			arrayOfUsedIds.push_back(id);
-			mapIdToOffsetInArrayOfUsedIds[id] = id; 
-			return id;
+			id = mapIdToOffsetInArrayOfUsedIds.size();
+			mapIdToOffsetInArrayOfUsedIds.emplace_back();
 		}
+		mapIdToOffsetInArrayOfUsedIds[id] = arrayOfUsedIds.size();
+		arrayOfUsedIds.emplace_back(id);
+		return id;
 	}
 	
 	void IdsManager::FreeId(uint32_t id) {
+		if(!IsUsed(id)) {
+			return;
+		}
+		RemoveUsedId(id);
 		freeIdsStack.emplace_back(id);
-		uint32_t arrayOfUsedIdsOffset = mapIdToOffsetInArrayOfUsedIds[id];
-		mapIdToOffsetInArrayOfUsedIds.erase(id);
+	}
+	
+	void IdsManager::GetNewIds(uint32_t count, uint32_t* outIds) {
+		const uint32_t reused = std::min<size_t>(count, freeIdsStack.size());
+		for(uint32_t i=0; i<reused; ++i) {
+			outIds[i] = freeIdsStack[freeIdsStack.size()-1-i];
+		}
+		freeIdsStack.resize(freeIdsStack.size()-reused);
 		
-		if(arrayOfUsedIdsOffset != arrayOfUsedIds.size()-1) {
-			uint32_t movingId = arrayOfUsedIds.back();
-			arrayOfUsedIds[arrayOfUsedIdsOffset] = movingId;
-			mapIdToOffsetInArrayOfUsedIds[movingId] = arrayOfUsedIdsOffset;
+		const uint32_t firstNewId = mapIdToOffsetInArrayOfUsedIds.size();
+		mapIdToOffsetInArrayOfUsedIds.resize(firstNewId + count - reused);
+		for(uint32_t i=reused; i<count; ++i) {
+			outIds[i] = firstNewId + i - reused;
 		}
 		
-		arrayOfUsedIds.resize(arrayOfUsedIds.size()-1);
+		const uint32_t firstOffset = arrayOfUsedIds.size();
+		arrayOfUsedIds.insert(arrayOfUsedIds.end(), outIds, outIds+count);
+		for(uint32_t i=0; i<count; ++i) {
+			mapIdToOffsetInArrayOfUsedIds[outIds[i]] = firstOffset+i;
+		}
+	}
+	
+	void IdsManager::FreeIds(const uint32_t* ids, uint32_t count) {
+		freeIdsStack.reserve(freeIdsStack.size() + count);
+		for(uint32_t i=0; i<count; ++i) {
+			IdsManager::FreeId(ids[i]);
+		}
+	}
+	
+	uint32_t IdsManager::RemoveUsedId(uint32_t id) {
+		const uint32_t offset = mapIdToOffsetInArrayOfUsedIds[id];
+		mapIdToOffsetInArrayOfUsedIds[id] = INVALID_OFFSET;
+		const uint32_t movingId = arrayOfUsedIds.back();
+		arrayOfUsedIds.pop_back();
+		if(movingId == id) {
+			return INVALID_OFFSET;
+		}
+		arrayOfUsedIds[offset] = movingId;
+		mapIdToOffsetInArrayOfUsedIds[movingId] = offset;
+		return offset;
 	}
 	
 	
 	
 	
 	
+	IdsManagerVBOManaged::IdsManagerVBOManaged(std::shared_ptr<Engine> engine)
+		: vbo(engine) {
+	}
+	
 	void IdsManagerVBOManaged::InitVBO() {
 		vbo.Init();
 	}
 	
 	uint32_t IdsManagerVBOManaged::GetNewId() {
-		if(freeIdsStack.empty()) {
-			const uint32_t addSize = std::max<uint32_t>(256, (arrayOfUsedIds.size()*3)/2);
-			const uint32_t start = arrayOfUsedIds.size();
-			arrayOfUsedIds.reserve(arrayOfUsedIds.size()+addSize);
-			mapIdToOffsetInArrayOfUsedIds.resize(arrayOfUsedIds.size()+addSize);
-			freeIdsStack.resize(addSize);
-			for(int i=0; i<addSize; ++i) {
-				freeIdsStack[i] = start+addSize-1-i;
-			}
-		}
-		uint32_t id = freeIdsStack.back();
-		freeIdsStack.resize(freeIdsStack.size()-1);
-		uint32_t arrayOfUsedIdsOffset = arrayOfUsedIds.size();
-		mapIdToOffsetInArrayOfUsedIds[id] = arrayOfUsedIdsOffset;
-		vbo.SetValue(id, arrayOfUsedIds.size());
-		arrayOfUsedIds.emplace_back(id);
+		const uint32_t id = IdsManager::GetNewId();
+		vbo.SetValue(id, arrayOfUsedIds.size()-1);
 		return id;
 	}
 	
 	void IdsManagerVBOManaged::FreeId(uint32_t id) {
+		if(!IsUsed(id)) {
+			return;
+		}
+		const uint32_t movedOffset = RemoveUsedId(id);
+		if(movedOffset != INVALID_OFFSET) {
+			vbo.SetValue(arrayOfUsedIds[movedOffset], movedOffset);
+		}
 		freeIdsStack.emplace_back(id);
-		uint32_t arrayOfUsedIdsOffset = mapIdToOffsetInArrayOfUsedIds[id];
-		
-		if(arrayOfUsedIdsOffset != arrayOfUsedIds.size()-1) {
-			uint32_t movingId = arrayOfUsedIds.back();
-			vbo.SetValue(movingId, arrayOfUsedIdsOffset);
-			arrayOfUsedIds[arrayOfUsedIdsOffset] = movingId;
-			mapIdToOffsetInArrayOfUsedIds[movingId] = arrayOfUsedIdsOffset;
+	}
+	
+	void IdsManagerVBOManaged::GetNewIds(uint32_t count, uint32_t* outIds) {
+		const uint32_t firstOffset = arrayOfUsedIds.size();
+		IdsManager::GetNewIds(count, outIds);
+		vbo.SetValues(outIds, firstOffset, count);
+	}
+	
+	void IdsManagerVBOManaged::FreeIds(const uint32_t* ids, uint32_t count) {
+		freeIdsStack.reserve(freeIdsStack.size() + count);
+		for(uint32_t i=0; i<count; ++i) {
+			FreeId(ids[i]);
 		}
-		
-		arrayOfUsedIds.resize(arrayOfUsedIds.size()-1);
 	}
 	
 	void IdsManagerVBOManaged::UpdateVBO() {
 		vbo.UpdateVBO();
 	}
 }
-
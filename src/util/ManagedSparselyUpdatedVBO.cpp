@@ -18,6 +18,8 @@
 
 #include <cstring>
 
+#include <algorithm>
+
 #include "../../OpenGLWrapper/include/openglwrapper/VBO.hpp"
 #include "../../OpenGLWrapper/include/openglwrapper/VAO.hpp"
 #include "../../OpenGLWrapper/include/openglwrapper/Shader.hpp"
@@ -33,7 +35,9 @@ namespace qgl {
 			std::shared_ptr<Engine> engine,
 			uint32_t elementSize) : engine(engine),
 			ELEMENT_SIZE((elementSize+3)-((elementSize+3)&3)),
-   			UPDATE_STRUCUTRE_SIZE(ELEMENT_SIZE+sizeof(uint32_t)) {
+   			UPDATE_STRUCUTRE_SIZE(ELEMENT_SIZE+sizeof(uint32_t)),
+			MIN_RANGE_UPLOAD_ELEMENTS(std::max<uint32_t>(32,
+						4096/ELEMENT_SIZE)) {
 		vbo = nullptr;
 		shader = nullptr;
 	}
@@ -87,6 +91,7 @@ void main() {
 				shader->GetUniformLocation("updateElements");
 		}
 		deltaData.clear();
+		stagedSlots.clear();
 	}
 	
 	void UntypedManagedSparselyUpdatedVBO::Destroy() {
@@ -101,57 +106,429 @@ void main() {
 			vbo = nullptr;
 		}
 		deltaData.clear();
+		stagedSlots.clear();
 	}
 	
 	void UntypedManagedSparselyUpdatedVBO::Resize(uint32_t size) {
 		vbo->Resize(size);
 	}
 	
+	void UntypedManagedSparselyUpdatedVBO::EnsureCapacity(uint32_t count) {
+		if(vbo->GetVertexCount() < count) {
+			vbo->Resize((count*3)/2+100);
+		}
+	}
+	
 	void UntypedManagedSparselyUpdatedVBO::UpdateVBO() {
+		const uint32_t scattered = PrepareUpdate();
+		if(scattered) {
+			UploadScattered(ScatteredEntries(), scattered);
+		}
+		FinishUpdate();
+	}
+	
+	uint32_t UntypedManagedSparselyUpdatedVBO::PrepareUpdate() {
+		scatteredEntries.clear();
+		allEntriesScattered = false;
 		if(deltaData.size() == 0)
-			return;
+			return 0;
 		if(vbo->GetVertexCount() <= maxId) {
 			vbo->Resize((maxId*3)/2+100);
 		}
+		const uint32_t entries = deltaData.size()/UPDATE_STRUCUTRE_SIZE;
+		
+		// split staged entries into dense runs of consecutive ids, uploaded
+		// as ranges, and sparse leftovers scattered by compute shader
+		bool anyRange = false;
+		for(uint32_t i=0; i<entries;) {
+			const uint32_t first = StagedId(i);
+			uint32_t run = 1;
+			while(i+run < entries && StagedId(i+run) == first+run) {
+				++run;
+			}
+			if(run >= MIN_RANGE_UPLOAD_ELEMENTS) {
+				UploadRange(i, run);
+				anyRange = true;
+			} else {
+				for(uint32_t j=i; j<i+run; ++j) {
+					scatteredEntries.emplace_back(j);
+				}
+			}
+			i += run;
+		}
+		if(!anyRange) {
+			allEntriesScattered = true;
+			scatteredEntries.clear();
+			return entries;
+		}
+		return scatteredEntries.size();
+	}
+	
+	void UntypedManagedSparselyUpdatedVBO::FinishUpdate() {
+		ClearStagedSlots(deltaData.size()/UPDATE_STRUCUTRE_SIZE);
+		deltaData.clear();
+		scatteredEntries.clear();
+	}
+	
+	void UntypedManagedSparselyUpdatedVBO::UploadRange(uint32_t firstEntry,
+			uint32_t count) {
+		const uint32_t firstId = StagedId(firstEntry);
+		for(uint32_t i=0; i<count; ) {
+			DeltaVboManager::Region region = engine->GetDeltaVboManager()
+				->Allocate((count-i)*ELEMENT_SIZE, ELEMENT_SIZE);
+			const uint32_t n = region.size/ELEMENT_SIZE;
+			uint8_t* dst = (uint8_t*)region.data;
+			const uint8_t* src = deltaData.data()
+				+ (firstEntry+i)*UPDATE_STRUCUTRE_SIZE;
+			for(uint32_t j=0; j<n; ++j) {
+				memcpy(dst, src, ELEMENT_SIZE);
+				dst += ELEMENT_SIZE;
+				src += UPDATE_STRUCUTRE_SIZE;
+			}
+			vbo->Copy(region.vbo, region.offset, (firstId+i)*ELEMENT_SIZE,
+					n*ELEMENT_SIZE);
+			i += n;
+		}
+	}
+	
+	void UntypedManagedSparselyUpdatedVBO::UploadScattered(
+			const uint32_t* entries, uint32_t count) {
 		const uint32_t vs = UPDATE_STRUCUTRE_SIZE;
 		shader->Use();
-		for(uint32_t i=0; i<deltaData.size()/vs; ) {
-			auto deltaVbo = engine->GetDeltaVboManager()->GetNextUpdateVBO();
-			const uint32_t count = std::min<uint32_t>(
-					deltaVbo->GetVertexCount()/vs,
-					deltaData.size()/vs - i);
-			deltaVbo->Update(deltaData.data()+(i*vs), 0, count*vs);
-			//TODO: check if memory barrier is needed
- 			gl::MemoryBarrier(gl::MemoryBarriers::BUFFER_UPDATE_BARRIER_BIT);
-			shader->SetUInt(shaderDeltaCommandsLocation, count);
-			deltaVbo->BindBufferBase(gl::SHADER_STORAGE_BUFFER, 1);
+		for(uint32_t i=0; i<count; ) {
+			DeltaVboManager::Region region = engine->GetDeltaVboManager()
+				->Allocate((count-i)*vs, vs);
+			const uint32_t n = region.size/vs;
+			// ring buffer is mapped coherently, no flush nor barrier needed
+			if(entries == nullptr) {
+				memcpy(region.data, deltaData.data()+(i*vs), n*vs);
+			} else {
+				uint8_t* dst = (uint8_t*)region.data;
+				for(uint32_t j=0; j<n; ++j, dst+=vs) {
+					memcpy(dst, deltaData.data()+entries[i+j]*vs, vs);
+				}
+			}
+			shader->SetUInt(shaderDeltaCommandsLocation, n);
+			region.BindBufferRange(1);
 			vbo->BindBufferBase(gl::SHADER_STORAGE_BUFFER, 2);
-			shader->DispatchRoundGroupNumbers(count, 1, 1);
+			shader->DispatchRoundGroupNumbers(n, 1, 1);
 			
-			i += count;
+			i += n;
 		}
 		gl::Shader::Unuse();
-		whereSomethingWasUpdated.clear();
-		deltaData.clear();
+	}
+	
+	uint8_t* UntypedManagedSparselyUpdatedVBO::StageValue(uint32_t id) {
+		if(id >= stagedSlots.size()) {
+			GrowStagedSlots(id+1);
+		}
+		uint32_t& slot = stagedSlots[id];
+		uint32_t p;
+		if(slot) {
+			p = (slot-1)*UPDATE_STRUCUTRE_SIZE;
+		} else {
+			p = deltaData.size();
+			deltaData.resize(p+UPDATE_STRUCUTRE_SIZE);
+			slot = p/UPDATE_STRUCUTRE_SIZE + 1;
+			*(uint32_t*)&(deltaData[p+ELEMENT_SIZE]) = id;
+			maxId = std::max(maxId, id);
+		}
+		return &(deltaData[p]);
+	}
+	
+	void UntypedManagedSparselyUpdatedVBO::GrowStagedSlots(uint32_t size) {
+		stagedSlots.resize(std::max<size_t>(size,
+					(stagedSlots.size()*3)/2 + 64), 0);
+	}
+	
+	void UntypedManagedSparselyUpdatedVBO::ClearStagedSlots(uint32_t entries) {
+		// resetting only touched slots is cheaper unless most of them were
+		// touched
+		if(entries*4 >= stagedSlots.size()) {
+			std::fill(stagedSlots.begin(), stagedSlots.end(), 0);
+		} else {
+			for(uint32_t i=0; i<entries; ++i) {
+				stagedSlots[StagedId(i)] = 0;
+			}
+		}
 	}
 	
 	void UntypedManagedSparselyUpdatedVBO::SetValue(const void* value,
 			uint32_t id) {
-		auto it = whereSomethingWasUpdated.find(id);
+		memcpy(StageValue(id), value, ELEMENT_SIZE);
+	}
+	
+	void UntypedManagedSparselyUpdatedVBO::SetValues(const void* values,
+			uint32_t valueStride, uint32_t firstId, uint32_t count) {
+		if(count == 0)
+			return;
+		const uint8_t* src = (const uint8_t*)values;
+		const uint32_t copySize = valueStride ? std::min(valueStride,
+				ELEMENT_SIZE) : ELEMENT_SIZE;
+		// ids above maxId cannot be staged yet, so they are appended without
+		// looking them up
+		uint32_t i = 0;
+		if(!deltaData.empty() && firstId <= maxId) {
+			for(; i<count && firstId+i<=maxId; ++i) {
+				memcpy(StageValue(firstId+i), src+i*valueStride, copySize);
+			}
+		}
+		if(i == count)
+			return;
+		if(firstId+count > stagedSlots.size()) {
+			GrowStagedSlots(firstId+count);
+		}
 		uint32_t p = deltaData.size();
-		if(it != whereSomethingWasUpdated.end()) {
-			p = it->second;
-		} else {
-			deltaData.resize(p+UPDATE_STRUCUTRE_SIZE);
-			whereSomethingWasUpdated[id] = p;
+		deltaData.resize(p + (count-i)*UPDATE_STRUCUTRE_SIZE);
+		for(; i<count; ++i, p+=UPDATE_STRUCUTRE_SIZE) {
+			const uint32_t id = firstId+i;
+			memcpy(&(deltaData[p]), src+i*valueStride, copySize);
+			*(uint32_t*)&(deltaData[p+ELEMENT_SIZE]) = id;
+			stagedSlots[id] = p/UPDATE_STRUCUTRE_SIZE + 1;
+		}
+		maxId = std::max(maxId, firstId+count-1);
+	}
+	
+	void UntypedManagedSparselyUpdatedVBO::SetValues(const void* values,
+			uint32_t valueStride, const uint32_t* ids, uint32_t count) {
+		const uint8_t* src = (const uint8_t*)values;
+		const uint32_t copySize = valueStride ? std::min(valueStride,
+				ELEMENT_SIZE) : ELEMENT_SIZE;
+		ReserveUpdates(count);
+		for(uint32_t i=0; i<count; ++i) {
+			if(ids[i] != 0xFFFFFFFF) {
+				memcpy(StageValue(ids[i]), src+i*valueStride, copySize);
+			}
 		}
-		memcpy(&(deltaData[p]), value, ELEMENT_SIZE);
-		*(uint32_t*)&(deltaData[p+ELEMENT_SIZE]) = id;
-		maxId = std::max(maxId, id);
+	}
+	
+	void UntypedManagedSparselyUpdatedVBO::ReserveUpdates(
+			uint32_t additionalUpdates) {
+		deltaData.reserve(deltaData.size()
+				+ additionalUpdates*UPDATE_STRUCUTRE_SIZE);
 	}
 
+	void UntypedManagedSparselyUpdatedVBO::CopyFrom(
+			UntypedManagedSparselyUpdatedVBO& src, const uint32_t* srcIds,
+			uint32_t count, uint32_t dstFirstId) {
+		if(src.ELEMENT_SIZE != ELEMENT_SIZE) {
+			throw "qgl::UntypedManagedSparselyUpdatedVBO::CopyFrom() element sizes differ.";
+		}
+		if(count == 0)
+			return;
+		EnsureCapacity(dstFirstId+count);
+		// consecutive source ids are copied at once
+		const uint32_t vs = src.vbo->VertexSize();
+		for(uint32_t i=0; i<count;) {
+			uint32_t run = 1;
+			while(i+run < count && srcIds[i+run] == srcIds[i]+run) {
+				++run;
+			}
+			vbo->Copy(src.vbo, srcIds[i]*vs, (dstFirstId+i)*vs, run*vs);
+			i += run;
+		}
+		
+		if(src.deltaData.empty())
+			return;
+		for(uint32_t i=0; i<count; ++i) {
+			const uint32_t id = srcIds[i];
+			if(id < src.stagedSlots.size() && src.stagedSlots[id]) {
+				memcpy(StageValue(dstFirstId+i),
+						&(src.deltaData[(src.stagedSlots[id]-1)
+							*UPDATE_STRUCUTRE_SIZE]), ELEMENT_SIZE);
+			}
+		}
+	}
+	
 	uint32_t UntypedManagedSparselyUpdatedVBO::Count() const {
 		return vbo->GetVertexCount();
 	}
-}
+	
+	
+	
+	ManagedSparselyUpdatedVBOGroup::ManagedSparselyUpdatedVBOGroup(
+			std::shared_ptr<Engine> engine) : engine(engine) {
+		shader = nullptr;
+	}
+	
+	ManagedSparselyUpdatedVBOGroup::~ManagedSparselyUpdatedVBOGroup() {
+		Destroy();
+	}
+	
+	void ManagedSparselyUpdatedVBOGroup::Add(
+			UntypedManagedSparselyUpdatedVBO* vbo) {
+		if(buffers.size() >= MAX_BUFFERS) {
+			throw "qgl::ManagedSparselyUpdatedVBOGroup::Add() too many buffers in group.";
+		}
+		buffers.emplace_back(vbo);
+		if(shader) {
+			delete shader;
+			shader = nullptr;
+		}
+	}
+	
+	void ManagedSparselyUpdatedVBOGroup::Destroy() {
+		if(shader) {
+			gl::Finish();
+			delete shader;
+			shader = nullptr;
+		}
+		buffers.clear();
+		records.clear();
+		recordOfId.clear();
+	}
+	
+	void ManagedSparselyUpdatedVBOGroup::CompileShader() {
+		// Delta stream of n records starts with n word offsets of records.
+		// Record is: id, mask of updated buffers, values of updated buffers.
+		std::string source = R"(#version 420 core
+#extension GL_ARB_compute_shader : require
+#extension GL_ARB_shader_storage_buffer_object : require
+
+layout (std430, binding=1) readonly buffer updateData {
+	uint words[];
+};
+)";
+		std::string body;
+		for(uint32_t k=0; k<buffers.size(); ++k) {
+			const std::string K = std::to_string(k);
+			const std::string W = std::to_string(buffers[k]->ELEMENT_SIZE/4);
+			source += "layout (std430, binding=" + std::to_string(k+2)
+				+ ") writeonly buffer dataBuffer" + K + " {\n\tuint data" + K
+				+ "[];\n};\n";
+			body += "\tif((mask & " + std::to_string(1u<<k) + "u) != 0u) {\n"
+				"\t\tfor(uint i=0; i<" + W + "u; ++i)\n"
+				"\t\t\tdata" + K + "[id*" + W + "u+i] = words[p+i];\n"
+				"\t\tp += " + W + "u;\n"
+				"\t}\n";
+		}
+		source += R"(
+layout (local_size_x = 256, local_size_y = 1, local_size_z = 1) in;
+
+uniform uint recordsCount;
 
+void main() {
+	uint self = gl_GlobalInvocationID.x;
+	if(self >= recordsCount)
+		return;
+	uint p = words[self];
+	uint id = words[p];
+	uint mask = words[p+1];
+	p += 2;
+)" + body + "}\n";
+		shader = new gl::Shader();
+		if(shader->Compile(source))
+			exit(31);
+		shaderRecordsCountLocation = shader->GetUniformLocation("recordsCount");
+	}
+	
+	void ManagedSparselyUpdatedVBOGroup::UpdateVBOs() {
+		records.clear();
+		uint32_t scattered[MAX_BUFFERS];
+		uint32_t scatteringBuffers = 0, lastScattering = 0;
+		for(uint32_t k=0; k<buffers.size(); ++k) {
+			scattered[k] = buffers[k]->PrepareUpdate();
+			if(scattered[k]) {
+				++scatteringBuffers;
+				lastScattering = k;
+			}
+		}
+		
+		// single buffer does not need record headers of packed stream
+		if(scatteringBuffers == 1) {
+			UntypedManagedSparselyUpdatedVBO* b = buffers[lastScattering];
+			b->UploadScattered(b->ScatteredEntries(), scattered[lastScattering]);
+			scatteringBuffers = 0;
+		}
+		
+		for(uint32_t k=0; k<buffers.size() && scatteringBuffers; ++k) {
+			UntypedManagedSparselyUpdatedVBO* b = buffers[k];
+			const uint32_t count = scattered[k];
+			const uint32_t words = b->ELEMENT_SIZE/4;
+			for(uint32_t i=0; i<count; ++i) {
+				const uint32_t entry = b->ScatteredEntry(i);
+				const uint32_t id = b->StagedId(entry);
+				if(id >= recordOfId.size()) {
+					recordOfId.resize(std::max<size_t>(id+1,
+								(recordOfId.size()*3)/2 + 64), 0);
+				}
+				uint32_t& r = recordOfId[id];
+				if(r == 0) {
+					records.push_back({id, 0, 2});
+					r = records.size();
+				}
+				Record& rec = records[r-1];
+				rec.mask |= 1u<<k;
+				rec.entries[k] = entry;
+				rec.words += words;
+			}
+		}
+		
+		if(!records.empty()) {
+			if(shader == nullptr) {
+				CompileShader();
+			}
+			uint64_t remainingBytes = 0;
+			for(const Record& rec : records) {
+				remainingBytes += (rec.words+1)*sizeof(uint32_t);
+			}
+			shader->Use();
+			for(uint32_t k=0; k<buffers.size(); ++k) {
+				buffers[k]->Vbo().BindBufferBase(gl::SHADER_STORAGE_BUFFER,
+						k+2);
+			}
+			for(uint32_t i=0; i<records.size(); ) {
+				DeltaVboManager::Region region = engine->GetDeltaVboManager()
+					->Allocate(std::min<uint64_t>(remainingBytes, 0xFFFFFFFF),
+							sizeof(uint32_t));
+				const uint32_t capacity = region.size/sizeof(uint32_t);
+				
+				// count records fitting into region with their offsets
+				uint32_t n = 0, used = 0;
+				while(i+n < records.size()
+						&& n+1 + used + records[i+n].words <= capacity) {
+					used += records[i+n].words;
+					++n;
+				}
+				if(n == 0) {
+					throw "qgl::ManagedSparselyUpdatedVBOGroup::UpdateVBOs() delta segment too small for single record.";
+				}
+				
+				uint32_t* words = (uint32_t*)region.data;
+				uint32_t p = n;
+				for(uint32_t j=0; j<n; ++j) {
+					const Record& rec = records[i+j];
+					words[j] = p;
+					words[p] = rec.id;
+					words[p+1] = rec.mask;
+					p += 2;
+					for(uint32_t k=0; k<buffers.size(); ++k) {
+						if(rec.mask & (1u<<k)) {
+							UntypedManagedSparselyUpdatedVBO* b = buffers[k];
+							memcpy(words+p, b->deltaData.data()
+									+ rec.entries[k]*b->UPDATE_STRUCUTRE_SIZE,
+									b->ELEMENT_SIZE);
+							p += b->ELEMENT_SIZE/4;
+						}
+					}
+					remainingBytes -= (rec.words+1)*sizeof(uint32_t);
+				}
+				
+				shader->SetUInt(shaderRecordsCountLocation, n);
+				region.BindBufferRange(1);
+				shader->DispatchRoundGroupNumbers(n, 1, 1);
+				i += n;
+			}
+			gl::Shader::Unuse();
+			
+			for(const Record& rec : records) {
+				recordOfId[rec.id] = 0;
+			}
+			records.clear();
+		}
+		
+		for(UntypedManagedSparselyUpdatedVBO* b : buffers) {
+			b->FinishUpdate();
+		}
+	}
+}
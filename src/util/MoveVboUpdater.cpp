@@ -16,6 +16,10 @@
  *  along with this program.  If not, see <https://www.gnu.org/licenses/>.
  */
 
+#include <cstring>
+
+#include <algorithm>
+
 #include "../../OpenGLWrapper/include/openglwrapper/VBO.hpp"
 #include "../../OpenGLWrapper/include/openglwrapper/OpenGL.hpp"
 #include "../../OpenGLWrapper/include/openglwrapper/Shader.hpp"
@@ -87,15 +91,14 @@ void main() {
 		shader->Use();
 		vbo->BindBufferBase(gl::SHADER_STORAGE_BUFFER, 2);
 		for(uint32_t i=0; i<elements;) {
-			auto deltaVbo = engine->GetDeltaVboManager()->GetNextUpdateVBO();
-			const uint32_t elem = std::min<uint32_t>(
-					deltaVbo->GetVertexCount()/sizeof(PairMove), elements-i);
+			DeltaVboManager::Region region = engine->GetDeltaVboManager()
+				->Allocate((elements-i)*sizeof(PairMove), sizeof(PairMove));
+			const uint32_t elem = region.size/sizeof(PairMove);
 			
-			deltaVbo->Update(data+i, 0, elem*sizeof(PairMove));
-			gl::MemoryBarrier(gl::BUFFER_UPDATE_BARRIER_BIT);
+			memcpy(region.data, data+i, elem*sizeof(PairMove));
 			
 			shader->SetUInt(updateElementsCountLocation, elem);
-			deltaVbo->BindBufferBase(gl::SHADER_STORAGE_BUFFER, 1);
+			region.BindBufferRange(1);
 			shader->DispatchRoundGroupNumbers(elem, 1, 1);
 			
 			i += elem;
@@ -103,17 +106,98 @@ void main() {
 		shader->Unuse();
 	}
 	
-	void MoveVboUpdater::Update(gl::VBO* vbo, gl::VBO* deltaVbo, uint32_t elements) {
+	void MoveVboUpdater::Update(gl::VBO* vbo,
+			const DeltaVboManager::Region& deltaRegion, uint32_t elements) {
 		shader->Use();
 		shader->SetUInt(updateElementsCountLocation, elements);
-		deltaVbo->BindBufferBase(gl::SHADER_STORAGE_BUFFER, 1);
+		deltaRegion.BindBufferRange(1);
 		vbo->BindBufferBase(gl::SHADER_STORAGE_BUFFER, 2);
 		shader->DispatchRoundGroupNumbers(elements, 1, 1);
 		shader->Unuse();
 	}
+	
+	
+	
+	MoveMultiVboUpdater::MoveMultiVboUpdater(std::shared_ptr<Engine> engine,
+			const std::vector<uint32_t>& bytes) :
+		BYTES(bytes), engine(engine) {
+	}
+	
+	MoveMultiVboUpdater::~MoveMultiVboUpdater() {
+		Destroy();
+	}
+	
+	void MoveMultiVboUpdater::Init() {
+		if(BYTES.size() == 0 || BYTES.size() > MAX_BUFFERS) {
+			throw "qgl::MoveMultiVboUpdater::Init() invalid number of buffers.";
+		}
+		
+		shader = std::make_shared<gl::Shader>();
+		
+		std::string buffers, moves;
+		for(uint32_t i=0; i<BYTES.size(); ++i) {
+			if(BYTES[i] % 4) {
+				throw "qgl::MoveMultiVboUpdater::Init() cannot initialize with BYTES not dividible by 4.";
+			}
+			const std::string I = std::to_string(i);
+			const std::string W = std::to_string(BYTES[i]/4);
+			buffers += "layout (std430, binding=" + std::to_string(i+2)
+				+ ") buffer dataBuffer" + I + " {\n\tuint data" + I
+				+ "[];\n};\n";
+			moves += "\tfor(uint i=0; i<" + W + "u; ++i)\n"
+				"\t\tdata" + I + "[delta.to*" + W + "u+i] = data" + I
+				+ "[delta.from*" + W + "u+i];\n";
+		}
 		
+		const std::string shaderSource = std::string(R"(#version 420 core
+#extension GL_ARB_compute_shader : require
+#extension GL_ARB_shader_storage_buffer_object : require
+struct DeltaData {
+	uint from;
+	uint to;
+};
 
+layout (std430, binding=1) readonly buffer updateData {
+	DeltaData deltaData[];
+};
+)") + buffers + R"(
+layout (local_size_x = 64, local_size_y = 1, local_size_z = 1) in;
 
+uniform uint updateElementsCount;
+
+void main() {
+	uint self = gl_GlobalInvocationID.x;
+	if(self >= updateElementsCount)
+		return;
+	DeltaData delta = deltaData[self];
+)" + moves + "}";
+		
+		shader->Compile(shaderSource);
+		updateElementsCountLocation = shader
+			->GetUniformLocation("updateElementsCount");
+	}
+	
+	void MoveMultiVboUpdater::Destroy() {
+		if(shader) {
+			shader->Destroy();
+			shader = nullptr;
+		}
+	}
+	
+	void MoveMultiVboUpdater::Update(gl::VBO* const* vbos,
+			const DeltaVboManager::Region& deltaRegion, uint32_t elements) {
+		shader->Use();
+		shader->SetUInt(updateElementsCountLocation, elements);
+		deltaRegion.BindBufferRange(1);
+		for(uint32_t i=0; i<BYTES.size(); ++i) {
+			vbos[i]->BindBufferBase(gl::SHADER_STORAGE_BUFFER, i+2);
+		}
+		shader->DispatchRoundGroupNumbers(elements, 1, 1);
+		shader->Unuse();
+	}
+	
+	
+	
 	MoveVboManager::MoveVboManager(std::shared_ptr<Engine> engine) : engine(engine) {
 	}
 
@@ -126,6 +210,10 @@ void main() {
 			u.second->Destroy();
 		}
 		updatersByElementSizeSize.clear();
+		for(auto u : multiUpdatersByElementSizes) {
+			u.second->Destroy();
+		}
+		multiUpdatersByElementSizes.clear();
 	}
 	
 	std::shared_ptr<MoveVboUpdater> MoveVboManager::GetByObjectSize(
@@ -149,10 +237,35 @@ void main() {
 		updater->Update(vbo, data, elements);
 	}
 	
-	void MoveVboManager::Update(gl::VBO* vbo, gl::VBO* deltaVbo, uint32_t elements,
+	void MoveVboManager::Update(gl::VBO* vbo,
+			const DeltaVboManager::Region& deltaRegion, uint32_t elements,
 			uint32_t elementSize) {
 		auto updater = GetByObjectSize(elementSize);
-		updater->Update(vbo, deltaVbo, elements);
+		updater->Update(vbo, deltaRegion, elements);
+	}
+	
+	void MoveVboManager::Update(gl::VBO* const* vbos, uint32_t vbosCount,
+			const DeltaVboManager::Region& deltaRegion, uint32_t elements) {
+		for(uint32_t i=0; i<vbosCount; i+=MoveMultiVboUpdater::MAX_BUFFERS) {
+			const uint32_t n = std::min(vbosCount-i,
+					MoveMultiVboUpdater::MAX_BUFFERS);
+			if(n == 1) {
+				Update(vbos[i], deltaRegion, elements, vbos[i]->VertexSize());
+				continue;
+			}
+			std::vector<uint32_t> bytes(n);
+			std::string key;
+			for(uint32_t j=0; j<n; ++j) {
+				bytes[j] = vbos[i+j]->VertexSize();
+				key += std::to_string(bytes[j]) + ",";
+			}
+			std::shared_ptr<MoveMultiVboUpdater>& updater
+				= multiUpdatersByElementSizes[key];
+			if(updater == nullptr) {
+				updater = std::make_shared<MoveMultiVboUpdater>(engine, bytes);
+				updater->Init();
+			}
+			updater->Update(vbos+i, deltaRegion, elements);
+		}
 	}
 }
-
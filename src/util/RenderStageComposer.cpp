@@ -20,9 +20,11 @@
 #include <set>
 
 #include "../../OpenGLWrapper/include/openglwrapper/OpenGL.hpp"
+#include "../../OpenGLWrapper/include/openglwrapper/Sync.hpp"
 
 #include "../../include/quickgl/cameras/Camera.hpp"
 #include "../../include/quickgl/pipelines/Pipeline.hpp"
+#include "../../include/quickgl/util/FrameTaskGraph.hpp"
 
 #include "../../include/quickgl/util/RenderStageComposer.hpp"
 
@@ -53,6 +55,12 @@ namespace qgl {
 		return true;
 	}
 	
+	gl::Sync* Stage::GetPendingSync(std::shared_ptr<Camera> camera) {
+		if(pendingSync)
+			return (pipeline.get()->*(pendingSync))(camera);
+		return nullptr;
+	}
+	
 	
 	
 	void PipelineStagesScheduler::Init(std::shared_ptr<Pipeline> pipeline) {
@@ -91,8 +99,33 @@ namespace qgl {
 		return GetNextStage() != nullptr;
 	}
 	
+	bool PipelineStagesScheduler::HasPendingStage(const std::string& name) {
+		for(uint32_t i=nextGlobalStage; i<globalStages.size(); ++i) {
+			if(globalStages[i]->name == name) {
+				return true;
+			}
+		}
+		if(renderStageComposer->GetCameraByIndex(currentCameraId) == nullptr) {
+			return false;
+		}
+		const uint32_t first = nextGlobalStage < globalStages.size() ? 0
+			: nextPerCameraStage;
+		const bool hasNextCamera = renderStageComposer
+			->GetCameraByIndex(currentCameraId+1) != nullptr;
+		for(uint32_t i=0; i<perCameraStages.size(); ++i) {
+			if(perCameraStages[i]->name == name
+					&& (i >= first || hasNextCamera)) {
+				return true;
+			}
+		}
+		return false;
+	}
+	
 	bool PipelineStagesScheduler::CanExecuteNextStage() {
 		auto stage = GetNextStage();
+		if(renderStageComposer->IsStageBlockedByJobs(stage->name)) {
+			return false;
+		}
 		bool ret = stage->CanExecute(currentCamera);
 		if(currentCamera && ret
 				&& stage->executionPolicy & STAGE_SYNC_AFTER_OTHER_MATERIALS_CURRENT_CAMERA) {
@@ -143,6 +176,7 @@ namespace qgl {
 		nextPerCameraStage = 0;
 		currentCameraId = 0;
 		currentCamera = nullptr;
+		lastExecutionIndex = 0;
 	}
 	
 	std::shared_ptr<Stage> PipelineStagesScheduler::GetNextStage() {
@@ -161,6 +195,9 @@ namespace qgl {
 	
 	RenderStageComposer::RenderStageComposer() {
 		enableGlFinishInEveryStageToProfile = false;
+		totalCpuTime = 0;
+		totalWaitTime = 0;
+		executedStagesCount = 0;
 	}
 	
 	void RenderStageComposer::AddPipeline(std::shared_ptr<Pipeline> pipeline) {
@@ -192,10 +229,17 @@ namespace qgl {
 	void RenderStageComposer::ResetExecution() {
 		auto start = std::chrono::steady_clock::now();
 		timings.clear();
+		waits.clear();
+		totalWaitTime = 0;
+		executedStagesCount = 0;
 		RenderAsLast(lastRenderCamera);
 		for(auto p : pipelines) {
 			p->GetStageScheduler().RestartExecution(this);
 		}
+		if(frameTaskGraph) {
+			frameTaskGraph->BeginFrame();
+			frameTaskGraph->UpdateStageDependencies(this);
+		}
 		hasAnyStagesLeft = true;
 		auto end = std::chrono::steady_clock::now();
 		totalCpuTime =
@@ -220,6 +264,7 @@ namespace qgl {
 					auto stage = s.GetNextStage();
 					timings.back().Start(stage);
 					s.ExecuteNextStage();
+					s.lastExecutionIndex = ++executedStagesCount;
 					executedAny = true;
 					if(this->enableGlFinishInEveryStageToProfile) {
 						gl::Finish();
@@ -230,6 +275,9 @@ namespace qgl {
 			}
 		}
 		gl::Flush();
+		if(executedAny && frameTaskGraph) {
+			frameTaskGraph->UpdateStageDependencies(this);
+		}
 		auto end = std::chrono::steady_clock::now();
 		totalCpuTime +=
 				std::chrono::duration_cast<
@@ -242,6 +290,48 @@ namespace qgl {
 		return hasAnyStagesLeft;
 	}
 	
+	bool RenderStageComposer::WaitForBlockedStages(int64_t maxWaitNanoseconds) {
+		gl::Sync* sync = nullptr;
+		std::shared_ptr<Stage> blockedStage;
+		std::shared_ptr<Camera> blockedCamera;
+		uint64_t earliest = 0;
+		for(auto p : pipelines) {
+			PipelineStagesScheduler& s = p->GetStageScheduler();
+			auto stage = s.GetNextStage();
+			// waiting for fence would not unblock stage waiting for jobs
+			if(stage == nullptr || IsStageBlockedByJobs(stage->name)) {
+				continue;
+			}
+			gl::Sync* pending = stage->GetPendingSync(s.GetCurrentCamera());
+			if(pending && (sync == nullptr || s.lastExecutionIndex < earliest)) {
+				sync = pending;
+				blockedStage = stage;
+				blockedCamera = s.GetCurrentCamera();
+				earliest = s.lastExecutionIndex;
+			}
+		}
+		if(sync == nullptr) {
+			return false;
+		}
+		
+		auto start = std::chrono::steady_clock::now();
+		sync->WaitClient(maxWaitNanoseconds);
+		auto end = std::chrono::steady_clock::now();
+		const double seconds =
+				std::chrono::duration_cast<
+					std::chrono::duration<double>>(
+							end - start).count();
+		totalWaitTime += seconds;
+		// consecutive bounded waits for the same stage are reported once
+		if(!waits.empty() && waits.back().stage == blockedStage
+				&& waits.back().camera == blockedCamera) {
+			waits.back().waitedSeconds += seconds;
+		} else {
+			waits.push_back({blockedStage, blockedCamera, seconds});
+		}
+		return true;
+	}
+	
 	bool RenderStageComposer::CanExecuteSyncStage(uint32_t cameraId,
 			StageOrder stage) {
 		for(auto p : pipelines) {
@@ -262,6 +352,47 @@ namespace qgl {
 		return true;
 	}
 	
+	void RenderStageComposer::SetFrameTaskGraph(
+			std::shared_ptr<FrameTaskGraph> frameTaskGraph) {
+		this->frameTaskGraph = frameTaskGraph;
+	}
+	
+	bool RenderStageComposer::ExecuteCpuJob() {
+		if(frameTaskGraph) {
+			return frameTaskGraph->ExecuteOne();
+		}
+		return false;
+	}
+	
+	bool RenderStageComposer::WaitForCpuJob(int64_t maxWaitNanoseconds) {
+		if(frameTaskGraph) {
+			return frameTaskGraph->WaitForJob(maxWaitNanoseconds);
+		}
+		return false;
+	}
+	
+	void RenderStageComposer::EndFrame() {
+		if(frameTaskGraph) {
+			frameTaskGraph->EndFrame();
+		}
+	}
+	
+	bool RenderStageComposer::IsStageFinished(const std::string& name) {
+		for(auto p : pipelines) {
+			if(p->GetStageScheduler().HasPendingStage(name)) {
+				return false;
+			}
+		}
+		return true;
+	}
+	
+	bool RenderStageComposer::IsStageBlockedByJobs(const std::string& name) {
+		if(frameTaskGraph) {
+			return frameTaskGraph->IsStageBlocked(name);
+		}
+		return false;
+	}
+	
 	std::shared_ptr<Camera> RenderStageComposer::GetCameraByIndex(uint32_t id) {
 		if(id < cameras.size()) {
 			return cameras[id];
@@ -280,15 +411,26 @@ namespace qgl {
 	double RenderStageComposer::GetTotalCpuTime() const {
 		return totalCpuTime;
 	}
+	
+	std::vector<StageWait> RenderStageComposer::GetWaits() const {
+		return waits;
+	}
+	
+	double RenderStageComposer::GetTotalWaitTime() const {
+		return totalWaitTime;
+	}
 		
 	void RenderStageComposer::Destroy() {
 		lastRenderCamera = nullptr;
 		timings.clear();
+		waits.clear();
 		
 		mapCurrentCameraIdToPipelines.clear();
 		
 		cameras.clear();
 		pipelines.clear();
+		
+		frameTaskGraph = nullptr;
 	}
 }
 
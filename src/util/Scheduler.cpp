@@ -16,35 +16,180 @@
  *  along with this program.  If not, see <https://www.gnu.org/licenses/>.
  */
 
-#include "../../include/quickgl/util/Scheduler.hpp"
-
 #include <thread>
+#include <chrono>
+
+#include "../../include/quickgl/util/Scheduler.hpp"
 
 namespace qgl {
 	
+	thread_local Scheduler* Scheduler::currentScheduler = nullptr;
+	thread_local uint32_t Scheduler::currentWorker = Scheduler::NO_WORKER;
+	
+	Scheduler::Scheduler(uint32_t workersCount) :
+		nextWorker(0), pendingTasks(0), sleepingWorkers(0), stopping(false),
+		started(false) {
+		if(workersCount == 0) {
+			workersCount = std::max(1u, std::thread::hardware_concurrency());
+		}
+		workers.resize(workersCount);
+		for(auto& w : workers) {
+			w = std::make_unique<Worker>();
+		}
+	}
+	
+	Scheduler::~Scheduler() {
+		Stop();
+	}
+	
+	void Scheduler::Start() {
+		if(started) {
+			return;
+		}
+		started = true;
+		stopping = false;
+		for(uint32_t i=0; i<workers.size(); ++i) {
+			workers[i]->thread = std::thread(&Scheduler::WorkerLoop, this, i);
+		}
+	}
+	
+	void Scheduler::Stop() {
+		if(!started) {
+			return;
+		}
+		stopping = true;
+		WakeAllWorkers();
+		for(auto& w : workers) {
+			if(w->thread.joinable()) {
+				w->thread.join();
+			}
+		}
+		started = false;
+	}
+	
 	void Scheduler::Run() {
-		while(true) {
+		Start();
+		while(!stopping) {
 			if(ExecuteOne() == false) {
-				std::this_thread::yield();
+				Park();
 			}
 		}
 	}
 	
 	bool Scheduler::ExecuteOne() {
-		if(priorityEvents.HasAnyEvents()) {
-			if(priorityEvents.ExecuteOneEvent()) {
+		return ExecuteOne(currentScheduler == this ? currentWorker : NO_WORKER);
+	}
+	
+	void Scheduler::PushTask(Task&& task, uint32_t lane) {
+		uint32_t target = currentWorker;
+		if(currentScheduler != this) {
+			target = nextWorker.fetch_add(1, std::memory_order_relaxed)
+				% workers.size();
+		}
+		{
+			Worker& w = *workers[target];
+			std::lock_guard lock(w.mutex);
+			w.lanes[lane].emplace_back(std::move(task));
+		}
+		// Parking worker increments sleepingWorkers before checking
+		// pendingTasks, so at least one of both sides sees the other.
+		pendingTasks.fetch_add(1);
+		WakeOneWorker();
+	}
+	
+	bool Scheduler::PopTask(uint32_t self, uint32_t lane, Task& task) {
+		if(self != NO_WORKER) {
+			Worker& w = *workers[self];
+			std::lock_guard lock(w.mutex);
+			if(!w.lanes[lane].empty()) {
+				task = std::move(w.lanes[lane].back());
+				w.lanes[lane].pop_back();
 				return true;
 			}
 		}
-		if(delayedEvents.ExecuteOneEvent()) {
-			return true;
-		}
-		if(regularEvents.HasAnyEvents()) {
-			if(regularEvents.ExecuteOneEvent()) {
+		
+		const uint32_t count = workers.size();
+		const uint32_t first = self != NO_WORKER ? self+1
+			: nextWorker.load(std::memory_order_relaxed);
+		for(uint32_t i=0; i<count; ++i) {
+			const uint32_t victim = (first+i) % count;
+			if(victim == self) {
+				continue;
+			}
+			Worker& w = *workers[victim];
+			std::lock_guard lock(w.mutex);
+			if(!w.lanes[lane].empty()) {
+				task = std::move(w.lanes[lane].front());
+				w.lanes[lane].pop_front();
 				return true;
 			}
 		}
 		return false;
 	}
+	
+	bool Scheduler::ExecuteOne(uint32_t self) {
+		Task task;
+		bool found = false;
+		if(pendingTasks.load(std::memory_order_relaxed) != 0) {
+			found = PopTask(self, LANE_PRIORITY, task);
+		}
+		if(!found && delayedEvents.HasAnyEvents()) {
+			if(delayedEvents.ExecuteExpiredEvents(DELAYED_EVENTS_BATCH) != 0) {
+				return true;
+			}
+		}
+		if(!found && pendingTasks.load(std::memory_order_relaxed) != 0) {
+			found = PopTask(self, LANE_REGULAR, task);
+		}
+		if(!found) {
+			return false;
+		}
+		pendingTasks.fetch_sub(1, std::memory_order_relaxed);
+		task();
+		return true;
+	}
+	
+	void Scheduler::WorkerLoop(uint32_t self) {
+		currentScheduler = this;
+		currentWorker = self;
+		while(!stopping) {
+			if(ExecuteOne(self) == false) {
+				Park();
+			}
+		}
+		currentScheduler = nullptr;
+		currentWorker = NO_WORKER;
+	}
+	
+	void Scheduler::Park() {
+		std::unique_lock lock(parkMutex);
+		sleepingWorkers.fetch_add(1);
+		auto deadline = delayedEvents.GetNextEventTime();
+		while(pendingTasks.load() == 0 && !stopping
+				&& std::chrono::steady_clock::now() < deadline) {
+			if(deadline == std::chrono::steady_clock::time_point::max()) {
+				parkCondition.wait(lock);
+			} else {
+				parkCondition.wait_until(lock, deadline);
+			}
+			deadline = delayedEvents.GetNextEventTime();
+		}
+		sleepingWorkers.fetch_sub(1);
+	}
+	
+	void Scheduler::WakeOneWorker() {
+		if(sleepingWorkers.load() != 0) {
+			{
+				std::lock_guard lock(parkMutex);
+			}
+			parkCondition.notify_one();
+		}
+	}
+	
+	void Scheduler::WakeAllWorkers() {
+		{
+			std::lock_guard lock(parkMutex);
+		}
+		parkCondition.notify_all();
+	}
 }
-
@@ -0,0 +1,46 @@
+
+#ifndef QUICKGL_BENCHMARK_HPP
+#define QUICKGL_BENCHMARK_HPP
+
+#include <cstdio>
+#include <cinttypes>
+
+#include <chrono>
+#include <vector>
+
+struct BenchmarkInfo {
+	char const* suite;
+	char const* name;
+	uint64_t operations;
+	double seconds;
+	
+	inline void Print() const {
+		printf("  %-24s %-40s %10.3f ms  %8.2f Mop/s\n", suite, name,
+				seconds*1000.0, operations/seconds/1000000.0);
+		fflush(stdout);
+	}
+};
+
+extern std::vector<BenchmarkInfo> benchmarksInfos;
+
+/*
+ * Results are accumulated here so that compiler cannot remove benchmarked
+ * code.
+ */
+extern volatile uint64_t benchmarkSink;
+
+template<typename F>
+inline static double Benchmark(char const* suite, char const* name,
+		uint64_t operations, F&& func) {
+	auto start = std::chrono::steady_clock::now();
+	func();
+	auto end = std::chrono::steady_clock::now();
+	BenchmarkInfo info{suite, name, operations,
+		std::chrono::duration<double>(end-start).count()};
+	info.Print();
+	benchmarksInfos.push_back(info);
+	return info.seconds;
+}
+
+#endif
+
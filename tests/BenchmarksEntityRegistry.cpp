@@ -0,0 +1,107 @@
+#include <cstdio>
+#include <cstdlib>
+
+#include <vector>
+#include <unordered_map>
+#include <random>
+#include <algorithm>
+
+#include "../include/quickgl/util/EntityRegistry.hpp"
+
+#include "Benchmark.hpp"
+
+namespace BenchmarksEntityRegistry {
+	
+	/*
+	 * Previous std::unordered_map based storage of GlobalEntityManager, kept
+	 * as a baseline.
+	 */
+	class ReferenceMapRegistry {
+	public:
+		
+		struct PipelineOffsetPair {
+			uint32_t offset;
+			uint32_t pipelineId;
+		};
+		
+		uint32_t Create(uint32_t pipelineId, uint32_t offset) {
+			uint32_t entity = 0;
+			for(;;) {
+				entity = ++lastAddedEntity;
+				if(entity == 0)
+					continue;
+				if(mapEntity.find(entity) == mapEntity.end())
+					break;
+			}
+			mapEntity[entity] = {offset, pipelineId};
+			return entity;
+		}
+		
+		uint32_t GetOffset(uint32_t entity) const {
+			auto it = mapEntity.find(entity);
+			if(it == mapEntity.end())
+				return 0;
+			return it->second.offset;
+		}
+		
+		void Destroy(uint32_t entity) {
+			mapEntity.erase(entity);
+		}
+		
+	private:
+		
+		uint32_t lastAddedEntity = 0;
+		std::unordered_map<uint32_t, PipelineOffsetPair> mapEntity;
+	};
+	
+	const uint32_t ENTITIES = 1000000;
+	
+	template<typename T>
+	void create_lookup_delete(const char* suite) {
+		T registry;
+		std::vector<uint32_t> handles(ENTITIES);
+		
+		Benchmark(suite, "create 1M", ENTITIES, [&]() {
+			for(uint32_t i=0; i<ENTITIES; ++i) {
+				handles[i] = registry.Create(1, i);
+			}
+		});
+		
+		std::vector<uint32_t> shuffled = handles;
+		std::shuffle(shuffled.begin(), shuffled.end(), std::mt19937(12345));
+		
+		Benchmark(suite, "lookup 1M sequential", ENTITIES, [&]() {
+			uint64_t sum = 0;
+			for(uint32_t i=0; i<ENTITIES; ++i) {
+				sum += registry.GetOffset(handles[i]);
+			}
+			benchmarkSink += sum;
+		});
+		
+		Benchmark(suite, "lookup 1M random", ENTITIES, [&]() {
+			uint64_t sum = 0;
+			for(uint32_t i=0; i<ENTITIES; ++i) {
+				sum += registry.GetOffset(shuffled[i]);
+			}
+			benchmarkSink += sum;
+		});
+		
+		Benchmark(suite, "delete 1M random", ENTITIES, [&]() {
+			for(uint32_t i=0; i<ENTITIES; ++i) {
+				registry.Destroy(shuffled[i]);
+			}
+		});
+		
+		Benchmark(suite, "recreate 1M after delete", ENTITIES, [&]() {
+			for(uint32_t i=0; i<ENTITIES; ++i) {
+				handles[i] = registry.Create(1, i);
+			}
+		});
+	}
+	
+	void RunAll() {
+		create_lookup_delete<ReferenceMapRegistry>("unordered_map");
+		create_lookup_delete<qgl::EntityRegistry>("qgl::EntityRegistry");
+	}
+}
+
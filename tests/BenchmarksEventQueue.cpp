@@ -0,0 +1,101 @@
+#include <cstdio>
+#include <cstdlib>
+
+#include <vector>
+#include <queue>
+#include <mutex>
+#include <thread>
+#include <atomic>
+#include <functional>
+
+#include "../include/quickgl/util/EventQueue.hpp"
+
+#include "Benchmark.hpp"
+
+namespace BenchmarksEventQueue {
+	
+	/*
+	 * Previous mutex and std::function based EventQueue, kept as a baseline.
+	 * It supports only single consumer.
+	 */
+	class ReferenceMutexQueue {
+	public:
+		
+		template<typename... Args, typename Fn>
+		void PushEvent(Fn event, Args... args) {
+			std::function<void()> f = std::bind(event, args...);
+			std::lock_guard lock(mutex);
+			eventsQueue.push(f);
+		}
+		
+		bool ExecuteOneEvent() {
+			if(popedEvents.empty()) {
+				std::lock_guard lock(mutex);
+				std::swap(eventsQueue, popedEvents);
+			}
+			if(popedEvents.empty() == false) {
+				popedEvents.front()();
+				popedEvents.pop();
+				return true;
+			}
+			return false;
+		}
+		
+	private:
+		
+		std::queue<std::function<void()>> eventsQueue;
+		std::mutex mutex;
+		std::queue<std::function<void()>> popedEvents;
+	};
+	
+	const uint32_t EVENTS = 1000000;
+	
+	std::atomic<uint32_t> done;
+	
+	void Event(uint32_t a, uint64_t b) {
+		benchmarkSink += a + b;
+		done.fetch_add(1, std::memory_order_relaxed);
+	}
+	
+	template<typename T>
+	void producers(const char* suite, const char* name, uint32_t producers) {
+		T queue;
+		done = 0;
+		Benchmark(suite, name, EVENTS, [&]() {
+			std::vector<std::thread> threads;
+			const uint32_t perProducer = EVENTS / producers;
+			for(uint32_t p=0; p<producers; ++p) {
+				threads.emplace_back([&queue, perProducer, p]() {
+					for(uint32_t i=0; i<perProducer; ++i) {
+						queue.PushEvent(Event, i, (uint64_t)p);
+					}
+				});
+			}
+			const uint32_t total = perProducer * producers;
+			while(done.load(std::memory_order_relaxed) < total) {
+				if(!queue.ExecuteOneEvent()) {
+					std::this_thread::yield();
+				}
+			}
+			for(std::thread& t : threads) {
+				t.join();
+			}
+		});
+	}
+	
+	void RunAll() {
+		producers<ReferenceMutexQueue>("mutex+std::function",
+				"1M events, 1 producer", 1);
+		producers<ReferenceMutexQueue>("mutex+std::function",
+				"1M events, 4 producers", 4);
+		producers<ReferenceMutexQueue>("mutex+std::function",
+				"1M events, 16 producers", 16);
+		producers<qgl::EventQueue>("qgl::EventQueue",
+				"1M events, 1 producer", 1);
+		producers<qgl::EventQueue>("qgl::EventQueue",
+				"1M events, 4 producers", 4);
+		producers<qgl::EventQueue>("qgl::EventQueue",
+				"1M events, 16 producers", 16);
+	}
+}
+
@@ -0,0 +1,116 @@
+#include <cstdio>
+#include <cstdlib>
+
+#include <vector>
+#include <map>
+#include <random>
+#include <algorithm>
+
+#include "../include/quickgl/util/IdsManager.hpp"
+
+#include "Benchmark.hpp"
+
+namespace BenchmarksIdsManager {
+	
+	/*
+	 * Previous std::map based IdsManager, kept as a baseline.
+	 */
+	class ReferenceMapIdsManager {
+	public:
+		
+		uint32_t GetNewId() {
+			if(freeIdsStack.size()) {
+				uint32_t id = freeIdsStack.back();
+				freeIdsStack.pop_back();
+				mapIdToOffsetInArrayOfUsedIds[id] = arrayOfUsedIds.size();
+				arrayOfUsedIds.emplace_back(id);
+				return id;
+			}
+			uint32_t id = idsCount++;
+			mapIdToOffsetInArrayOfUsedIds[id] = arrayOfUsedIds.size();
+			arrayOfUsedIds.emplace_back(id);
+			return id;
+		}
+		
+		void FreeId(uint32_t id) {
+			freeIdsStack.emplace_back(id);
+			uint32_t offset = mapIdToOffsetInArrayOfUsedIds[id];
+			mapIdToOffsetInArrayOfUsedIds.erase(id);
+			if(offset != arrayOfUsedIds.size()-1) {
+				uint32_t movingId = arrayOfUsedIds.back();
+				arrayOfUsedIds[offset] = movingId;
+				mapIdToOffsetInArrayOfUsedIds[movingId] = offset;
+			}
+			arrayOfUsedIds.pop_back();
+		}
+		
+		void GetNewIds(uint32_t count, uint32_t* outIds) {
+			for(uint32_t i=0; i<count; ++i) {
+				outIds[i] = GetNewId();
+			}
+		}
+		
+		void FreeIds(const uint32_t* ids, uint32_t count) {
+			for(uint32_t i=0; i<count; ++i) {
+				FreeId(ids[i]);
+			}
+		}
+		
+	private:
+		
+		uint32_t idsCount = 0;
+		std::vector<uint32_t> freeIdsStack;
+		std::vector<uint32_t> arrayOfUsedIds;
+		std::map<uint32_t, uint32_t> mapIdToOffsetInArrayOfUsedIds;
+	};
+	
+	const uint32_t IDS = 1000000;
+	
+	template<typename T>
+	void churn(const char* suite) {
+		T mg;
+		std::vector<uint32_t> ids(IDS);
+		
+		Benchmark(suite, "allocate 1M one by one", IDS, [&]() {
+			for(uint32_t i=0; i<IDS; ++i) {
+				ids[i] = mg.GetNewId();
+			}
+		});
+		
+		std::shuffle(ids.begin(), ids.end(), std::mt19937(12345));
+		
+		Benchmark(suite, "free 1M random one by one", IDS, [&]() {
+			for(uint32_t i=0; i<IDS; ++i) {
+				mg.FreeId(ids[i]);
+			}
+		});
+		
+		Benchmark(suite, "allocate 1M bulk", IDS, [&]() {
+			mg.GetNewIds(IDS, ids.data());
+		});
+		
+		std::shuffle(ids.begin(), ids.end(), std::mt19937(54321));
+		
+		Benchmark(suite, "free 1M random bulk", IDS, [&]() {
+			mg.FreeIds(ids.data(), IDS);
+		});
+		
+		// steady state: half of ids alive, random frees and reallocations
+		mg.GetNewIds(IDS/2, ids.data());
+		std::mt19937 rng(777);
+		Benchmark(suite, "churn 1M free+allocate", IDS, [&]() {
+			for(uint32_t i=0; i<IDS; ++i) {
+				const uint32_t j = rng() % (IDS/2);
+				mg.FreeId(ids[j]);
+				ids[j] = mg.GetNewId();
+			}
+		});
+		benchmarkSink += ids[0];
+	}
+	
+	void RunAll() {
+		churn<ReferenceMapIdsManager>("std::map");
+		churn<qgl::IdsManager>("qgl::IdsManager");
+	}
+}
+
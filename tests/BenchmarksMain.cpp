@@ -0,0 +1,28 @@
+#include "Benchmark.hpp"
+
+std::vector<BenchmarkInfo> benchmarksInfos;
+volatile uint64_t benchmarkSink = 0;
+
+namespace BenchmarksEntityRegistry {
+	void RunAll();
+}
+namespace BenchmarksIdsManager {
+	void RunAll();
+}
+namespace BenchmarksScheduler {
+	void RunAll();
+}
+namespace BenchmarksEventQueue {
+	void RunAll();
+}
+
+int main() {
+	BenchmarksEntityRegistry::RunAll();
+	BenchmarksIdsManager::RunAll();
+	BenchmarksScheduler::RunAll();
+	BenchmarksEventQueue::RunAll();
+	
+	fflush(stdout);
+	return 0;
+}
+
@@ -0,0 +1,83 @@
+#include <cstdio>
+#include <cstdlib>
+
+#include <atomic>
+#include <thread>
+#include <deque>
+#include <string>
+
+#include "../include/quickgl/util/Scheduler.hpp"
+
+#include "Benchmark.hpp"
+
+namespace BenchmarksScheduler {
+	
+	const uint32_t TASKS = 1000000;
+	const uint32_t SPAWN_DEPTH = 19; // 2^20-1 tasks
+	
+	std::atomic<uint32_t> done;
+	qgl::Scheduler* scheduler;
+	
+	// benchmark names have to outlive benchmarksInfos
+	std::deque<std::string> names;
+	
+	void Work(uint32_t seed) {
+		uint32_t x = seed;
+		for(uint32_t i=0; i<200; ++i) {
+			x = x*1664525u + 1013904223u;
+		}
+		benchmarkSink += x & 1;
+		done.fetch_add(1, std::memory_order_relaxed);
+	}
+	
+	void Spawn(uint32_t depth) {
+		if(depth) {
+			scheduler->ScheduleTask(Spawn, depth-1);
+			scheduler->ScheduleTask(Spawn, depth-1);
+		}
+		Work(depth);
+	}
+	
+	void WaitFor(uint32_t count) {
+		while(done.load() < count) {
+			std::this_thread::yield();
+		}
+	}
+	
+	void throughput(uint32_t workers) {
+		names.emplace_back(std::to_string(workers) + " workers");
+		const char* suite = names.back().c_str();
+		
+		qgl::Scheduler s(workers);
+		scheduler = &s;
+		s.Start();
+		
+		done = 0;
+		Benchmark(suite, "1M tasks from single producer", TASKS, [&]() {
+			for(uint32_t i=0; i<TASKS; ++i) {
+				s.ScheduleTask(Work, i);
+			}
+			WaitFor(TASKS);
+		});
+		
+		done = 0;
+		const uint32_t spawned = (2u<<SPAWN_DEPTH) - 1;
+		Benchmark(suite, "1M tasks spawned recursively", spawned, [&]() {
+			s.ScheduleTask(Spawn, SPAWN_DEPTH);
+			WaitFor(spawned);
+		});
+		
+		s.Stop();
+		scheduler = nullptr;
+	}
+	
+	void RunAll() {
+		const uint32_t maxWorkers = std::max(1u,
+				std::thread::hardware_concurrency());
+		for(uint32_t w=1; w<maxWorkers; w*=2) {
+			throughput(w);
+		}
+		throughput(maxWorkers);
+	}
+}
+
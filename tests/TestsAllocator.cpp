@@ -4,6 +4,9 @@
 #include <cstdlib>
 
 #include <map>
+#include <set>
+#include <random>
+#include <algorithm>
 
 #include "../include/quickgl/util/Allocator.hpp"
 
@@ -19,6 +22,115 @@
 
 namespace TestsAllocator {
 	
+	/*
+	 * Previous first-fit std::map based implementation of qgl::Allocator, kept
+	 * as a reference to compare against.
+	 */
+	class ReferenceAllocator {
+	public:
+		
+		ReferenceAllocator(std::vector<uint64_t>* buffer) :
+			allocated(0), buffer(buffer) {}
+		
+		uint32_t Allocate(uint32_t size) {
+			if(freeRanges.size() == 0) {
+				ReserveAdditional(
+						std::max(std::max(size, allocated/2), 4096u));
+			} else {
+				for(auto it : freeRanges) {
+					if(it.second >= size) {
+						uint32_t offset = it.first;
+						uint32_t elements = it.second;
+						
+						freeRanges.erase(offset);
+						if(elements > size) {
+							freeRanges[offset+size] = elements-size;
+						}
+						
+						return offset;
+					}
+				}
+			
+				auto p = *freeRanges.rbegin();
+				if(p.first + p.second < allocated) {
+					ReserveAdditional(
+							std::max(std::max(size, allocated/2),
+								4096u));
+				} else {
+					ReserveAdditional(
+							std::max(std::max(size-p.second,
+									allocated), 4096u));
+				}
+			}
+			
+			auto it = freeRanges.rbegin();
+			uint32_t offset = it->first;
+			uint32_t r = it->second - size;
+			freeRanges.erase(it->first);
+			if(r > 0) {
+				freeRanges[offset+size] = r;
+			}
+			return offset;
+		}
+		
+		void Free(uint32_t pos, uint32_t size) {
+			freeRanges[pos] = size;
+			auto it = freeRanges.find(pos);
+			{
+				auto next = it; ++next;
+				if(next != freeRanges.end()) {
+					if(pos+size == next->first) {
+						it->second += next->second;
+						freeRanges.erase(next);
+						it = freeRanges.find(pos);
+					}
+				}
+			}
+			if(it != freeRanges.begin()) {
+				auto prev = it; --prev;
+				if(prev->first + prev->second == pos) {
+					prev->second += it->second;
+					freeRanges.erase(pos);
+				}
+			}
+		}
+		
+		void ReserveAdditional(uint32_t additionalElements) {
+			uint32_t prevSize = allocated;
+			uint32_t newSize = prevSize+additionalElements;
+			buffer->resize(newSize);
+			Free(prevSize, additionalElements);
+			allocated = newSize;
+		}
+		
+		std::map<uint32_t, uint32_t> freeRanges;
+		uint32_t allocated;
+		std::vector<uint64_t>* buffer;
+	};
+	
+	/*
+	 * Returns false if [offset, offset+size) overlaps any of live ranges or
+	 * exceeds capacity.
+	 */
+	bool InsertRange(std::map<uint32_t, uint32_t>& live, uint32_t offset,
+			uint32_t size, uint32_t capacity) {
+		if(offset+size > capacity) {
+			return false;
+		}
+		auto next = live.lower_bound(offset);
+		if(next != live.end() && next->first < offset+size) {
+			return false;
+		}
+		if(next != live.begin()) {
+			auto prev = next; --prev;
+			if(prev->first + prev->second > offset) {
+				return false;
+			}
+		}
+		live[offset] = size;
+		return true;
+	}
+	
 	void allocate_one_two() {
 		ALLOCATOR(allocator);
 		
@@ -126,6 +238,187 @@ namespace TestsAllocator {
 		ASSERT_EQUAL(fifth, third, "");
 	}
 	
+	void compare_random_with_reference() {
+		std::vector<uint64_t>* buffer = new std::vector<uint64_t>();
+		qgl::Allocator allocator(buffer,
+				[](void* obj, uint32_t size) {
+					((std::vector<uint64_t>*)obj)->resize(size);
+				},
+				[](void* obj) {
+					delete (std::vector<uint64_t>*)obj;
+				});
+		std::vector<uint64_t> referenceBuffer;
+		ReferenceAllocator reference(&referenceBuffer);
+		
+		std::mt19937 mt(12345);
+		std::map<uint32_t, uint32_t> live, referenceLive;
+		std::vector<std::pair<uint32_t, uint32_t>> ranges, referenceRanges;
+		bool disjoint = true, referenceDisjoint = true;
+		
+		for(int i=0; i<20000; ++i) {
+			if(ranges.empty() || mt()%5 < 3) {
+				uint32_t size = (mt()%4 == 0) ? (mt()%4000)+1 : (mt()%64)+1;
+				uint32_t a = allocator.Allocate(size);
+				uint32_t b = reference.Allocate(size);
+				disjoint &= InsertRange(live, a, size, buffer->size());
+				referenceDisjoint &= InsertRange(referenceLive, b, size,
+						referenceBuffer.size());
+				ranges.push_back({a, size});
+				referenceRanges.push_back({b, size});
+			} else {
+				uint32_t id = mt() % ranges.size();
+				allocator.Free(ranges[id].first, ranges[id].second);
+				reference.Free(referenceRanges[id].first,
+						referenceRanges[id].second);
+				live.erase(ranges[id].first);
+				referenceLive.erase(referenceRanges[id].first);
+				std::swap(ranges[id], ranges.back());
+				std::swap(referenceRanges[id], referenceRanges.back());
+				ranges.pop_back();
+				referenceRanges.pop_back();
+			}
+		}
+		
+		ASSERT_TRUE(disjoint, "Allocated ranges cannot overlap");
+		ASSERT_TRUE(referenceDisjoint, "Reference ranges cannot overlap");
+		const bool comparableCapacity
+			= buffer->size() <= referenceBuffer.size()*2;
+		ASSERT_TRUE(comparableCapacity,
+				"Capacity has to stay comparable with reference");
+		
+		for(uint32_t i=0; i<ranges.size(); ++i) {
+			allocator.Free(ranges[i].first, ranges[i].second);
+			reference.Free(referenceRanges[i].first, referenceRanges[i].second);
+		}
+		
+		// after freeing everything both allocators have to coalesce into one
+		// range, so whole capacity can be allocated without growing
+		const uint32_t capacity = buffer->size();
+		const uint32_t referenceCapacity = referenceBuffer.size();
+		const uint32_t referenceFreeRanges = reference.freeRanges.size();
+		const uint32_t whole = allocator.Allocate(capacity);
+		const uint32_t referenceWhole = reference.Allocate(referenceCapacity);
+		const uint32_t capacityAfter = buffer->size();
+		const uint32_t referenceCapacityAfter = referenceBuffer.size();
+		ASSERT_EQUAL(referenceFreeRanges, 1, "");
+		ASSERT_EQUAL(whole, 0, "");
+		ASSERT_EQUAL(referenceWhole, 0, "");
+		ASSERT_EQUAL(capacityAfter, capacity, "Allocator cannot grow");
+		ASSERT_EQUAL(referenceCapacityAfter, referenceCapacity, "");
+	}
+	
+	void relocate_and_shrink() {
+		std::vector<uint64_t>* buffer = new std::vector<uint64_t>();
+		qgl::Allocator allocator(buffer,
+				[](void* obj, uint32_t size) {
+					((std::vector<uint64_t>*)obj)->resize(size);
+				},
+				[](void* obj) {
+					delete (std::vector<uint64_t>*)obj;
+				});
+		uint32_t first = allocator.Allocate(100);
+		uint32_t second = allocator.Allocate(100);
+		uint32_t third = allocator.Allocate(100);
+		allocator.Free(first, 100);
+		
+		qgl::Allocator::Relocation r;
+		const bool relocated = allocator.Relocate(1000, r);
+		ASSERT_EQUAL(relocated, true, "");
+		ASSERT_EQUAL(r.from, third, "Last range has to be moved");
+		ASSERT_EQUAL(r.to, first, "");
+		ASSERT_EQUAL(r.count, 100, "");
+		
+		const bool relocatedAgain = allocator.Relocate(1000, r);
+		ASSERT_EQUAL(relocatedAgain, false, "Nothing can be moved lower");
+		
+		const uint32_t capacity = allocator.ShrinkToFit(0);
+		const uint32_t bufferSize = buffer->size();
+		ASSERT_EQUAL(capacity, 250, "");
+		ASSERT_EQUAL(bufferSize, 250, "");
+		
+		uint32_t fourth = allocator.Allocate(10);
+		ASSERT_EQUAL(fourth, 200, "");
+		allocator.Free(second, 100);
+		allocator.Free(r.to, 100);
+	}
+	
+	void relocate_many_compacts_all() {
+		ALLOCATOR(allocator);
+		std::vector<uint32_t> ranges;
+		for(uint32_t i=0; i<400; ++i) {
+			ranges.emplace_back(allocator.Allocate(10));
+		}
+		for(uint32_t i=0; i<400; i+=2) {
+			allocator.Free(ranges[i], 10);
+		}
+		std::set<uint32_t> live;
+		for(uint32_t i=1; i<400; i+=2) {
+			live.insert(ranges[i]);
+		}
+		qgl::Allocator::Relocation r;
+		uint32_t relocations = 0;
+		bool valid = true;
+		while(allocator.Relocate(10, r)) {
+			valid &= live.erase(r.from) == 1;
+			valid &= live.insert(r.to).second;
+			++relocations;
+		}
+		ASSERT_TRUE(valid, "");
+		const uint32_t end = *live.rbegin() + 10;
+		ASSERT_EQUAL(end, 2000, "All ranges moved to the beginning");
+		ASSERT_EQUAL(relocations, 100, "");
+	}
+	
+	void stats_track_allocations() {
+		ALLOCATOR(allocator);
+		uint32_t first = allocator.Allocate(100);
+		allocator.Allocate(3);
+		allocator.Allocate(50);
+		allocator.Free(first, 100);
+		
+		qgl::Allocator::Stats stats = allocator.GetStats();
+		ASSERT_EQUAL(stats.capacity, 4096, "");
+		ASSERT_EQUAL(stats.liveElements, 53, "");
+		ASSERT_EQUAL(stats.liveAllocations, 2, "");
+		ASSERT_EQUAL(stats.freeElements, 4043, "");
+		ASSERT_EQUAL(stats.freeRanges, 2, "");
+		ASSERT_EQUAL(stats.largestFreeRange, 3943, "");
+		ASSERT_EQUAL(stats.growthCount, 1, "");
+		ASSERT_EQUAL(stats.grownElements, 4096, "");
+		ASSERT_EQUAL(stats.allocationSizeHistogram[1], 1, "");
+		ASSERT_EQUAL(stats.allocationSizeHistogram[5], 1, "");
+		ASSERT_EQUAL(stats.allocationSizeHistogram[6], 0, "");
+		const bool fragmented = stats.fragmentation > 0.02f &&
+			stats.fragmentation < 0.03f;
+		ASSERT_EQUAL(fragmented, true, "");
+	}
+	
+	void deferred_free_waits_for_epoch() {
+		ALLOCATOR(allocator);
+		allocator.BeginEpoch(1);
+		uint32_t first = allocator.Allocate(100);
+		uint32_t second = allocator.Allocate(100);
+		allocator.FreeDeferred(first, 100);
+		allocator.BeginEpoch(2);
+		allocator.FreeDeferred(second, 100);
+		
+		uint32_t third = allocator.Allocate(100);
+		ASSERT_NOTEQUAL(third, first, "Quarantined range cannot be reused");
+		const uint32_t quarantined = allocator.GetStats().quarantinedElements;
+		ASSERT_EQUAL(quarantined, 200, "");
+		
+		allocator.ReleaseEpochs(1);
+		uint32_t fourth = allocator.Allocate(100);
+		ASSERT_EQUAL(fourth, first, "");
+		const uint32_t quarantinedAfter =
+			allocator.GetStats().quarantinedElements;
+		ASSERT_EQUAL(quarantinedAfter, 100, "");
+		
+		allocator.ReleaseEpochs(2);
+		uint32_t fifth = allocator.Allocate(100);
+		ASSERT_EQUAL(fifth, second, "");
+	}
+	
 	void RunAll() {
 		allocate_one_two();
 		allocate_two_free_allocate_two();
@@ -134,6 +427,11 @@ namespace TestsAllocator {
 		free_neighboring_back();
 		free_single_end_allocate_more();
 		free_single_end_allocate_more_2();
+		compare_random_with_reference();
+		relocate_and_shrink();
+		relocate_many_compacts_all();
+		stats_track_allocations();
+		deferred_free_waits_for_epoch();
 	}
 }
 
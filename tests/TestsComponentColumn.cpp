@@ -0,0 +1,123 @@
+#include <cstdio>
+#include <cstdlib>
+
+#include <vector>
+
+#include "../include/quickgl/util/ComponentColumn.hpp"
+
+#include "Test.hpp"
+
+namespace TestsComponentColumn {
+	void host_only_set_and_reset() {
+		qgl::ComponentColumn<int> column(nullptr, "health",
+				qgl::COMPONENT_STORAGE_HOST, 0, 7);
+		column.SetAtOffset(3, 42);
+		column.SetAtOffset(1, 13);
+		const int* data = column.HostData();
+		ASSERT_EQUAL(data[0], 7, "");
+		ASSERT_EQUAL(data[1], 13, "");
+		ASSERT_EQUAL(data[2], 7, "");
+		ASSERT_EQUAL(data[3], 42, "");
+		
+		// reset range may exceed host size
+		column.Reset(1, 10);
+		data = column.HostData();
+		ASSERT_EQUAL(data[0], 7, "");
+		ASSERT_EQUAL(data[1], 7, "");
+		ASSERT_EQUAL(data[3], 7, "");
+		
+		// without engine entities cannot be resolved
+		const int value = column.Get(3);
+		ASSERT_EQUAL(value, 7, "");
+	}
+	
+	void move_host() {
+		qgl::ComponentColumn<int> column(nullptr, "value",
+				qgl::COMPONENT_STORAGE_HOST, 0, -1);
+		for(int i=0; i<8; ++i) {
+			column.SetAtOffset(i, i*10);
+		}
+		const qgl::EntityMove moves[4] = {
+			{5, 1},
+			{6, 2},
+			{20, 3}, // source out of range gives default value
+			{1, 30}, // destination out of range is ignored
+		};
+		column.MoveHost(moves, 4);
+		const int* data = column.HostData();
+		ASSERT_EQUAL(data[0], 0, "");
+		ASSERT_EQUAL(data[1], 50, "");
+		ASSERT_EQUAL(data[2], 60, "");
+		ASSERT_EQUAL(data[3], -1, "");
+		ASSERT_EQUAL(data[4], 40, "");
+		ASSERT_EQUAL(data[7], 70, "");
+	}
+	
+	void copy_host_from() {
+		qgl::ComponentColumn<int> src(nullptr, "value",
+				qgl::COMPONENT_STORAGE_HOST, 0, -1);
+		qgl::ComponentColumn<int> dst(nullptr, "value",
+				qgl::COMPONENT_STORAGE_HOST, 1, -2);
+		for(int i=0; i<5; ++i) {
+			src.SetAtOffset(i, 100+i);
+		}
+		dst.SetAtOffset(0, 5);
+		
+		const uint32_t offsets[3] = {4, 1, 100};
+		dst.CopyHostFrom(src, offsets, 3, 2);
+		const int* data = dst.HostData();
+		ASSERT_EQUAL(data[0], 5, "");
+		ASSERT_EQUAL(data[1], -2, "");
+		ASSERT_EQUAL(data[2], 104, "");
+		ASSERT_EQUAL(data[3], 101, "");
+		ASSERT_EQUAL(data[4], -2, "");
+		
+		// columns of different value type are not copied
+		qgl::ComponentColumn<float> other(nullptr, "value",
+				qgl::COMPONENT_STORAGE_HOST, 0, 1.0f);
+		other.SetAtOffset(0, 3.0f);
+		const uint32_t first = 0;
+		dst.CopyHostFrom(other, &first, 1, 0);
+		data = dst.HostData();
+		ASSERT_EQUAL(data[0], 5, "");
+	}
+	
+	void copy_from_same_type_only() {
+		qgl::ComponentColumn<int> src(nullptr, "value",
+				qgl::COMPONENT_STORAGE_HOST, 0, -1);
+		qgl::ComponentColumn<int> dst(nullptr, "value",
+				qgl::COMPONENT_STORAGE_HOST, 1, -2);
+		qgl::ComponentColumn<float> other(nullptr, "value",
+				qgl::COMPONENT_STORAGE_HOST, 0, 1.0f);
+		src.SetAtOffset(3, 33);
+		
+		const uint32_t offset = 3;
+		const bool copied = dst.CopyFrom(src, &offset, 1, 0);
+		ASSERT_TRUE(copied, "");
+		ASSERT_EQUAL(dst.HostData()[0], 33, "");
+		
+		const bool copiedOther = dst.CopyFrom(other, &offset, 1, 0);
+		ASSERT_FALSE(copiedOther, "");
+		ASSERT_EQUAL(dst.HostData()[0], 33, "");
+	}
+	
+	void gpu_column_requires_engine() {
+		bool thrown = false;
+		try {
+			qgl::ComponentColumn<int> column(nullptr, "value",
+					qgl::COMPONENT_STORAGE_HOST_AND_GPU, 0);
+		} catch(const char*) {
+			thrown = true;
+		}
+		ASSERT_TRUE(thrown, "");
+	}
+	
+	void RunAll() {
+		host_only_set_and_reset();
+		move_host();
+		copy_host_from();
+		copy_from_same_type_only();
+		gpu_column_requires_engine();
+	}
+}
+
@@ -0,0 +1,189 @@
+#include <cstdio>
+#include <cstdlib>
+
+#include <vector>
+#include <map>
+#include <chrono>
+#include <thread>
+
+#include "../include/quickgl/util/DelayedEvents.hpp"
+
+#include "Test.hpp"
+
+namespace TestsDelayedEvents {
+	
+	using Clock = std::chrono::steady_clock;
+	
+	// previous std::multimap based implementation, used as reference
+	class ReferenceDelayedEvents {
+	public:
+		
+		void PushEvent_(int msDelay, qgl::Task&& event) {
+			events.emplace(Clock::now() + std::chrono::milliseconds(msDelay),
+					std::move(event));
+		}
+		
+		bool ExecuteOneEvent() {
+			if(events.empty() || events.begin()->first > Clock::now()) {
+				return false;
+			}
+			qgl::Task event = std::move(events.begin()->second);
+			events.erase(events.begin());
+			event();
+			return true;
+		}
+		
+		bool HasAnyEvents() {
+			return !events.empty();
+		}
+		
+	private:
+		
+		std::multimap<Clock::time_point, qgl::Task> events;
+	};
+	
+	struct Fired {
+		uint32_t id;
+		double lateness; // in ms
+	};
+	
+	template<typename T>
+	void Schedule(T& events, std::vector<Fired>& fired, uint32_t id,
+			int msDelay) {
+		const Clock::time_point deadline = Clock::now()
+			+ std::chrono::milliseconds(msDelay);
+		events.PushEvent_(msDelay, qgl::Task([&fired, id, deadline]() {
+					fired.push_back({id, std::chrono::duration<double,
+						std::milli>(Clock::now() - deadline).count()});
+				}));
+	}
+	
+	void order_and_latency_against_reference() {
+		qgl::DelayedEvents wheel;
+		ReferenceDelayedEvents reference;
+		std::vector<Fired> wheelFired, referenceFired;
+		
+		// delays spaced by 3 ms, up to beyond first level of wheel, with
+		// duplicates that need to fire in order of insertion
+		uint32_t id = 0;
+		for(int i=0; i<200; ++i) {
+			const int delay = ((i*37) % 200) * 3;
+			Schedule(wheel, wheelFired, id, delay);
+			Schedule(reference, referenceFired, id, delay);
+			++id;
+			if(i % 5 == 0) {
+				Schedule(wheel, wheelFired, id, delay);
+				Schedule(reference, referenceFired, id, delay);
+				++id;
+			}
+		}
+		
+		while(wheel.HasAnyEvents() || reference.HasAnyEvents()) {
+			wheel.ExecuteExpiredEvents(8);
+			while(reference.ExecuteOneEvent()) {
+			}
+			std::this_thread::sleep_for(std::chrono::microseconds(200));
+		}
+		
+		const uint32_t count = wheelFired.size();
+		ASSERT_EQUAL(count, id, "");
+		const uint32_t referenceCount = referenceFired.size();
+		ASSERT_EQUAL(referenceCount, id, "");
+		
+		bool sameOrder = true;
+		bool neverEarly = true;
+		double wheelLateness = 0, referenceLateness = 0;
+		for(uint32_t i=0; i<count && i<referenceCount; ++i) {
+			sameOrder &= wheelFired[i].id == referenceFired[i].id;
+			neverEarly &= wheelFired[i].lateness >= 0;
+			wheelLateness += wheelFired[i].lateness;
+			referenceLateness += referenceFired[i].lateness;
+		}
+		ASSERT_TRUE(sameOrder, "");
+		ASSERT_TRUE(neverEarly, "");
+		// millisecond resolution adds at most 1 ms to every event
+		const double extraLateness = (wheelLateness - referenceLateness)
+			/ (count ? count : 1);
+		const bool withinResolution = extraLateness < 5.0;
+		ASSERT_TRUE(withinResolution, "");
+	}
+	
+	void cancel() {
+		qgl::DelayedEvents events;
+		std::vector<uint32_t> executed;
+		std::vector<qgl::DelayedEvents::Handle> handles;
+		for(uint32_t i=0; i<100; ++i) {
+			handles.emplace_back(events.PushEvent_(i%10,
+						qgl::Task([&executed, i]() {
+							executed.emplace_back(i);
+						})));
+		}
+		uint32_t cancelled = 0;
+		for(uint32_t i=0; i<100; i+=2) {
+			cancelled += events.Cancel(handles[i]) ? 1 : 0;
+		}
+		ASSERT_EQUAL(cancelled, 50, "");
+		const bool cancelledTwice = events.Cancel(handles[0]);
+		ASSERT_FALSE(cancelledTwice, "");
+		
+		while(events.HasAnyEvents()) {
+			events.ExecuteExpiredEvents();
+			std::this_thread::sleep_for(std::chrono::milliseconds(1));
+		}
+		const uint32_t count = executed.size();
+		ASSERT_EQUAL(count, 50, "");
+		bool onlyOdd = true;
+		for(uint32_t v : executed) {
+			onlyOdd &= (v & 1) == 1;
+		}
+		ASSERT_TRUE(onlyOdd, "");
+		const bool cancelledExecuted = events.Cancel(handles[1]);
+		ASSERT_FALSE(cancelledExecuted, "");
+		
+		// handle of freed timer must not cancel new timer reusing its slot
+		qgl::DelayedEvents::Handle reused = events.PushEvent_(0,
+				qgl::Task([](){}));
+		bool staleCancelled = false;
+		for(uint32_t i=0; i<100; ++i) {
+			if(handles[i].index == reused.index) {
+				staleCancelled |= events.Cancel(handles[i]);
+			}
+		}
+		ASSERT_FALSE(staleCancelled, "");
+		const bool reusedCancelled = events.Cancel(reused);
+		ASSERT_TRUE(reusedCancelled, "");
+		const bool hasEvents = events.HasAnyEvents();
+		ASSERT_FALSE(hasEvents, "");
+	}
+	
+	void next_event_time() {
+		qgl::DelayedEvents events;
+		uint32_t executed = 0;
+		events.PushEvent_(10000, qgl::Task([&executed]() { ++executed; }));
+		const uint32_t early = events.ExecuteExpiredEvents();
+		ASSERT_EQUAL(early, 0, "");
+		const bool farAway = events.GetNextEventTime()
+			> Clock::now() + std::chrono::seconds(9);
+		ASSERT_TRUE(farAway, "");
+		
+		// earlier event lowers next event time and is executed on time
+		events.PushEvent_(1, qgl::Task([&executed]() { ++executed; }));
+		const bool lowered = events.GetNextEventTime()
+			<= Clock::now() + std::chrono::milliseconds(2);
+		ASSERT_TRUE(lowered, "");
+		std::this_thread::sleep_for(std::chrono::milliseconds(3));
+		const uint32_t due = events.ExecuteExpiredEvents();
+		ASSERT_EQUAL(due, 1, "");
+		ASSERT_EQUAL(executed, 1, "");
+		const bool raised = events.GetNextEventTime()
+			> Clock::now() + std::chrono::seconds(9);
+		ASSERT_TRUE(raised, "");
+	}
+	
+	void RunAll() {
+		order_and_latency_against_reference();
+		cancel();
+		next_event_time();
+	}
+}
+
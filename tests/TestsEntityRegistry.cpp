@@ -0,0 +1,68 @@
+#include <cstdio>
+#include <cstdlib>
+
+#include <vector>
+
+#include "../include/quickgl/util/EntityRegistry.hpp"
+
+#include "Test.hpp"
+
+namespace TestsEntityRegistry {
+	void create_lookup_destroy() {
+		qgl::EntityRegistry registry;
+		uint32_t first = registry.Create(3, 10);
+		uint32_t second = registry.Create(4, 11);
+		
+		ASSERT_NOTEQUAL(first, 0, "");
+		ASSERT_NOTEQUAL(first, second, "");
+		const uint32_t firstOffset = registry.GetOffset(first);
+		ASSERT_EQUAL(firstOffset, 10, "");
+		const uint32_t secondPipeline = registry.GetPipelineId(second);
+		ASSERT_EQUAL(secondPipeline, 4, "");
+		
+		const bool destroyed = registry.Destroy(first);
+		ASSERT_TRUE(destroyed, "");
+		const uint32_t count = registry.Count();
+		ASSERT_EQUAL(count, 1, "");
+	}
+	
+	void stale_handle_is_detected() {
+		qgl::EntityRegistry registry;
+		uint32_t first = registry.Create(1, 5);
+		registry.Destroy(first);
+		uint32_t second = registry.Create(1, 6);
+		
+		ASSERT_NOTEQUAL(first, second, "");
+		const bool staleValid = registry.IsValid(first);
+		ASSERT_FALSE(staleValid, "");
+		const uint32_t staleOffset = registry.GetOffset(first);
+		ASSERT_EQUAL(staleOffset, qgl::EntityRegistry::INVALID_OFFSET, "");
+		const bool staleDestroyed = registry.Destroy(first);
+		ASSERT_FALSE(staleDestroyed, "");
+		const bool staleSet = registry.SetOffset(first, 7);
+		ASSERT_FALSE(staleSet, "");
+		const uint32_t secondOffset = registry.GetOffset(second);
+		ASSERT_EQUAL(secondOffset, 6, "");
+	}
+	
+	void batch_create_is_contiguous() {
+		qgl::EntityRegistry registry;
+		std::vector<uint32_t> handles(1000);
+		registry.Create(2, 100, handles.size(), handles.data());
+		bool correct = true;
+		for(uint32_t i=0; i<handles.size(); ++i) {
+			if(registry.GetOffset(handles[i]) != 100+i)
+				correct = false;
+		}
+		ASSERT_TRUE(correct, "");
+		const uint32_t count = registry.Count();
+		ASSERT_EQUAL(count, 1000, "");
+	}
+	
+	void RunAll() {
+		create_lookup_destroy();
+		stale_handle_is_detected();
+		batch_create_is_contiguous();
+	}
+}
+
@@ -0,0 +1,101 @@
+#include <cstdio>
+#include <cstdlib>
+
+#include <vector>
+#include <memory>
+#include <thread>
+#include <atomic>
+
+#include "../include/quickgl/util/EventQueue.hpp"
+
+#include "Test.hpp"
+
+namespace TestsEventQueue {
+	std::vector<uint32_t> executed;
+	
+	void Record(uint32_t value) {
+		executed.emplace_back(value);
+	}
+	
+	void fifo_through_overflow() {
+		qgl::EventQueue queue(8);
+		executed.clear();
+		for(uint32_t i=0; i<100; ++i) {
+			queue.PushEvent(Record, i);
+		}
+		while(queue.ExecuteOneEvent()) {
+		}
+		const uint32_t count = executed.size();
+		ASSERT_EQUAL(count, 100, "");
+		bool ordered = true;
+		for(uint32_t i=0; i<executed.size(); ++i) {
+			ordered &= executed[i] == i;
+		}
+		ASSERT_TRUE(ordered, "");
+		const bool hasEvents = queue.HasAnyEvents();
+		ASSERT_FALSE(hasEvents, "");
+	}
+	
+	void move_only_and_big_captures() {
+		qgl::EventQueue queue(4);
+		std::unique_ptr<uint32_t> ptr = std::make_unique<uint32_t>(7);
+		uint32_t result = 0;
+		queue.PushEvent_(qgl::Task([p=std::move(ptr), &result]() {
+					result += *p;
+				}));
+		// bigger than inline storage of Task
+		uint64_t big[16];
+		for(uint32_t i=0; i<16; ++i) {
+			big[i] = i;
+		}
+		queue.PushEvent_(qgl::Task([big, &result]() {
+					for(uint64_t v : big) {
+						result += v;
+					}
+				}));
+		while(queue.ExecuteOneEvent()) {
+		}
+		ASSERT_EQUAL(result, 7+120, "");
+	}
+	
+	void concurrent_producers_and_consumers() {
+		qgl::EventQueue queue(64);
+		const uint32_t PRODUCERS = 4, PER_PRODUCER = 20000;
+		std::atomic<uint64_t> sum = 0;
+		std::atomic<uint32_t> done = 0;
+		std::vector<std::thread> threads;
+		for(uint32_t p=0; p<PRODUCERS; ++p) {
+			threads.emplace_back([&, p]() {
+				for(uint32_t i=0; i<PER_PRODUCER; ++i) {
+					const uint64_t v = p*PER_PRODUCER + i;
+					queue.PushEvent_(qgl::Task([&sum, &done, v]() {
+								sum += v;
+								done++;
+							}));
+				}
+			});
+		}
+		for(uint32_t c=0; c<2; ++c) {
+			threads.emplace_back([&]() {
+				while(done.load() < PRODUCERS*PER_PRODUCER) {
+					if(!queue.ExecuteOneEvent()) {
+						std::this_thread::yield();
+					}
+				}
+			});
+		}
+		for(std::thread& t : threads) {
+			t.join();
+		}
+		const uint64_t n = PRODUCERS*PER_PRODUCER;
+		const uint64_t result = sum.load();
+		ASSERT_EQUAL(result, n*(n-1)/2, "");
+	}
+	
+	void RunAll() {
+		fifo_through_overflow();
+		move_only_and_big_captures();
+		concurrent_producers_and_consumers();
+	}
+}
+
@@ -0,0 +1,143 @@
+#include <cstdio>
+#include <cstdlib>
+
+#include <vector>
+#include <memory>
+#include <thread>
+#include <atomic>
+#include <mutex>
+
+#include "../include/quickgl/util/Scheduler.hpp"
+#include "../include/quickgl/util/FrameTaskGraph.hpp"
+
+#include "Test.hpp"
+
+namespace TestsFrameTaskGraph {
+	
+	void RunFrame(qgl::FrameTaskGraph& graph) {
+		graph.BeginFrame();
+		while(graph.HasPendingJobs()) {
+			if(!graph.ExecuteOne()) {
+				std::this_thread::yield();
+			}
+		}
+		graph.EndFrame();
+	}
+	
+	void dependencies_order() {
+		auto scheduler = std::make_shared<qgl::Scheduler>(3);
+		scheduler->Start();
+		qgl::FrameTaskGraph graph(scheduler);
+		
+		std::mutex mutex;
+		std::vector<uint32_t> order;
+		auto record = [&](uint32_t v) {
+			return qgl::Task([&, v]() {
+					std::lock_guard lock(mutex);
+					order.emplace_back(v);
+				});
+		};
+		
+		for(uint32_t frame=0; frame<50; ++frame) {
+			order.clear();
+			// diamond: 0 -> {1, 2} -> 3, with 3 on render thread
+			auto a = graph.AddJob("a", record(0));
+			auto b = graph.AddJob("b", record(1));
+			auto c = graph.AddJob("c", record(2));
+			auto d = graph.AddJob("d", record(3),
+					qgl::FrameTaskGraph::JOB_RENDER_THREAD);
+			graph.AddDependency(b, a);
+			graph.AddDependency(c, a);
+			graph.AddDependency(d, b);
+			graph.AddDependency(d, c);
+			graph.RunBeforeStage(d, "stage");
+			RunFrame(graph);
+			
+			const uint32_t count = order.size();
+			ASSERT_EQUAL(count, 4, "");
+			const bool ordered = count == 4 && order[0] == 0 && order[3] == 3;
+			ASSERT_TRUE(ordered, "");
+			const bool blocked = graph.IsStageBlocked("stage");
+			ASSERT_FALSE(blocked, "");
+		}
+		scheduler->Stop();
+	}
+	
+	void render_thread_jobs_and_blocking() {
+		auto scheduler = std::make_shared<qgl::Scheduler>(2);
+		scheduler->Start();
+		qgl::FrameTaskGraph graph(scheduler);
+		
+		const std::thread::id renderThread = std::this_thread::get_id();
+		std::atomic<bool> onRenderThread = false;
+		std::atomic<bool> started = false;
+		std::atomic<bool> release = false;
+		auto blocker = graph.AddJob("blocker", [&]() {
+				started = true;
+				while(!release) {
+					std::this_thread::yield();
+				}
+			});
+		auto upload = graph.AddJob("upload", [&]() {
+				onRenderThread = std::this_thread::get_id() == renderThread;
+			}, qgl::FrameTaskGraph::JOB_RENDER_THREAD);
+		graph.AddDependency(upload, blocker);
+		graph.RunBeforeStage(blocker, "culling");
+		
+		graph.BeginFrame();
+		while(!started) {
+			std::this_thread::yield();
+		}
+		const bool blocked = graph.IsStageBlocked("culling");
+		ASSERT_TRUE(blocked, "");
+		const bool otherBlocked = graph.IsStageBlocked("other");
+		ASSERT_FALSE(otherBlocked, "");
+		
+		bool addThrew = false;
+		try {
+			graph.AddJob("late", [](){});
+		} catch(const char* e) {
+			addThrew = true;
+		}
+		ASSERT_TRUE(addThrew, "");
+		
+		release = true;
+		graph.EndFrame();
+		const bool unblocked = graph.IsStageBlocked("culling");
+		ASSERT_FALSE(unblocked, "");
+		const bool renderThreadJob = onRenderThread;
+		ASSERT_TRUE(renderThreadJob, "");
+		scheduler->Stop();
+	}
+	
+	void execute_only_own_jobs() {
+		// workers are not started, so render thread has to run every job
+		auto scheduler = std::make_shared<qgl::Scheduler>(2);
+		qgl::FrameTaskGraph graph(scheduler);
+		
+		std::atomic<bool> foreignExecuted = false;
+		scheduler->ScheduleTask_(qgl::Task([&]() {
+					foreignExecuted = true;
+				}));
+		
+		std::atomic<uint32_t> executed = 0;
+		auto a = graph.AddJob("a", [&]() { ++executed; });
+		auto b = graph.AddJob("b", [&]() { ++executed; });
+		auto c = graph.AddJob("c", [&]() { ++executed; });
+		graph.AddDependency(c, a);
+		graph.AddDependency(c, b);
+		RunFrame(graph);
+		
+		const uint32_t count = executed;
+		ASSERT_EQUAL(count, 3, "");
+		const bool foreign = foreignExecuted;
+		ASSERT_FALSE(foreign, "");
+	}
+	
+	void RunAll() {
+		dependencies_order();
+		render_thread_jobs_and_blocking();
+		execute_only_own_jobs();
+	}
+}
+
@@ -4,6 +4,8 @@
 #include <cstdlib>
 
 #include <map>
+#include <vector>
+#include <algorithm>
 
 #include "../include/quickgl/util/IdsManager.hpp"
 
@@ -29,8 +31,54 @@ namespace TestsIdsManager {
 		ASSERT_EQUAL(first, second-1, "");
 	}
 	
+	void bulk_allocate_and_free() {
+		qgl::IdsManager mg;
+		std::vector<uint32_t> ids(100);
+		mg.GetNewIds(100, ids.data());
+		for(uint32_t i=0; i<100; ++i) {
+			ASSERT_EQUAL(ids[i], i, "");
+		}
+		
+		const uint32_t freed[3] = {10, 50, 99};
+		mg.FreeIds(freed, 3);
+		const uint32_t count = mg.CountIds();
+		ASSERT_EQUAL(count, 97, "");
+		const bool used50 = mg.IsUsed(50);
+		ASSERT_FALSE(used50, "");
+		
+		// freed ids are reused first, then new consecutive ones follow
+		std::vector<uint32_t> more(5);
+		mg.GetNewIds(5, more.data());
+		ASSERT_EQUAL(more[0], 99, "");
+		ASSERT_EQUAL(more[1], 50, "");
+		ASSERT_EQUAL(more[2], 10, "");
+		ASSERT_EQUAL(more[3], 100, "");
+		ASSERT_EQUAL(more[4], 101, "");
+		
+		const uint32_t* used = mg.GetArrayOfUsedIds();
+		std::vector<uint32_t> sorted(used, used+mg.CountIds());
+		std::sort(sorted.begin(), sorted.end());
+		for(uint32_t i=0; i<sorted.size(); ++i) {
+			ASSERT_EQUAL(sorted[i], i, "");
+		}
+	}
+	
+	void free_unused_id_is_ignored() {
+		qgl::IdsManager mg;
+		uint32_t first = mg.GetNewId();
+		mg.FreeId(first);
+		mg.FreeId(first);
+		mg.FreeId(1000);
+		uint32_t second = mg.GetNewId();
+		uint32_t third = mg.GetNewId();
+		ASSERT_EQUAL(second, first, "");
+		ASSERT_EQUAL(third, first+1, "");
+	}
+	
 	void RunAll() {
 		free_two_allocate_three();
+		bulk_allocate_and_free();
+		free_unused_id_is_ignored();
 	}
 }
 
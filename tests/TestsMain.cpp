@@ -11,9 +11,34 @@ namespace TestsIdsManager {
 	void RunAll();
 }
 
+namespace TestsEntityRegistry {
+	void RunAll();
+}
+
+namespace TestsEventQueue {
+	void RunAll();
+}
+
+namespace TestsDelayedEvents {
+	void RunAll();
+}
+
+namespace TestsFrameTaskGraph {
+	void RunAll();
+}
+
+namespace TestsComponentColumn {
+	void RunAll();
+}
+
 int main() {
 	TestsAllocator::RunAll();
 	TestsIdsManager::RunAll();
+	TestsEntityRegistry::RunAll();
+	TestsEventQueue::RunAll();
+	TestsDelayedEvents::RunAll();
+	TestsFrameTaskGraph::RunAll();
+	TestsComponentColumn::RunAll();
 	
 	int correct = 0;
 	for(int i=0; i<testsInfos.size(); ++i) {